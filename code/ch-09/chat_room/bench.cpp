@@ -0,0 +1,170 @@
+/**
+ * @file bench.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief 比较聊天室服务器 poll 和 epoll 两种模式的测试客户端
+ *
+ * 先建立 idle 个空闲连接，它们加入 idle 房间后不再发送数据；再建立两个活跃连接，
+ * 加入 bench 房间后互相发送消息：A 发送一条，B 收到后回复，A 收到回复算完成一次
+ * 往返。活跃连接的数量固定，空闲连接越多，poll 模式每次调用要扫描的连接就越多，
+ * 而 epoll 模式只处理有事件的连接，往返延迟基本不变：
+ *
+ *     server -u 20000 127.0.0.1 12345         # poll
+ *     server -e 127.0.0.1 12345               # epoll
+ *     bench -n 10000 -d 5 127.0.0.1 12345
+*/
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../../ch-16/latency_histogram.h"
+#include "frame.h"
+
+static long long now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int connect_to(const sockaddr_in & address) {
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+    if (connect(sockfd, (sockaddr *)&address, sizeof(address)) < 0) {
+        close(sockfd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return sockfd;
+}
+
+/**
+ * @brief 读满 len 字节
+*/
+static bool recv_all(int sockfd, char * buf, int len) {
+    while (len > 0) {
+        int ret = recv(sockfd, buf, len, 0);
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+/**
+ * @brief 发送一帧
+*/
+static bool send_frame(int sockfd, const char * payload, int len) {
+    char frame[FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD];
+    int n = frame_encode(frame, payload, len);
+    return send(sockfd, frame, n, 0) == n;
+}
+
+/**
+ * @brief 接收一帧，负载保存在 buf 中，长度至少为 MAX_FRAME_PAYLOAD
+*/
+static bool recv_frame(int sockfd, char * buf) {
+    char header[FRAME_HEADER_SIZE];
+    uint32_t len;
+    if (!recv_all(sockfd, header, FRAME_HEADER_SIZE)) {
+        return false;
+    }
+    memcpy(&len, header, FRAME_HEADER_SIZE);
+    len = ntohl(len);
+    return len <= (uint32_t)MAX_FRAME_PAYLOAD && recv_all(sockfd, buf, len);
+}
+
+/**
+ * @brief 发送一条命令并等待服务器的回复
+*/
+static bool command(int sockfd, const char * cmd) {
+    char buf[MAX_FRAME_PAYLOAD];
+    return send_frame(sockfd, cmd, strlen(cmd)) && recv_frame(sockfd, buf);
+}
+
+int main(int argc, char * argv[]) {
+    const char * name = basename(argv[0]);
+    int idle_number = 1000;
+    int duration = 5;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+        switch (opt) {
+            case 'n': idle_number = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || argc - optind < 2 || idle_number < 0 || duration <= 0) {
+        printf("usage: %s [-n idle_clients] [-d seconds] ip_address port_number\n", name);
+        return 1;
+    }
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[optind], &address.sin_addr);
+    address.sin_port = htons(atoi(argv[optind + 1]));
+
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    std::vector<int> idle;
+    for (int i=0; i<idle_number; ++i) {
+        int sockfd = connect_to(address);
+        if (sockfd < 0 || !command(sockfd, "/join idle\n")) {
+            printf("connect failed after %d idle clients: %s\n", i, strerror(errno));
+            return 1;
+        }
+        idle.push_back(sockfd);
+    }
+    int a = connect_to(address);
+    int b = connect_to(address);
+    if (a < 0 || b < 0 || !command(a, "/join bench\n") || !command(b, "/join bench\n")) {
+        printf("connect failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    const char msg[] = "ping-pong-ping-pong-ping-pong\n";
+    const int len = sizeof(msg) - 1;
+    char buf[MAX_FRAME_PAYLOAD];
+    latency_histogram latency;
+    long long deadline = now_us() + duration * 1000000LL;
+    long long start;
+    while ((start = now_us()) < deadline) {
+        if (!send_frame(a, msg, len) || !recv_frame(b, buf)
+            || !send_frame(b, msg, len) || !recv_frame(a, buf)) {
+            printf("connection lost: %s\n", strerror(errno));
+            return 1;
+        }
+        latency.record(now_us() - start);
+    }
+
+    printf("%d idle clients: %lld round trips in %d s, %.1f round trips/s\n",
+           idle_number, latency.count(), duration, (double)latency.count() / duration);
+    printf("round trip latency (us): min %lld mean %.0f p50 %lld p90 %lld p99 %lld max %lld\n",
+           latency.min(), latency.mean(), latency.percentile(50), latency.percentile(90),
+           latency.percentile(99), latency.max());
+
+    close(a);
+    close(b);
+    for (size_t i=0; i<idle.size(); ++i) {
+        close(idle[i]);
+    }
+    return 0;
+}
@@ -3,9 +3,13 @@
  * @author
  * @date 2024-03-10
  * @brief 聊天室客户端程序。
+ *
+ * 标准输入的每一行编码成一帧发送给服务器，一次读到的所有行用一次 writev 发送；
+ * 收到的每一帧输出一行。
 */
 #define _GNU_SOURCE 1
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <poll.h>
@@ -16,8 +20,51 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <algorithm>
+#include "frame.h"
 
-#define BUFFER_SIZE 64
+#define BUFFER_SIZE 4096
+#define IOV_LIMIT 64    // 一次 writev 最多发送的帧数量
+
+/* 把 data 中的每一行编码成一帧发送出去，最后不完整的一行留在 data 中
+return: 是否发送成功
+*/
+bool send_lines(int sockfd, std::string & data) {
+    char headers[IOV_LIMIT][FRAME_HEADER_SIZE];
+    iovec iov[IOV_LIMIT * 2];
+    size_t start = 0;
+    while (true) {
+        int count = 0;
+        while (count < IOV_LIMIT) {
+            // 太长的行拆成多帧
+            size_t end = data.find('\n', start);
+            int len;
+            if (end != std::string::npos) {
+                len = std::min(end + 1 - start, (size_t)MAX_FRAME_PAYLOAD);
+            } else if (data.size() - start >= (size_t)MAX_FRAME_PAYLOAD) {
+                len = MAX_FRAME_PAYLOAD;
+            } else {
+                break;
+            }
+            frame_header(headers[count], len);
+            iov[2*count].iov_base = headers[count];
+            iov[2*count].iov_len = FRAME_HEADER_SIZE;
+            iov[2*count+1].iov_base = &data[start];
+            iov[2*count+1].iov_len = len;
+            start += len;
+            ++count;
+        }
+        if (count == 0) {
+            break;
+        }
+        // 阻塞 socket 上 writev 会写完所有数据
+        if (writev(sockfd, iov, 2*count) < 0) {
+            return false;
+        }
+    }
+    data.erase(0, start);
+    return true;
+}
 
 int main(int argc, char * argv[]) {
     if (argc <= 2) {
@@ -52,9 +99,9 @@ int main(int argc, char * argv[]) {
     fds[1].revents = 0;
 
     char read_buf[BUFFER_SIZE];
-    int pipefd[2];
-    int ret = pipe(pipefd);
-    assert(ret != -1);
+    frame_decoder decoder;
+    std::string input;
+    int ret;
 
     while (true) {
         ret = poll(fds, 2, -1);
@@ -63,20 +110,51 @@ int main(int argc, char * argv[]) {
             break;
         }
 
-        if (fds[1].revents & POLLRDHUP) {
+        // 先读完服务器发来的数据，recv 返回 0 时才认为连接已关闭，否则服务器关闭
+        // 连接之前发送的最后几条消息会被丢掉
+        if (fds[1].revents & POLLIN) {
+            ret = recv(fds[1].fd, read_buf, BUFFER_SIZE, 0);
+            if (ret <= 0) {
+                printf("server closed the connection\n");
+                break;
+            }
+            decoder.feed(read_buf, ret);
+            const char * payload;
+            int len;
+            while ((ret = decoder.next(payload, len)) > 0) {
+                // 消息通常以换行结尾，不再额外输出换行
+                fwrite(payload, 1, len, stdout);
+                if (len == 0 || payload[len-1] != '\n') {
+                    putchar('\n');
+                }
+            }
+            fflush(stdout);
+            if (ret < 0) {
+                printf("bad frame from server\n");
+                break;
+            }
+        } else if (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR)) {
             printf("server closed the connection\n");
             break;
-        } else if (fds[1].revents & POLLIN) {
-            memset(read_buf, '\0', BUFFER_SIZE);
-            recv(fds[1].fd, read_buf, BUFFER_SIZE-1, 0);
-            printf("%s\n", read_buf);
         }
 
-        if (fds[0].revents & POLLIN) {
-            ret = splice(STDIN_FILENO, nullptr, pipefd[1], nullptr, 32768,
-                    SPLICE_F_MORE | SPLICE_F_MOVE);
-            ret = splice(pipefd[0], nullptr, sockfd, nullptr, 32768,
-                    SPLICE_F_MORE | SPLICE_F_MOVE);
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ret = read(STDIN_FILENO, read_buf, BUFFER_SIZE);
+            if (ret <= 0) {
+                // 标准输入结束，发送最后不完整的一行，然后等服务器关闭连接
+                if (!input.empty()) {
+                    input += '\n';
+                    send_lines(sockfd, input);
+                }
+                shutdown(sockfd, SHUT_WR);
+                fds[0].fd = -1;
+                continue;
+            }
+            input.append(read_buf, ret);
+            if (!send_lines(sockfd, input)) {
+                printf("send failure\n");
+                break;
+            }
         }
     }
 
@@ -0,0 +1,97 @@
+/**
+ * @file frame.h
+ * @author
+ * @date 2026-10-18
+ * @brief 聊天室的分帧协议
+ *
+ * 每条消息是一帧：4 字节网络字节序的负载长度，后面紧跟负载。TCP 是字节流，一次
+ * recv 可能只读到半帧，也可能读到好几帧，frame_decoder 负责把读到的数据重新切分
+ * 成完整的帧。
+*/
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <cstring>
+#include <string>
+
+// 帧头的长度
+static const int FRAME_HEADER_SIZE = 4;
+// 负载的最大长度，超过时认为对端出错
+static const int MAX_FRAME_PAYLOAD = 4096;
+
+/**
+ * @brief 填写帧头
+ * @param header 长度至少为 FRAME_HEADER_SIZE
+ * @param len 负载长度
+*/
+inline void frame_header(char * header, int len) {
+    uint32_t n = htonl(len);
+    memcpy(header, &n, FRAME_HEADER_SIZE);
+}
+
+/**
+ * @brief 把负载编码成一帧
+ * @param buf 长度至少为 FRAME_HEADER_SIZE + len
+ * @return 帧的总长度
+*/
+inline int frame_encode(char * buf, const char * payload, int len) {
+    frame_header(buf, len);
+    memcpy(buf + FRAME_HEADER_SIZE, payload, len);
+    return FRAME_HEADER_SIZE + len;
+}
+
+/**
+ * @brief 流式解码器
+ *
+ * 用法：每次 recv 之后调用 feed，然后反复调用 next 取出所有完整的帧。next 返回的
+ * 负载指向解码器内部的缓冲区，下一次调用 feed 之前有效。
+*/
+class frame_decoder {
+public:
+    frame_decoder(): m_start(0) {}
+
+    void feed(const char * data, int len) {
+        // 丢掉已经取走的帧，剩下的不完整的帧通常很短，移动的代价很小
+        if (m_start > 0) {
+            m_buf.erase(0, m_start);
+            m_start = 0;
+        }
+        m_buf.append(data, len);
+    }
+
+    /**
+     * @brief 取出下一帧
+     * @param payload 保存负载的地址
+     * @param len 保存负载长度
+     * @return 1 表示取出一帧，0 表示数据不够一帧，-1 表示帧长度超过 MAX_FRAME_PAYLOAD
+    */
+    int next(const char *& payload, int & len) {
+        size_t available = m_buf.size() - m_start;
+        if (available < (size_t)FRAME_HEADER_SIZE) {
+            return 0;
+        }
+        uint32_t n;
+        memcpy(&n, m_buf.data() + m_start, FRAME_HEADER_SIZE);
+        n = ntohl(n);
+        if (n > (uint32_t)MAX_FRAME_PAYLOAD) {
+            return -1;
+        }
+        if (available < FRAME_HEADER_SIZE + n) {
+            return 0;
+        }
+        payload = m_buf.data() + m_start + FRAME_HEADER_SIZE;
+        len = n;
+        m_start += FRAME_HEADER_SIZE + n;
+        return 1;
+    }
+
+    // 缓冲区中还没有取出的字节数
+    size_t buffered() const { return m_buf.size() - m_start; }
+private:
+    std::string m_buf;
+    size_t m_start;     // 下一帧在 m_buf 中的位置
+};
+
+#endif
@@ -0,0 +1,247 @@
+/**
+ * @file room.h
+ * @author
+ * @date 2026-10-18
+ * @brief 聊天室的房间和订阅者发送队列
+ *
+ * 一条消息只保存一份（chat_message，带引用计数），房间里的每个订阅者在自己的
+ * 发送队列（subscriber_queue）中保存指向它的指针，发送完或被丢弃时减少引用计数。
+ * 因此广播占用的内存与消息数量成正比，而不是与消息数量乘以用户数量成正比。
+ *
+ * 发送队列有容量上限。接收太慢的订阅者的队列满了之后，按照 OVERFLOW_POLICY 处理：
+ * 丢弃最新的消息、丢弃最旧的消息，或者断开连接。
+ *
+ * 这些类都只在一个线程中使用，引用计数不是原子的。
+*/
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <sys/uio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/**
+ * @brief 带引用计数的消息，创建者持有第一个引用
+*/
+class chat_message {
+public:
+    static chat_message * create(int sender, const char * data, int len) {
+        return new chat_message(sender, data, len);
+    }
+
+    void ref() { ++m_refs; }
+    void unref() {
+        if (--m_refs == 0) {
+            delete this;
+        }
+    }
+
+    int sender() const { return m_sender; }
+    const char * data() const { return m_data.data(); }
+    int length() const { return m_data.size(); }
+private:
+    chat_message(int sender, const char * data, int len)
+        : m_refs(1), m_sender(sender), m_data(data, len) {}
+    chat_message(const chat_message &);
+    chat_message & operator=(const chat_message &);
+
+    int m_refs;
+    int m_sender;           // 发送者的 socket
+    std::string m_data;
+};
+
+// 订阅者的发送队列满了之后的处理方式
+enum OVERFLOW_POLICY {
+    DROP_NEWEST,    // 丢弃新到的消息
+    DROP_OLDEST,    // 丢弃队列中最旧的、还没有开始发送的消息
+    DISCONNECT      // 断开连接
+};
+
+/**
+ * @brief 一个订阅者的有界发送队列
+*/
+class subscriber_queue {
+public:
+    subscriber_queue(): m_capacity(64), m_policy(DROP_OLDEST), m_head(0), m_size(0),
+        m_offset(0), m_peak(0), m_dropped(0) {}
+    ~subscriber_queue() { clear(); }
+
+    /**
+     * @brief 设置容量和溢出策略，只能在队列为空时调用
+    */
+    void set_policy(int capacity, OVERFLOW_POLICY policy) {
+        m_capacity = capacity > 0 ? capacity : 1;
+        m_policy = policy;
+        std::vector<chat_message *>().swap(m_ring);
+    }
+
+    /**
+     * @brief 消息入队，成功入队时增加它的引用计数
+     * @return 队列满并且策略为 DISCONNECT 时返回 false，调用者应断开连接
+    */
+    bool push(chat_message * msg) {
+        if (m_ring.empty()) {
+            m_ring.resize(m_capacity, nullptr);
+        }
+        if (m_size == m_capacity) {
+            ++m_dropped;
+            if (m_policy == DISCONNECT) {
+                return false;
+            } else if (m_policy == DROP_NEWEST || m_capacity == 1) {
+                return true;
+            }
+            // 队头的消息可能已经发送了一部分，丢弃它后面的一条
+            int victim = m_offset > 0 ? 1 : 0;
+            for (int i=victim; i<m_size-1; ++i) {
+                std::swap(at(i), at(i+1));
+            }
+            at(m_size - 1)->unref();
+            --m_size;
+        }
+        msg->ref();
+        at(m_size++) = msg;
+        m_peak = std::max(m_peak, m_size);
+        return true;
+    }
+
+    /**
+     * @brief 用队列中的消息填充 iov，供 writev 使用
+     * @return 填充的 iovec 数量
+    */
+    int fill_iov(iovec * iov, int max) {
+        int n = std::min(max, m_size);
+        for (int i=0; i<n; ++i) {
+            chat_message * msg = at(i);
+            size_t skip = i == 0 ? m_offset : 0;
+            iov[i].iov_base = (void *)(msg->data() + skip);
+            iov[i].iov_len = msg->length() - skip;
+        }
+        return n;
+    }
+
+    /**
+     * @brief 已经发送了 bytes 字节，移除发送完的消息
+    */
+    void consume(size_t bytes) {
+        while (m_size > 0) {
+            chat_message * msg = at(0);
+            size_t left = msg->length() - m_offset;
+            if (bytes < left) {
+                m_offset += bytes;
+                return;
+            }
+            bytes -= left;
+            pop();
+        }
+    }
+
+    void clear() {
+        while (m_size > 0) {
+            pop();
+        }
+    }
+
+    bool empty() const { return m_size == 0; }
+    // 队列中的消息数量
+    int depth() const { return m_size; }
+    // 历史最大深度
+    int peak() const { return m_peak; }
+    // 因为队列满而丢弃的消息数量
+    long long dropped() const { return m_dropped; }
+private:
+    subscriber_queue(const subscriber_queue &);
+    subscriber_queue & operator=(const subscriber_queue &);
+
+    chat_message *& at(int i) {
+        return m_ring[(m_head + i) % m_capacity];
+    }
+
+    void pop() {
+        at(0)->unref();
+        at(0) = nullptr;
+        m_head = (m_head + 1) % m_capacity;
+        --m_size;
+        m_offset = 0;
+    }
+
+    int m_capacity;
+    OVERFLOW_POLICY m_policy;
+    std::vector<chat_message *> m_ring;     // 第一次入队时才分配
+    int m_head;
+    int m_size;
+    size_t m_offset;        // 队头消息已经发送的字节数
+    int m_peak;
+    long long m_dropped;
+};
+
+/**
+ * @brief 房间，保存订阅者的 socket
+*/
+class chat_room {
+public:
+    explicit chat_room(const std::string & name): m_name(name) {}
+
+    void join(int fd) {
+        if (std::find(m_members.begin(), m_members.end(), fd) == m_members.end()) {
+            m_members.push_back(fd);
+        }
+    }
+
+    void leave(int fd) {
+        std::vector<int>::iterator it = std::find(m_members.begin(), m_members.end(), fd);
+        if (it != m_members.end()) {
+            *it = m_members.back();
+            m_members.pop_back();
+        }
+    }
+
+    const std::string & name() const { return m_name; }
+    const std::vector<int> & members() const { return m_members; }
+private:
+    std::string m_name;
+    std::vector<int> m_members;
+};
+
+/**
+ * @brief 按名字管理房间，房间在第一个订阅者加入时创建，最后一个离开时销毁
+*/
+class room_manager {
+public:
+    ~room_manager() {
+        for (std::map<std::string, chat_room *>::iterator it = m_rooms.begin();
+             it != m_rooms.end(); ++it) {
+            delete it->second;
+        }
+    }
+
+    chat_room * join(const std::string & name, int fd) {
+        chat_room *& room = m_rooms[name];
+        if (!room) {
+            room = new chat_room(name);
+        }
+        room->join(fd);
+        return room;
+    }
+
+    // 查找房间，不存在时返回 nullptr
+    chat_room * find(const std::string & name) const {
+        std::map<std::string, chat_room *>::const_iterator it = m_rooms.find(name);
+        return it == m_rooms.end() ? nullptr : it->second;
+    }
+
+    void leave(chat_room * room, int fd) {
+        room->leave(fd);
+        if (room->members().empty()) {
+            m_rooms.erase(room->name());
+            delete room;
+        }
+    }
+
+    int size() const { return m_rooms.size(); }
+private:
+    std::map<std::string, chat_room *> m_rooms;
+};
+
+#endif
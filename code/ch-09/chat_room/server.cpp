@@ -3,30 +3,65 @@
  * @author
  * @date 2024-03-10
  * @brief 聊天室服务端程序。
+ *
+ * 用户发送 "/join 房间名" 切换房间（默认在 lobby 房间），发送 "/stats" 查看房间人数
+ * 和自己的发送队列状态，其他数据广播给同一房间的其他用户。每个用户有一个有界的
+ * 发送队列，容量和溢出策略由 -q 和 -p 选项指定，见 room.h。消息和命令都按 frame.h
+ * 分帧，一帧是一条消息。
+ *
+ * 默认使用 poll，每次调用都要扫描所有连接。-e 选项改用 epoll 的 ET 模式，只处理
+ * 有事件的连接，用户数量只受文件描述符数量的限制。-u 选项指定最大用户数量。
 */
 #define _GNU_SOURCE 1
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
 #include <cerrno>
 #include <cassert>
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <vector>
+#include "room.h"
+#include "frame.h"
 
-#define BUFFER_SIZE 64  // 读缓冲区的大小
-#define USER_LIMIT 5    // 最大用户数量
-#define FD_LIMIT 65535  // 文件描述符数量限制
+#define BUFFER_SIZE 4096    // 读缓冲区的大小
+#ifndef USER_LIMIT
+#define USER_LIMIT 5    // poll 模式下默认的最大用户数量
+#endif
+#define IOV_LIMIT 64    // 一次 writev 最多发送的消息数量
+#define MAX_EVENT_NUMBER 1024
 
 struct client_data {
     sockaddr_in address;
-    char * write_buf;
-    char buf[BUFFER_SIZE];
+    int poll_idx;               // poll 模式下在 fds 数组中的下标
+    chat_room * room;           // 所在的房间
+    subscriber_queue queue;     // 等待发送给这个用户的消息
+    bool closing;               // 已经关闭读写，等待清理
+    frame_decoder decoder;      // 把收到的数据切分成帧
 };
 
+// 以 socket 为下标，连接建立时分配，关闭时释放
+std::vector<client_data *> users;
+// poll 模式下的 pollfd 数组，第 0 项是监听 socket
+std::vector<pollfd> fds;
+int user_counter = 0;
+int user_limit = USER_LIMIT;
+bool use_epoll = false;
+// 发送队列的容量和溢出策略
+int queue_capacity = 64;
+OVERFLOW_POLICY overflow_policy = DROP_OLDEST;
+room_manager rooms;
+// epoll 模式下发送队列在这一轮事件中由空变为非空的用户，本轮事件处理完后统一发送
+std::vector<int> dirty;
+
 int set_nonblocking(int fd) {
     int old_option = fcntl(fd, F_GETFL);
     int new_option = old_option | O_NONBLOCK;
@@ -34,43 +69,209 @@ int set_nonblocking(int fd) {
     return old_option;
 }
 
-int main(int argc, char * argv[]) {
-    if (argc <= 2) {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
-        return 1;
+bool flush(int fd);
+
+/* 关闭用户 fd 的读写
+不在这里关闭连接，因为调用者可能正在遍历房间的成员。下一次 poll 或 epoll_wait
+时它会作为断开的连接被清理。
+*/
+void disconnect(int fd) {
+    users[fd]->closing = true;
+    users[fd]->queue.clear();
+    shutdown(fd, SHUT_RDWR);
+}
+
+// 把消息放入用户 fd 的发送队列
+void enqueue(int fd, chat_message * msg) {
+    client_data * user = users[fd];
+    if (user->closing) {
+        return;
     }
-    const char * ip = argv[1];
-    int port = atoi(argv[2]);
+    // 队列满了先尝试发送，一次读到的一大批消息不会因为还没来得及发送而被丢弃
+    if (user->queue.depth() >= queue_capacity && !flush(fd)) {
+        disconnect(fd);
+        return;
+    }
+    bool idle = user->queue.empty();
+    if (!user->queue.push(msg)) {
+        printf("user %d is too slow, %lld messages dropped, disconnect\n",
+               fd, user->queue.dropped());
+        disconnect(fd);
+        return;
+    }
+    if (!use_epoll) {
+        fds[user->poll_idx].events |= POLLOUT;
+    } else if (idle) {
+        // ET 模式下 EPOLLOUT 只在 socket 从不可写变为可写时触发，所以队列从空变为
+        // 非空时要主动发送一次。推迟到这一轮事件处理完，一批消息只用一次 writev
+        dirty.push_back(fd);
+    }
+}
 
-    int ret = 0;
-    sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    inet_pton(AF_INET, ip, &address.sin_addr);
-    address.sin_port = htons(port);
+// 把负载编码成一帧，作为消息
+chat_message * frame_message(int sender, const char * payload, int len) {
+    char frame[FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD];
+    return chat_message::create(sender, frame, frame_encode(frame, payload, len));
+}
 
-    int listen_fd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listen_fd >= 0);
+// 把服务器生成的文本发送给用户 fd
+void reply(int fd, const char * text) {
+    chat_message * msg = frame_message(-1, text, strlen(text));
+    enqueue(fd, msg);
+    msg->unref();
+}
 
-    ret = bind(listen_fd, (sockaddr *)&address, sizeof(address));
-    assert(ret != -1);
+// 把用户 fd 发来的数据广播给同一房间的其他用户
+void broadcast(int fd, const char * data, int len) {
+    chat_message * msg = frame_message(fd, data, len);
+    const std::vector<int> & members = users[fd]->room->members();
+    for (size_t j=0; j<members.size(); ++j) {
+        if (members[j] != fd) {
+            enqueue(members[j], msg);
+        }
+    }
+    msg->unref();
+}
 
-    ret = listen(listen_fd, 5);
-    assert(ret != -1);
+/* 处理命令
+return: 数据是否是命令
+*/
+bool handle_command(int fd, const char * payload, int len) {
+    if (len == 0 || payload[0] != '/') {
+        return false;
+    }
+    client_data * user = users[fd];
+    char data[MAX_FRAME_PAYLOAD + 1];
+    memcpy(data, payload, len);
+    data[len] = '\0';
+    // 去掉行尾的换行符
+    data[strcspn(data, "\r\n")] = '\0';
+    char info[256];
+    if (strncmp(data, "/join ", 6) == 0 && data[6] != '\0') {
+        rooms.leave(user->room, fd);
+        user->room = rooms.join(data + 6, fd);
+        snprintf(info, sizeof(info), "joined %s, %d members\n",
+                 user->room->name().c_str(), (int)user->room->members().size());
+    } else if (strcmp(data, "/stats") == 0) {
+        snprintf(info, sizeof(info), "room %s: %d members, %d rooms; "
+                 "queue depth %d, peak %d, dropped %lld\n",
+                 user->room->name().c_str(), (int)user->room->members().size(),
+                 rooms.size(), user->queue.depth(), user->queue.peak(),
+                 user->queue.dropped());
+    } else {
+        return false;
+    }
+    reply(fd, info);
+    return true;
+}
+
+/* 接受一个新用户
+return: 是否接受，用户太多时返回 false，调用者关闭连接
+*/
+bool add_user(int connfd, const sockaddr_in & client_address) {
+    if (user_counter >= user_limit) {
+        // 连接随即关闭，不经过发送队列，直接发送编码好的一帧
+        const char * info = "too many users\n";
+        printf("%s\n", info);
+        char frame[FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD];
+        send(connfd, frame, frame_encode(frame, info, strlen(info)), 0);
+        return false;
+    }
+    if (connfd >= (int)users.size()) {
+        users.resize(connfd + 1, nullptr);
+    }
+    client_data * user = new client_data;
+    user->address = client_address;
+    user->poll_idx = -1;
+    user->closing = false;
+    user->queue.set_policy(queue_capacity, overflow_policy);
+    user->room = rooms.join("lobby", connfd);
+    users[connfd] = user;
+    user_counter++;
+    set_nonblocking(connfd);
+    return true;
+}
+
+// 释放用户 fd 的数据并关闭连接
+void remove_user(int connfd) {
+    // 对端可能只是半关闭，关闭之前尽量把已经排队的消息发出去
+    if (!users[connfd]->closing) {
+        flush(connfd);
+    }
+    rooms.leave(users[connfd]->room, connfd);
+    delete users[connfd];
+    users[connfd] = nullptr;
+    close(connfd);
+    --user_counter;
+}
+
+/* 读取用户 fd 发来的数据，处理其中所有完整的帧
+return: 1 表示读到了数据，0 表示没有数据可读，-1 表示连接已断开或出错
+*/
+int handle_input(int connfd) {
+    char buf[BUFFER_SIZE];
+    int ret = recv(connfd, buf, BUFFER_SIZE, 0);
+    if (ret < 0) {
+        return errno == EAGAIN ? 0 : -1;
+    } else if (ret == 0) {
+        return -1;
+    }
+    frame_decoder & decoder = users[connfd]->decoder;
+    decoder.feed(buf, ret);
+    const char * payload;
+    int len;
+    while ((ret = decoder.next(payload, len)) > 0) {
+        if (!handle_command(connfd, payload, len)) {
+            broadcast(connfd, payload, len);
+        }
+    }
+    if (ret < 0) {
+        printf("bad frame from %d\n", connfd);
+        return -1;
+    }
+    return 1;
+}
 
-    client_data * users = new client_data[FD_LIMIT];
-    pollfd fds[USER_LIMIT+1];
+/* 一次 writev 尽量多发送几条消息，直到发送完或者 socket 不可写
+return: 是否出错
+*/
+bool flush(int fd) {
+    subscriber_queue & queue = users[fd]->queue;
+    iovec iov[IOV_LIMIT];
+    while (!queue.empty()) {
+        int count = queue.fill_iov(iov, IOV_LIMIT);
+        int ret = writev(fd, iov, count);
+        if (ret < 0) {
+            return errno == EAGAIN;
+        }
+        queue.consume(ret);
+    }
+    return true;
+}
+
+// poll 模式下关闭 fds 中第 i 个连接，把最后一个连接移到这个位置
+void close_poll_user(int i) {
+    int connfd = fds[i].fd;
+    fds[i] = fds[user_counter];
+    fds[user_counter].fd = -1;
+    if (i != user_counter) {
+        users[fds[i].fd]->poll_idx = i;
+    }
+    remove_user(connfd);
+}
+
+int run_poll(int listen_fd) {
+    fds.resize(user_limit + 1);
     fds[0].fd = listen_fd;
     fds[0].events = POLLIN | POLLERR;
     fds[0].revents = 0;
-    for (int i=1; i<=USER_LIMIT; ++i) {
+    for (int i=1; i<=user_limit; ++i) {
         fds[i].fd = -1;
         fds[i].events = 0;
     }
-    int user_counter = 0;
 
     while (true) {
-        ret = poll(fds, user_counter+1, -1);
+        int ret = poll(fds.data(), user_counter+1, -1);
         if (ret < 0) {
             printf("poll failure\n");
             break;
@@ -86,18 +287,11 @@ int main(int argc, char * argv[]) {
                     printf("errno is: %d\n", errno);
                     continue;
                 }
-                
-                if (user_counter >= USER_LIMIT) {
-                    const char * info = "too many users\n";
-                    printf("%s\n", info);
-                    send(connfd, info, strlen(info), 0);
+                if (!add_user(connfd, client_address)) {
                     close(connfd);
                     continue;
                 }
-
-                user_counter++;
-                users[connfd].address = client_address;
-                set_nonblocking(connfd);
+                users[connfd]->poll_idx = user_counter;
                 fds[user_counter].fd = connfd;
                 fds[user_counter].events = POLLIN | POLLRDHUP | POLLERR;
                 fds[user_counter].revents = 0;
@@ -111,54 +305,182 @@ int main(int argc, char * argv[]) {
                  < 0) {
                     printf("get socket option failed\n");
                 }
-                continue;
-            } else if ( fds[i].revents & POLLRDHUP ) {
-                // 如果客户端关闭连接，则服务器也关闭对应的连接，并将用户数量减1
-                users[fds[i].fd] = users[fds[user_counter].fd];
-                close(fds[i].fd);
-                fds[i] = fds[user_counter];
+                close_poll_user(i);
                 --i;
-                --user_counter;
-                printf("a client left\n");
-            } else if ( fds[i].revents & POLLIN ) {
+            } else if ( fds[i].revents & (POLLIN | POLLHUP | POLLOUT) ) {
+                // 先读完缓冲区中的数据：对端半关闭时 POLLRDHUP 和最后几条消息一起到达，
+                // 直到 recv 返回 0 才关闭连接
                 int connfd = fds[i].fd;
-                memset(users[connfd].buf, '\0', BUFFER_SIZE);
-                ret = recv(connfd, users[connfd].buf, BUFFER_SIZE-1, 0);
-                printf("get %d bytes of client data %s from %d\n", ret, 
-                        users[connfd].buf, connfd);
-                if (ret < 0) {
-                    // 如果读操作出错，则关闭连接
-                    if (errno != EAGAIN) {
-                        close(connfd);
-                        users[connfd] = users[fds[user_counter].fd];
-                        fds[i] = fds[user_counter];
-                        --i;
-                        --user_counter;
+                bool closed = false;
+                if (fds[i].revents & POLLIN) {
+                    closed = handle_input(connfd) < 0;
+                } else if (fds[i].revents & POLLHUP) {
+                    closed = true;
+                }
+                // 发送完之后不再关注 POLLOUT
+                if (!closed && (fds[i].revents & POLLOUT)) {
+                    if (!flush(connfd)) {
+                        closed = true;
+                    } else if (users[connfd]->queue.empty()) {
+                        fds[i].events &= ~POLLOUT;
                     }
-                } else if (ret == 0) {
+                }
+                if (closed) {
+                    // 如果客户端关闭连接，则服务器也关闭对应的连接，并将用户数量减1
+                    close_poll_user(i);
+                    --i;
+                    printf("a client left\n");
+                }
+            }
+        }
+    }
+    return 0;
+}
 
-                } else {
-                    // 如果接收到客户端数据，则通知其他socket连接准备写数据
-                    for (int j=1; j<=user_counter; ++j) {
-                        if (fds[j].fd == connfd) continue;
-                        fds[j].events |= ~POLLIN;
-                        fds[j].events |= POLLOUT;
-                        users[fds[j].fd].write_buf = users[connfd].buf;
+int run_epoll(int listen_fd) {
+    epoll_event events[MAX_EVENT_NUMBER];
+    int epollfd = epoll_create(5);
+    assert(epollfd != -1);
+    set_nonblocking(listen_fd);
+    epoll_event event;
+    event.data.fd = listen_fd;
+    event.events = EPOLLIN | EPOLLET;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    while (true) {
+        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        if (number < 0 && errno != EINTR) {
+            printf("epoll failure\n");
+            break;
+        }
+
+        for (int i=0; i<number; ++i) {
+            int sockfd = events[i].data.fd;
+            if (sockfd == listen_fd) {
+                // ET 模式下要接受所有等待的连接
+                while (true) {
+                    sockaddr_in client_address;
+                    socklen_t client_addr_len = sizeof(client_address);
+                    int connfd = accept(listen_fd, (sockaddr *)&client_address,
+                                    &client_addr_len);
+                    if (connfd < 0) {
+                        if (errno != EAGAIN) {
+                            printf("errno is: %d\n", errno);
+                        }
+                        break;
+                    }
+                    if (!add_user(connfd, client_address)) {
+                        close(connfd);
+                        continue;
                     }
+                    // 一开始就关注 EPOLLOUT，ET 模式下只在 socket 重新变为可写时触发
+                    event.data.fd = connfd;
+                    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    epoll_ctl(epollfd, EPOLL_CTL_ADD, connfd, &event);
                 }
-            } else if ( fds[i].revents & POLLOUT ) {
-                int connfd = fds[i].fd;
-                if (!users[connfd].write_buf) continue;
-                ret = send(connfd, users[connfd].write_buf,
-                            strlen(users[connfd].write_buf), 0);
-                users[connfd].write_buf = nullptr;
-                fds[i].events |= ~POLLOUT;
-                fds[i].events |= POLLIN;
+                continue;
+            }
+            // 连接可能已经在这一轮中被关闭
+            if (sockfd >= (int)users.size() || !users[sockfd]) {
+                continue;
+            }
+            bool closed = events[i].events & (EPOLLHUP | EPOLLERR);
+            if (!closed && (events[i].events & EPOLLIN)) {
+                // ET 模式下要读到 EAGAIN 为止
+                int ret;
+                while ((ret = handle_input(sockfd)) > 0) {
+                }
+                closed = ret < 0;
+            }
+            if (!closed && (events[i].events & EPOLLOUT)) {
+                closed = !flush(sockfd);
             }
+            if (closed) {
+                remove_user(sockfd);
+            }
+        }
+
+        for (size_t i=0; i<dirty.size(); ++i) {
+            int fd = dirty[i];
+            if (fd < (int)users.size() && users[fd] && !users[fd]->closing && !flush(fd)) {
+                disconnect(fd);
+            }
+        }
+        dirty.clear();
+    }
+    close(epollfd);
+    return 0;
+}
+
+int main(int argc, char * argv[]) {
+    const char * name = basename(argv[0]);
+    int limit = 0;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "q:p:eu:")) != -1) {
+        switch (opt) {
+            case 'q': queue_capacity = atoi(optarg); break;
+            case 'p':
+                if (strcmp(optarg, "drop-newest") == 0) {
+                    overflow_policy = DROP_NEWEST;
+                } else if (strcmp(optarg, "drop-oldest") == 0) {
+                    overflow_policy = DROP_OLDEST;
+                } else if (strcmp(optarg, "disconnect") == 0) {
+                    overflow_policy = DISCONNECT;
+                } else {
+                    bad_option = true;
+                }
+                break;
+            case 'e': use_epoll = true; break;
+            case 'u': limit = atoi(optarg); break;
+            default: bad_option = true; break;
         }
     }
+    if (bad_option || argc - optind < 2 || queue_capacity <= 0 || limit < 0) {
+        printf("usage: %s [-e] [-u user_limit] [-q queue_capacity] "
+               "[-p drop-newest|drop-oldest|disconnect] ip_address port_number\n", name);
+        return 1;
+    }
+    const char * ip = argv[optind];
+    int port = atoi(argv[optind + 1]);
+
+    // 把文件描述符数量的软限制提高到硬限制。epoll 模式下默认不限制用户数量
+    rlimit rlim;
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+        rlim.rlim_cur = rlim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rlim);
+    }
+    // 向已经断开的连接发送数据时返回 EPIPE，而不是终止进程
+    signal(SIGPIPE, SIG_IGN);
+    if (limit > 0) {
+        user_limit = limit;
+    } else if (use_epoll) {
+        user_limit = rlim.rlim_cur;
+    }
+
+    int ret = 0;
+    sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    int listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(listen_fd >= 0);
+
+    ret = bind(listen_fd, (sockaddr *)&address, sizeof(address));
+    assert(ret != -1);
 
-    delete [] users;
+    ret = listen(listen_fd, SOMAXCONN);
+    assert(ret != -1);
+
+    ret = use_epoll ? run_epoll(listen_fd) : run_poll(listen_fd);
+
+    for (size_t i=0; i<users.size(); ++i) {
+        if (users[i]) {
+            remove_user(i);
+        }
+    }
     close(listen_fd);
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
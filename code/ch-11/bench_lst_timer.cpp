@@ -0,0 +1,91 @@
+/**
+ * @file bench_lst_timer.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief 比较 sort_timer_lst 与 fifo_timer_lst 在大量连接下刷新定时器的开销。
+ *
+ * 所有连接使用相同的空闲超时时长，先为每个连接添加一个定时器，随后随机挑选
+ * 连接刷新其超时时间（相当于 close_inactive_conn.cpp 中每次读到数据）。
+ * 用法: bench_lst_timer [connection_number] [refresh_number]
+*/
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include "lst_timer.h"
+
+#define TIMEOUT 15000
+
+static void dummy_cb(client_data *) {}
+
+/**
+ * @brief 获取单调时钟的当前时间（秒）
+*/
+static double now_sec() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 对定时器链表 lst 执行一轮添加和刷新操作，并打印每次操作的平均耗时
+ * @param name 被测链表的名字
+ * @param lst 被测链表
+ * @param n 连接数量
+ * @param picks 每次刷新的连接编号
+ * @param m 刷新次数
+*/
+template <typename LIST>
+void run(const char * name, LIST & lst, int n, const int * picks, int m) {
+    util_timer* *handles = new util_timer* [n];
+    // 用递增的“时间”模拟时钟的流逝，让每次操作的 expire 都不小于之前的值
+    long long clock = 0;
+    double t0 = now_sec();
+    for (int i=0; i<n; ++i) {
+        util_timer * timer = new util_timer;
+        timer->cb_func = dummy_cb;
+        timer->user_data = nullptr;
+        timer->timeout = TIMEOUT;
+        timer->expire = ++clock + TIMEOUT;
+        handles[i] = timer;
+        lst.add_timer(timer);
+    }
+    double t1 = now_sec();
+    for (int i=0; i<m; ++i) {
+        util_timer * timer = handles[picks[i]];
+        timer->expire = ++clock + TIMEOUT;
+        lst.adjust_timer(timer);
+    }
+    double t2 = now_sec();
+    for (int i=0; i<n; ++i) {
+        lst.delete_timer(handles[i]);
+    }
+    printf("%-16s add %10.1f ns/op, refresh %12.1f ns/op\n", name,
+           (t1-t0)*1e9/n, m ? (t2-t1)*1e9/m : 0.0);
+    delete [] handles;
+}
+
+int main(int argc, char * argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 100000;
+    int m = argc > 2 ? atoi(argv[2]) : 5000;
+    if (n <= 0 || m < 0) {
+        printf("usage: %s [connection_number] [refresh_number]\n", argv[0]);
+        return 1;
+    }
+    int * picks = new int[m];
+    srand(12345);
+    for (int i=0; i<m; ++i) {
+        picks[i] = rand() % n;
+    }
+
+    {
+        fifo_timer_lst lst;
+        run("fifo_timer_lst", lst, n, picks, m);
+    }
+    {
+        sort_timer_lst lst;
+        run("sort_timer_lst", lst, n, picks, m);
+    }
+
+    delete [] picks;
+    return 0;
+}
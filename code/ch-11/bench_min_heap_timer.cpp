@@ -0,0 +1,190 @@
+/**
+ * @file bench_min_heap_timer.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief 比较带下标的 4 叉时间堆与“延迟销毁”二叉时间堆的性能。
+ *
+ * 模拟 N 个连接，每个连接一个定时器，随后随机挑选连接刷新其超时时间
+ * （相当于连接上每次有数据可读），最后把堆中的定时器全部弹出。
+ * 用法: bench_min_heap_timer [timer_number] [refresh_number]
+*/
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include "min_heap_timer.h"
+
+/**
+ * @brief 原来的“延迟销毁”二叉时间堆，删除定时器只是将其回调函数置空。
+*/
+class lazy_time_heap {
+public:
+    lazy_time_heap(int cap): capacity(cap), cur_size(0) {
+        array = new heap_timer* [capacity];
+    }
+
+    ~lazy_time_heap() {
+        for (int i=0; i<cur_size; ++i) {
+            delete array[i];
+        }
+        delete [] array;
+    }
+
+    void add_timer(heap_timer * timer) {
+        if (cur_size >= capacity) resize();
+        int hole = cur_size++;
+        int parent = 0;
+        for (; hole > 0; hole = parent) {
+            parent = (hole - 1) / 2;
+            if (array[parent]->expire <= timer->expire) {
+                break;
+            }
+            array[hole] = array[parent];
+        }
+        array[hole] = timer;
+    }
+
+    void del_timer(heap_timer * timer) {
+        timer->cb_func = nullptr;
+    }
+
+    heap_timer * top() const {
+        return cur_size ? array[0] : nullptr;
+    }
+
+    void pop_timer() {
+        if (cur_size == 0) return;
+        delete array[0];
+        array[0] = array[--cur_size];
+        if (cur_size > 0) percolate_down(0);
+    }
+
+    bool empty() const { return cur_size == 0; }
+    int size() const { return cur_size; }
+private:
+    void percolate_down(int hole) {
+        heap_timer * tmp = array[hole];
+        int child = 0;
+        for (; hole*2+1 <= cur_size-1; hole = child) {
+            child = hole * 2 + 1;
+            if ((child < cur_size-1) &&
+                (array[child+1]->expire < array[child]->expire)) {
+                ++child;
+            }
+            if (array[child]->expire < tmp->expire) {
+                array[hole] = array[child];
+            } else {
+                break;
+            }
+        }
+        array[hole] = tmp;
+    }
+
+    void resize() {
+        heap_timer* *tmp = new heap_timer* [capacity * 2];
+        for (int i=0; i<cur_size; ++i) {
+            tmp[i] = array[i];
+        }
+        capacity *= 2;
+        delete [] array;
+        array = tmp;
+    }
+private:
+    heap_timer* *array;
+    int capacity;
+    int cur_size;
+};
+
+static void dummy_cb(client_data *) {}
+
+/**
+ * @brief 获取单调时钟的当前时间（秒）
+*/
+static double now_sec() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int m = argc > 2 ? atoi(argv[2]) : 1000000;
+    if (n <= 0 || m < 0) {
+        printf("usage: %s [timer_number] [refresh_number]\n", argv[0]);
+        return 1;
+    }
+    heap_timer* *handles = new heap_timer* [n];
+    long long * expires = new long long[n];
+    int * picks = new int[m];
+    srand(12345);
+    for (int i=0; i<n; ++i) {
+        expires[i] = rand() % n;
+    }
+    for (int i=0; i<m; ++i) {
+        picks[i] = rand() % n;
+    }
+
+    // ---- 带下标的 4 叉堆 ----
+    {
+        time_heap heap(1024);
+        double t0 = now_sec();
+        for (int i=0; i<n; ++i) {
+            heap_timer * timer = new heap_timer(0);
+            timer->expire = expires[i];
+            timer->cb_func = dummy_cb;
+            handles[i] = timer;
+            heap.add_timer(timer);
+        }
+        double t1 = now_sec();
+        long long clock = n;
+        for (int i=0; i<m; ++i) {
+            heap.adjust_timer(handles[picks[i]], clock++);
+        }
+        double t2 = now_sec();
+        int peak = heap.size();
+        while (!heap.empty()) {
+            heap.pop_timer();
+        }
+        double t3 = now_sec();
+        printf("indexed 4-ary heap: add %.1f ns/op, refresh %.1f ns/op, "
+               "drain %.1f ns/op, peak size %d\n",
+               (t1-t0)*1e9/n, m ? (t2-t1)*1e9/m : 0.0, (t3-t2)*1e9/peak, peak);
+    }
+
+    // ---- 延迟销毁的二叉堆 ----
+    {
+        lazy_time_heap heap(1024);
+        double t0 = now_sec();
+        for (int i=0; i<n; ++i) {
+            heap_timer * timer = new heap_timer(0);
+            timer->expire = expires[i];
+            timer->cb_func = dummy_cb;
+            handles[i] = timer;
+            heap.add_timer(timer);
+        }
+        double t1 = now_sec();
+        long long clock = n;
+        for (int i=0; i<m; ++i) {
+            // 延迟销毁方案只能先“删除”旧定时器，再插入一个新的定时器
+            heap.del_timer(handles[picks[i]]);
+            heap_timer * timer = new heap_timer(0);
+            timer->expire = clock++;
+            timer->cb_func = dummy_cb;
+            handles[picks[i]] = timer;
+            heap.add_timer(timer);
+        }
+        double t2 = now_sec();
+        int peak = heap.size();
+        while (!heap.empty()) {
+            heap.pop_timer();
+        }
+        double t3 = now_sec();
+        printf("lazy binary heap:   add %.1f ns/op, refresh %.1f ns/op, "
+               "drain %.1f ns/op, peak size %d\n",
+               (t1-t0)*1e9/n, m ? (t2-t1)*1e9/m : 0.0, (t3-t2)*1e9/peak, peak);
+    }
+
+    delete [] handles;
+    delete [] expires;
+    delete [] picks;
+    return 0;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file bench_timer_queue.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief 用模拟的连接超时轨迹比较 timer_queue 的各个后端。
+ *
+ * 先生成一条轨迹：连接按固定速率到达，到达时添加一个空闲超时定时器；连接上
+ * 每个请求到来时刷新定时器；一部分连接在最后一个请求之后由客户端主动关闭
+ * （取消定时器），其余的连接一直空闲直到超时。然后在各个后端上按时间顺序
+ * 重放这条轨迹，报告平均每次操作的耗时和峰值内存占用。
+ * 用法: bench_timer_queue [connection_number] [idle_timeout_ms]
+*/
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "timer_queue.h"
+
+// 轨迹中的一次操作
+struct trace_op {
+    enum TYPE { ADD = 0, ADJUST, CANCEL };
+    long long time;   // 操作发生的时间（毫秒）
+    int type;
+    int conn;         // 连接编号
+    bool operator<(const trace_op & other) const {
+        if (time != other.time) return time < other.time;
+        return type < other.type;
+    }
+};
+
+static int expired_count = 0;
+
+/**
+ * @brief 获取单调时钟的当前时间（秒）
+*/
+static double now_sec() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 服从均值为 mean 的指数分布的随机数
+*/
+static double exp_rand(double mean) {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return -mean * log(u);
+}
+
+/**
+ * @brief 生成连接超时轨迹
+ * @param conn_number 连接数量
+ * @param timeout 空闲超时时长（毫秒）
+ * @param trace 生成的轨迹
+*/
+static void make_trace(int conn_number, int timeout, std::vector<trace_op> & trace) {
+    const double arrival_gap = 0.05;    // 平均每毫秒到达 20 个连接
+    const double request_gap = timeout / 8.0;
+    double arrival = 0;
+    srand(12345);
+    for (int c=0; c<conn_number; ++c) {
+        arrival += exp_rand(arrival_gap);
+        long long t = (long long)arrival;
+        trace_op op = {t, trace_op::ADD, c};
+        trace.push_back(op);
+        int requests = 1 + rand() % 10;
+        bool expired = false;
+        for (int r=0; r<requests; ++r) {
+            long long gap = (long long)exp_rand(request_gap);
+            if (gap >= timeout) {
+                expired = true;   // 两次请求的间隔超过空闲超时，定时器先到期
+                break;
+            }
+            t += gap;
+            trace_op adjust = {t, trace_op::ADJUST, c};
+            trace.push_back(adjust);
+        }
+        // 七成的连接由客户端主动关闭
+        if (!expired && rand() % 10 < 7) {
+            long long gap = (long long)exp_rand(request_gap);
+            if (gap < timeout) {
+                trace_op cancel = {t + gap, trace_op::CANCEL, c};
+                trace.push_back(cancel);
+            }
+        }
+    }
+    std::stable_sort(trace.begin(), trace.end());
+}
+
+template <typename QUEUE>
+struct replay_context {
+    static std::vector<typename QUEUE::handle> handles;
+    static void on_expire(int & conn) {
+        handles[conn] = nullptr;
+        ++expired_count;
+    }
+};
+
+template <typename QUEUE>
+std::vector<typename QUEUE::handle> replay_context<QUEUE>::handles;
+
+/**
+ * @brief 在后端 Backend 上重放轨迹
+*/
+template <template <typename> class Backend>
+void replay(const char * name, const std::vector<trace_op> & trace,
+            int conn_number, int timeout) {
+    typedef timer_queue<int, Backend> queue_type;
+    typedef replay_context<queue_type> context;
+    context::handles.assign(conn_number, nullptr);
+    expired_count = 0;
+
+    queue_type queue(0);
+    size_t peak_memory = 0;
+    size_t peak_size = 0;
+    long long ops = 0;
+    long long last = -1;
+    double t0 = now_sec();
+    for (size_t i=0; i<trace.size(); ++i) {
+        const trace_op & op = trace[i];
+        if (op.time != last) {
+            ops += queue.expire(op.time - 1);
+            last = op.time;
+        }
+        switch (op.type) {
+            case trace_op::ADD: {
+                context::handles[op.conn] = queue.add(op.time + timeout, op.conn,
+                                                context::on_expire);
+                break;
+            }
+            case trace_op::ADJUST: {
+                queue.adjust(context::handles[op.conn], op.time + timeout);
+                break;
+            }
+            case trace_op::CANCEL: {
+                queue.cancel(context::handles[op.conn]);
+                context::handles[op.conn] = nullptr;
+                break;
+            }
+        }
+        ++ops;
+        if ((i & 1023) == 0) {
+            peak_memory = std::max(peak_memory, queue.memory_bytes());
+            peak_size = std::max(peak_size, queue.size());
+        }
+    }
+    ops += queue.expire(last + timeout + 1);
+    double t1 = now_sec();
+    printf("%-12s %8.1f ns/op  peak timers %8zu  peak memory %8.1f KB  "
+           "expired %d\n", name, (t1-t0)*1e9/ops, peak_size,
+           peak_memory/1024.0, expired_count);
+}
+
+int main(int argc, char * argv[]) {
+    int conn_number = argc > 1 ? atoi(argv[1]) : 500000;
+    int timeout = argc > 2 ? atoi(argv[2]) : 30000;
+    if (conn_number <= 0 || timeout <= 0) {
+        printf("usage: %s [connection_number] [idle_timeout_ms]\n", argv[0]);
+        return 1;
+    }
+    std::vector<trace_op> trace;
+    make_trace(conn_number, timeout, trace);
+    printf("trace: %d connections, %zu operations, idle timeout %d ms\n",
+           conn_number, trace.size(), timeout);
+
+    replay<sorted_list_backend>("sorted_list", trace, conn_number, timeout);
+    replay<heap2_backend>("heap2", trace, conn_number, timeout);
+    replay<heap4_backend>("heap4", trace, conn_number, timeout);
+    replay<wheel_backend>("wheel", trace, conn_number, timeout);
+    return 0;
+}
@@ -11,7 +11,7 @@
 #include <sys/epoll.h>  // epoll_event, epoll_ctl, epoll_wait, epoll_create
 #include <signal.h> // sigaction, sigfillset
 #include <fcntl.h>  // fcntl
-#include <unistd.h> // close, alarm
+#include <unistd.h> // close
 #include <cstring>  // basename, bzero
 #include <cstdio>   // printf
 #include <cstdlib>  // atoi
@@ -21,10 +21,10 @@
 
 #define FD_LIMIT 65535
 #define MAX_EVENT_NUMBER 1024
-#define TIMESLOT 5
+#define TIMEOUT 15000  // 非活动连接的超时时间（毫秒）
 
 static int pipefd[2];
-static sort_timer_lst timer_lst;
+static fifo_timer_lst timer_lst;
 static int epollfd = 0;
 
 int set_nonblocking(int fd) {
@@ -58,12 +58,6 @@ void add_sig(int sig) {
     assert(sigaction(sig, &sa, nullptr) != -1);
 }
 
-void timer_handler() {
-    // 定时处理任务，实际上是调用 tick 函数
-    timer_lst.tick();
-    alarm(TIMESLOT);
-}
-
 // 定时器回调函数，它删除非活动连接 socket 上的注册事件，并将其关闭
 void cb_func(client_data * user_data) {
     epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
@@ -104,20 +98,21 @@ int main(int argc, char * argv[]) {
     set_nonblocking(pipefd[1]);
     add_fd(epollfd, pipefd[0]);
 
-    // 设置信号处理函数
-    add_sig(SIGALRM);
+    // 设置信号处理函数。定时不再依赖 SIGALRM，而是由 epoll_wait 的超时参数驱动。
     add_sig(SIGTERM);
     bool stop_sever = false;
     client_data * users = new client_data[FD_LIMIT];
-    bool timeout = false;
-    alarm(TIMESLOT);  // 定时
 
     while (!stop_sever) {
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        // 以距离下一个定时器到期的时间作为 epoll_wait 的超时时间
+        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER,
+                        timer_lst.next_timeout());
         if (number < 0 && errno != EINTR) {
             printf("epoll failure\n");
             break;
         }
+        // 每轮迭代只读取一次单调时钟，本轮中的定时器操作都使用这个缓存值
+        timer_clock::update();
 
         for (int i=0; i<number; ++i) {
             int sockfd = events[i].data.fd;
@@ -134,7 +129,8 @@ int main(int argc, char * argv[]) {
                 // 最后将定时器添加到定时器链表中
                 util_timer * timer = new util_timer;
                 timer->cb_func = cb_func;
-                timer->expire = time(nullptr) + 3 * TIMESLOT;
+                timer->timeout = TIMEOUT;
+                timer->expire = timer_clock::now() + TIMEOUT;
                 timer->user_data = &users[connfd];
                 users[connfd].timer = timer;
                 timer_lst.add_timer(timer);
@@ -151,13 +147,6 @@ int main(int argc, char * argv[]) {
                 } else {
                     for (int i=0; i<ret; ++i) {
                         switch (signals[i]) {
-                            case SIGALRM: {
-                                // 使用 timeout 标记有定时任务需要处理，但不立即处理
-                                // 定时任务。因为定时任务的优先级不是很高，我们优先处理
-                                // 其他重要任务。
-                                timeout = true;
-                                break;
-                            }
                             case SIGTERM: {
                                 stop_sever = true;
                             }
@@ -191,7 +180,7 @@ int main(int argc, char * argv[]) {
                     // 如果某个客户连接上有数据可读，我们需要调整该连接对应的定时器，
                     // 以延长该连接被关闭的时间。
                     if (timer) {
-                        timer->expire = time(nullptr) + 3 * TIMESLOT;
+                        timer->expire = timer_clock::now() + TIMEOUT;
                         printf("adjust time once\n");
                         timer_lst.adjust_timer(timer);
                     }
@@ -202,11 +191,9 @@ int main(int argc, char * argv[]) {
             }
         }
 
-        // 最后处理定时事件
-        if (timeout) {
-            timer_handler();
-            timeout = false;
-        }
+        // 最后处理定时事件。定时任务的优先级不是很高，因此在处理完其他
+        // 重要任务之后才处理它们。
+        timer_lst.tick();
     }
 
     close(epollfd);
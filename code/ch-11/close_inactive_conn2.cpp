@@ -5,7 +5,7 @@
 #include <sys/epoll.h>  // epoll_event, epoll_ctl, epoll_wait, epoll_create
 #include <signal.h> // sigaction, sigfillset
 #include <fcntl.h>  // fcntl
-#include <unistd.h> // close, alarm
+#include <unistd.h> // close
 #include <cstring>  // basename, bzero
 #include <cstdio>   // printf
 #include <cstdlib>  // atoi
@@ -15,7 +15,8 @@
 
 #define FD_LIMIT 65535
 #define MAX_EVENT_NUMBER 1024
-#define TIMESLOT 1
+#define TIMEOUT 10000  // 非活动连接的超时时间（毫秒）
+#define MAX_EXPIRE_PER_TICK 256  // 每轮事件循环至多处理的到期定时器数量
 
 static int pipefd[2];
 static time_wheel tw;
@@ -52,12 +53,6 @@ void add_sig(int sig) {
     assert(sigaction(sig, &sa, nullptr) != -1);
 }
 
-void timer_handler() {
-    // 定时处理任务，实际上是调用 tick 函数
-    tw.tick();
-    alarm(TIMESLOT);
-}
-
 // 定时器回调函数，它删除非活动连接 socket 上的注册事件，并将其关闭
 void cb_func(client_data * user_data) {
     epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
@@ -98,20 +93,21 @@ int main(int argc, char * argv[]) {
     set_nonblocking(pipefd[1]);
     add_fd(epollfd, pipefd[0]);
 
-    // 设置信号处理函数
-    add_sig(SIGALRM);
+    // 设置信号处理函数。定时不再依赖 SIGALRM，而是由 epoll_wait 的超时参数驱动。
     add_sig(SIGTERM);
     bool stop_sever = false;
     client_data * users = new client_data[FD_LIMIT];
-    bool timeout = false;
-    alarm(TIMESLOT);  // 定时
 
     while (!stop_sever) {
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        // 以距离下一个定时器到期的时间作为 epoll_wait 的超时时间
+        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER,
+                        tw.next_timeout());
         if (number < 0 && errno != EINTR) {
             printf("epoll failure\n");
             break;
         }
+        // 每轮迭代只读取一次单调时钟，本轮中的定时器操作都使用这个缓存值
+        timer_clock::update();
 
         for (int i=0; i<number; ++i) {
             int sockfd = events[i].data.fd;
@@ -126,7 +122,7 @@ int main(int argc, char * argv[]) {
                 users[connfd].sockfd = connfd;
                 // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，
                 // 最后将定时器添加到定时器链表中
-                tw_timer * timer = tw.add_timer(10*TIMESLOT);
+                tw_timer * timer = tw.add_timer(TIMEOUT);
                 timer->cb_func = cb_func;
                 timer->user_data = &users[connfd];
                 users[connfd].timer = timer;
@@ -143,13 +139,6 @@ int main(int argc, char * argv[]) {
                 } else {
                     for (int i=0; i<ret; ++i) {
                         switch (signals[i]) {
-                            case SIGALRM: {
-                                // 使用 timeout 标记有定时任务需要处理，但不立即处理
-                                // 定时任务。因为定时任务的优先级不是很高，我们优先处理
-                                // 其他重要任务。
-                                timeout = true;
-                                break;
-                            }
                             case SIGTERM: {
                                 stop_sever = true;
                             }
@@ -185,7 +174,7 @@ int main(int argc, char * argv[]) {
                     if (timer) {
                         tw.del_timer(timer);
                         printf("adjust time once\n");
-                        tw_timer * new_timer = tw.add_timer(10*TIMESLOT);
+                        tw_timer * new_timer = tw.add_timer(TIMEOUT);
                         new_timer->cb_func = cb_func;
                         new_timer->user_data = &users[sockfd];
                         users[sockfd].timer = new_timer;
@@ -197,13 +186,13 @@ int main(int argc, char * argv[]) {
             }
         }
 
-        // 最后处理定时事件
-        if (timeout) {
-            timer_handler();
-            timeout = false;
-        }
+        // 最后处理定时事件。定时任务的优先级不是很高，因此在处理完其他
+        // 重要任务之后才处理它们。每轮至多处理 MAX_EXPIRE_PER_TICK 个，
+        // 大量连接同时超时时也不会长时间阻塞事件循环。
+        tw.tick(MAX_EXPIRE_PER_TICK);
     }
 
+    tw.stats().dump(stdout);
     close(epollfd);
     close(listen_fd);
     close(pipefd[1]);
@@ -3,13 +3,18 @@
  * @author
  * @date 2024-03-11
  * @brief 升序定时器链表。
+ *
+ * sort_timer_lst 是通用的升序链表，添加和调整定时器需要 O(n) 的遍历。
+ * fifo_timer_lst 为每种超时时长维护一条 FIFO 链表：超时时长相同的定时器按
+ * 加入（或刷新）的先后顺序到期，因此刷新只需将其摘下并追加到链表尾部，是 O(1)
+ * 操作。超时时长种类过多或未设置超时时长的定时器则退回到 sort_timer_lst。
 */
 #ifndef LST_TIMER
 #define LST_TIMER
 
-#include <ctime>
 #include <netinet/in.h>
 #include <cstdio>
+#include "timer_clock.h"
 
 #define BUFFER_SIZE 64
 
@@ -26,9 +31,11 @@ struct client_data {
 // 定时器类
 class util_timer {
 public:
-    util_timer(): prev(nullptr), next(nullptr) {}
+    util_timer(): timeout(0), bucket(-1), prev(nullptr), next(nullptr) {}
 public:
-    time_t expire;      // 超时时间
+    long long expire;   // 超时时间（单调时钟，毫秒）
+    int timeout;        // 超时时长（毫秒），fifo_timer_lst 据此将定时器归入 FIFO 链表
+    int bucket;         // 定时器所在的 FIFO 链表的序号，-1 表示位于通用链表中
     void (*cb_func)(client_data *);  // 任务回调函数
     client_data * user_data;  // 回调函数处理的客户数据，由定时器的执行者传递给回调函数
     util_timer * prev;
@@ -119,12 +126,18 @@ public:
         delete timer;
     }
 
-    // SIGALRM 信号每次被触发就在其信号处理函数中执行依次 tick 函数，
-    // 以处理链表上到期的任务
+    // 距离最早到期的定时器还有多少毫秒，可直接用作 epoll_wait 的超时参数。
+    // 链表为空时返回 -1，表示无限等待。
+    int next_timeout() const {
+        if (!head) return -1;
+        long long delta = head->expire - timer_clock::now();
+        return delta > 0 ? (int)delta : 0;
+    }
+
+    // 每轮事件循环结束时执行一次 tick 函数，以处理链表上到期的任务
     void tick() {
         if (!head) return;
-        printf("timer tick\n");
-        time_t cur = time(nullptr);  // 获取系统当前时间
+        long long cur = timer_clock::now();  // 获取本轮缓存的当前时间
         util_timer * tmp = head;
         while (tmp) {
             if (cur < tmp->expire) break;
@@ -171,4 +184,147 @@ private:
     util_timer * tail;
 };
 
+// 按超时时长分桶的定时器链表，接口与 sort_timer_lst 相同。
+// 使用前需设置定时器的 timeout 字段，并令 expire = timer_clock::now() + timeout。
+class fifo_timer_lst {
+public:
+    fifo_timer_lst(): bucket_number(0) {}
+
+    ~fifo_timer_lst() {
+        for (int i=0; i<bucket_number; ++i) {
+            util_timer * tmp = buckets[i].head;
+            while (tmp) {
+                buckets[i].head = tmp->next;
+                delete tmp;
+                tmp = buckets[i].head;
+            }
+        }
+    }
+public:
+    // 将目标定时器 timer 添加到超时时长对应的 FIFO 链表尾部
+    void add_timer(util_timer * timer) {
+        if (!timer) return;
+        int b = find_bucket(timer->timeout);
+        if (b < 0 || (buckets[b].tail && timer->expire < buckets[b].tail->expire)) {
+            add_to_general(timer);
+            return;
+        }
+        append(b, timer);
+    }
+
+    // 定时器的超时时间被延长后调用。同一 FIFO 链表中最后被刷新的定时器总是
+    // 最晚到期，所以只需把它移到链表尾部。
+    void adjust_timer(util_timer * timer) {
+        if (!timer) return;
+        if (timer->bucket < 0) {
+            general.adjust_timer(timer);
+            return;
+        }
+        int b = timer->bucket;
+        if (timer == buckets[b].tail) return;
+        unlink(timer);
+        if (timer->expire < buckets[b].tail->expire) {
+            // 超时时间与该链表的顺序不符（例如调用者修改了 timeout），交给通用链表处理
+            add_to_general(timer);
+            return;
+        }
+        append(b, timer);
+    }
+
+    void delete_timer(util_timer * timer) {
+        if (!timer) return;
+        if (timer->bucket < 0) {
+            general.delete_timer(timer);
+            return;
+        }
+        unlink(timer);
+        delete timer;
+    }
+
+    // 距离最早到期的定时器还有多少毫秒，没有定时器时返回 -1
+    int next_timeout() const {
+        int ret = general.next_timeout();
+        long long cur = timer_clock::now();
+        for (int i=0; i<bucket_number; ++i) {
+            if (!buckets[i].head) continue;
+            long long delta = buckets[i].head->expire - cur;
+            int t = delta > 0 ? (int)delta : 0;
+            if (ret < 0 || t < ret) ret = t;
+        }
+        return ret;
+    }
+
+    // 处理各条链表上到期的任务。每条 FIFO 链表只需从头部开始检查。
+    void tick() {
+        long long cur = timer_clock::now();
+        for (int i=0; i<bucket_number; ++i) {
+            util_timer * tmp = buckets[i].head;
+            while (tmp && tmp->expire <= cur) {
+                unlink(tmp);
+                tmp->cb_func(tmp->user_data);
+                delete tmp;
+                tmp = buckets[i].head;
+            }
+        }
+        general.tick();
+    }
+private:
+    // 查找超时时长为 timeout 的 FIFO 链表，不存在时尝试创建一条。
+    // timeout 无效或链表数量已达上限时返回 -1。
+    int find_bucket(int timeout) {
+        if (timeout <= 0) return -1;
+        for (int i=0; i<bucket_number; ++i) {
+            if (buckets[i].timeout == timeout) return i;
+        }
+        if (bucket_number >= MAX_BUCKET_NUMBER) return -1;
+        buckets[bucket_number].timeout = timeout;
+        buckets[bucket_number].head = nullptr;
+        buckets[bucket_number].tail = nullptr;
+        return bucket_number++;
+    }
+
+    void append(int b, util_timer * timer) {
+        timer->bucket = b;
+        timer->next = nullptr;
+        timer->prev = buckets[b].tail;
+        if (buckets[b].tail) {
+            buckets[b].tail->next = timer;
+        } else {
+            buckets[b].head = timer;
+        }
+        buckets[b].tail = timer;
+    }
+
+    void unlink(util_timer * timer) {
+        int b = timer->bucket;
+        if (timer->prev) {
+            timer->prev->next = timer->next;
+        } else {
+            buckets[b].head = timer->next;
+        }
+        if (timer->next) {
+            timer->next->prev = timer->prev;
+        } else {
+            buckets[b].tail = timer->prev;
+        }
+        timer->prev = timer->next = nullptr;
+    }
+
+    void add_to_general(util_timer * timer) {
+        timer->bucket = -1;
+        timer->prev = timer->next = nullptr;
+        general.add_timer(timer);
+    }
+private:
+    struct fifo_bucket {
+        int timeout;          // 该链表中定时器的超时时长
+        util_timer * head;
+        util_timer * tail;
+    };
+    static const int MAX_BUCKET_NUMBER = 8;  // FIFO 链表的最大数量
+    fifo_bucket buckets[MAX_BUCKET_NUMBER];
+    int bucket_number;                       // 已使用的 FIFO 链表数量
+    sort_timer_lst general;                  // 超时时长不固定的定时器使用的通用链表
+};
+
 #endif
\ No newline at end of file
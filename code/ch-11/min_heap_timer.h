@@ -3,13 +3,21 @@
  * @author
  * @date 2024-03-13
  * @brief 时间堆
+ *
+ * 每个定时器都记录自己在堆数组中的下标，因此删除和调整定时器都是真正的
+ * O(log n) 操作，不再依赖“延迟销毁”。堆采用 4 叉（ARITY）布局：一个结点的
+ * 子结点在数组中连续存放，下虑时比较的元素位于同一块缓存行内，同时树高减半。
+ *
+ * tick 时到期的定时器先从堆中取出放入一个批次，每次 tick 至多执行其中的
+ * 若干个回调，其余的留到下一次 tick 继续执行。
 */
 #ifndef MIN_HEAP_TIMER
 #define MIN_HEAP_TIMER
 
 #include <exception>
 #include <netinet/in.h>
-#include <ctime>
+#include "timer_clock.h"
+#include "timer_stats.h"
 
 #define BUFFER_SIZE 64
 
@@ -26,19 +34,25 @@ struct client_data {
 
 class heap_timer {
 public:
-    heap_timer(int delay) {
-        expire = time(nullptr) + delay;
+    // delay 为定时器的超时时间（毫秒）
+    heap_timer(int delay): cb_func(nullptr), user_data(nullptr), index(-1) {
+        expire = timer_clock::now() + delay;
     }
 public:
-    time_t expire;                     // 定时器生效的绝对时间
+    long long expire;                  // 定时器生效的绝对时间（单调时钟，毫秒）
     void (*cb_func)(client_data *);    // 定时器的回调函数
     client_data * user_data;           // 用户数据
+    // 定时器在堆数组中的下标，不在堆中时为 -1；
+    // 已到期、位于待执行批次中时为 -(pos+2)，pos 是它在批次数组中的下标
+    int index;
 };
 
 class time_heap {
 public:
     // 初始化一个容量为 cap 的空堆。
-    time_heap(int cap): capacity(cap), cur_size(0) {
+    time_heap(int cap): capacity(cap), cur_size(0), batch(nullptr),
+        batch_capacity(0), batch_head(0), batch_tail(0), batch_number(0) {
+        if (capacity <= 0) capacity = 1;
         array = new heap_timer* [capacity];
         if (!array) throw exception();
         for (int i=0; i<capacity; ++i) {
@@ -48,8 +62,9 @@ public:
 
     // 用已有数组来初始化堆
     time_heap(heap_timer* *init_array, int size, int cap)
-    : cur_size(size), capacity(cap) {
-        if (capacity < cur_size) {
+    : capacity(cap), cur_size(size), batch(nullptr), batch_capacity(0),
+      batch_head(0), batch_tail(0), batch_number(0) {
+        if (capacity < cur_size || capacity <= 0) {
             throw exception();
         }
         array = new heap_timer* [capacity];
@@ -62,9 +77,10 @@ public:
         if (cur_size != 0) {
             for (int i=0; i<cur_size; ++i) {
                 array[i] = init_array[i];
+                array[i]->index = i;
             }
-            // 对数组中的第⌊(cur_size-1)/2⌋~0个元素执行下虑操作
-            for (int i=(cur_size-1)/2; i>=0; --i) {
+            // 从最后一个非叶子结点开始，到根结点为止，依次执行下虑操作
+            for (int i=(cur_size-2)/ARITY; i>=0; --i) {
                 percolate_down(i);
             }
         }
@@ -75,6 +91,10 @@ public:
             delete array[i];
         }
         delete [] array;
+        for (int i=batch_head; i<batch_tail; ++i) {
+            delete batch[i];
+        }
+        delete [] batch;
     }
 public:
     // 添加目标定时器
@@ -82,23 +102,45 @@ public:
         if (!timer) return;
         if (cur_size >= capacity) resize();
         int hole = cur_size++;
-        int parent = 0;
-        for (; hole > 0; hole = parent) {
-            parent = (hole - 1) / 2;
-            if (array[parent]->expire <= timer->expire) {
-                break;
-            }
-            array[hole] = array[parent];
-        }
         array[hole] = timer;
+        timer->index = hole;
+        percolate_up(hole);
     }
 
-    // 删除目标定时器
+    // 删除目标定时器：用堆尾元素填补空穴，再根据它与原定时器的大小关系上虑或下虑。
     void del_timer(heap_timer * timer) {
         if (!timer) return;
-        // 仅仅将目标定时器的回调函数设为空，即所谓的延迟销毁。这将节省真正删除
-        // 该定时器造成的开销，但这样做容易使堆数组膨胀。
-        timer->cb_func = nullptr;
+        if (timer->index <= -2) {
+            take_from_batch(timer);
+            delete timer;
+            return;
+        }
+        int hole = timer->index;
+        if (hole < 0 || hole >= cur_size || array[hole] != timer) return;
+        remove_at(hole);
+        delete timer;
+    }
+
+    // 将目标定时器的超时时间修改为 expire，并调整它在堆中的位置。
+    // 超时时间提前时上虑，推迟时下虑。
+    void adjust_timer(heap_timer * timer, long long expire) {
+        if (!timer) return;
+        if (timer->index <= -2) {
+            // 定时器已到期但回调尚未执行，把它放回堆中
+            take_from_batch(timer);
+            timer->expire = expire;
+            add_timer(timer);
+            return;
+        }
+        int hole = timer->index;
+        if (hole < 0 || hole >= cur_size || array[hole] != timer) return;
+        long long old_expire = timer->expire;
+        timer->expire = expire;
+        if (expire < old_expire) {
+            percolate_up(hole);
+        } else if (expire > old_expire) {
+            percolate_down(hole);
+        }
     }
 
     // 获取堆顶部的定时器
@@ -110,53 +152,152 @@ public:
     // 删除堆顶部的定时器
     void pop_timer() {
         if (empty()) return;
-        delete array[0];
-        array[0] = nullptr;
-        if (cur_size > 1) {
-            array[0] = array[cur_size-1];
-        }
-        if (array[0]) {
-            percolate_down(0);
-        }
-        --cur_size;
+        heap_timer * tmp = array[0];
+        remove_at(0);
+        delete tmp;
     }
 
-    // 心搏函数
-    void tick() {
-        heap_timer * tmp = top();
-        time_t cur = time(nullptr);
-        while (!empty()) {
-            if (!tmp) break;
-            if (tmp->expire > cur) break;
+    // 距离堆顶定时器到期还有多少毫秒，堆为空时返回 -1。
+    // 仍有积压的到期定时器时返回 0，让事件循环尽快回来继续处理。
+    int next_timeout() const {
+        if (batch_number > 0) return 0;
+        if (empty()) return -1;
+        long long delta = array[0]->expire - timer_clock::now();
+        return delta > 0 ? (int)delta : 0;
+    }
+
+    // 心搏函数。先把所有到期的定时器移入待执行批次，再按到期的先后顺序至多
+    // 执行 max_number 个回调（负数表示不限制），其余的留到下一次 tick。
+    void tick(int max_number = -1) {
+        long long cur = timer_clock::now();
+        while (!empty() && array[0]->expire <= cur) {
+            heap_timer * tmp = array[0];
+            remove_at(0);
+            push_batch(tmp);
+        }
+        m_stats.expired = 0;
+        while (batch_head < batch_tail &&
+               (max_number < 0 || m_stats.expired < max_number)) {
+            heap_timer * tmp = batch[batch_head++];
+            if (!tmp) continue;  // 已被删除或调整的定时器
+            --batch_number;
+            tmp->index = -1;
+            m_stats.record(cur - tmp->expire);
             if (tmp->cb_func) {
                 tmp->cb_func(tmp->user_data);
             }
-            pop_timer();
-            tmp = top();
-        } 
+            delete tmp;
+        }
+        if (batch_number == 0) {
+            batch_head = batch_tail = 0;
+        }
+        m_stats.finish_tick(batch_number);
+    }
+
+    // 到期处理的统计信息
+    const timer_stats & stats() const {
+        return m_stats;
     }
 
     bool empty() const {
         return cur_size == 0;
     }
+
+    int size() const {
+        return cur_size;
+    }
 private:
+    // 将到期的定时器追加到待执行批次的尾部
+    void push_batch(heap_timer * timer) {
+        if (batch_tail >= batch_capacity) {
+            // 先把尚未执行的部分移到数组开头，空间仍不够时再扩大一倍
+            int live = batch_tail - batch_head;
+            int new_capacity = batch_capacity;
+            if (live * 2 >= batch_capacity) {
+                new_capacity = batch_capacity ? batch_capacity * 2 : 64;
+            }
+            heap_timer* *tmp = new heap_timer* [new_capacity];
+            for (int i=0; i<live; ++i) {
+                tmp[i] = batch[batch_head+i];
+                if (tmp[i]) tmp[i]->index = -(i + 2);
+            }
+            delete [] batch;
+            batch = tmp;
+            batch_capacity = new_capacity;
+            batch_head = 0;
+            batch_tail = live;
+        }
+        timer->index = -(batch_tail + 2);
+        batch[batch_tail++] = timer;
+        ++batch_number;
+    }
+
+    // 将定时器从待执行批次中取出（不释放它）
+    void take_from_batch(heap_timer * timer) {
+        int pos = -timer->index - 2;
+        if (pos < batch_head || pos >= batch_tail || batch[pos] != timer) return;
+        batch[pos] = nullptr;
+        timer->index = -1;
+        --batch_number;
+    }
+
+    // 从堆中取出下标为 hole 的定时器（不释放它）
+    void remove_at(int hole) {
+        array[hole]->index = -1;
+        int last = --cur_size;
+        if (hole == last) {
+            array[last] = nullptr;
+            return;
+        }
+        array[hole] = array[last];
+        array[hole]->index = hole;
+        array[last] = nullptr;
+        if (hole > 0 && array[hole]->expire < array[(hole-1)/ARITY]->expire) {
+            percolate_up(hole);
+        } else {
+            percolate_down(hole);
+        }
+    }
+
+    // 最小堆的上虑操作，将 hole 处的定时器沿着父结点方向移动到合适的位置。
+    void percolate_up(int hole) {
+        heap_timer * tmp = array[hole];
+        int parent = 0;
+        for (; hole > 0; hole = parent) {
+            parent = (hole - 1) / ARITY;
+            if (array[parent]->expire <= tmp->expire) {
+                break;
+            }
+            array[hole] = array[parent];
+            array[hole]->index = hole;
+        }
+        array[hole] = tmp;
+        tmp->index = hole;
+    }
+
     // 最小堆的下虑操作，它确保堆数组中以 hole 为根结点的子树拥有最小堆的性质。
     void percolate_down(int hole) {
         heap_timer * tmp = array[hole];
         int child = 0;
-        for (; hole*2+1 <= cur_size-1; hole = child) {
-            child = hole * 2 + 1;
-            if ((child < cur_size-1) && 
-                (array[child+1]->expire < array[child]->expire)) {
-                ++child;
+        for (; hole*ARITY+1 <= cur_size-1; hole = child) {
+            // 在至多 ARITY 个连续存放的子结点中找到超时时间最小的一个
+            child = hole * ARITY + 1;
+            int end = child + ARITY;
+            if (end > cur_size) end = cur_size;
+            for (int c=child+1; c<end; ++c) {
+                if (array[c]->expire < array[child]->expire) {
+                    child = c;
+                }
             }
             if (array[child]->expire < tmp->expire) {
                 array[hole] = array[child];
+                array[hole]->index = hole;
             } else {
                 break;
             }
         }
         array[hole] = tmp;
+        tmp->index = hole;
     }
 
     // 将堆数组的容量扩大一倍
@@ -176,9 +317,16 @@ private:
         array = tmp;
     }
 private:
+    static const int ARITY = 4;  // 堆的叉数
     heap_timer* *array;   // 堆数组
     int capacity;         // 堆数组的容量
     int cur_size;         // 堆数组当前的元素个数
+    heap_timer* *batch;   // 已到期、等待执行回调的定时器
+    int batch_capacity;   // 批次数组的容量
+    int batch_head;       // 批次中下一个待执行的位置
+    int batch_tail;       // 批次数组中已使用部分的末尾
+    int batch_number;     // 批次中尚未执行的定时器数量
+    timer_stats m_stats;  // 到期处理的统计信息
 };
 
-#endif
\ No newline at end of file
+#endif
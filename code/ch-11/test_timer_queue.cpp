@@ -0,0 +1,162 @@
+/**
+ * @file test_timer_queue.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief 用随机操作序列检查 timer_queue 各个后端的正确性。
+ *
+ * 按事件循环的方式推进时间：每一步先 expire(now)，再随机添加、调整或取消定时器，
+ * 最后检查 next_timeout(now) 不晚于真正最早的超时时间（否则 epoll_wait 会睡过头），
+ * 并检查每个定时器都恰好在到期后的第一次 expire 中被执行。时间推进时有意停在
+ * 时间轮一圈的边界上，也会跳过很长的空闲时段。最后检查队列析构时会析构仍在
+ * 队列中的定时器所携带的用户数据。
+ * 用法: test_timer_queue [seed_number]
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include "timer_queue.h"
+
+static long long cur_time = 0;
+static int error_count = 0;
+
+// 记录构造和析构次数的用户数据
+struct counted {
+    static int live;
+    int conn;
+    counted(): conn(-1) { ++live; }
+    counted(int c): conn(c) { ++live; }
+    counted(const counted & other): conn(other.conn) { ++live; }
+    counted & operator=(const counted & other) { conn = other.conn; return *this; }
+    ~counted() { --live; }
+};
+int counted::live = 0;
+
+template <typename QUEUE>
+struct check_context {
+    static std::vector<typename QUEUE::handle> handles;
+    static std::map<int, long long> pending;   // 连接编号 -> 超时时间
+    static void on_expire(counted & data) {
+        std::map<int, long long>::iterator it = pending.find(data.conn);
+        if (it == pending.end()) {
+            printf("  timer %d fired twice or after cancel\n", data.conn);
+            ++error_count;
+            return;
+        }
+        if (it->second > cur_time) {
+            printf("  timer %d fired early: expire %lld now %lld\n",
+                   data.conn, it->second, cur_time);
+            ++error_count;
+        }
+        pending.erase(it);
+        handles[data.conn] = nullptr;
+    }
+};
+
+template <typename QUEUE>
+std::vector<typename QUEUE::handle> check_context<QUEUE>::handles;
+template <typename QUEUE>
+std::map<int, long long> check_context<QUEUE>::pending;
+
+/**
+ * @brief 随机选择下一个时刻：多数是小步前进，也会停在 256ms 的边界上或长时间空闲
+*/
+static long long next_time(long long now) {
+    int r = rand() % 100;
+    if (r < 70) return now + rand() % 20;
+    if (r < 90) return (now | 255) + 1;
+    if (r < 98) return now + rand() % 3000;
+    return now + 600000 + rand() % 100000;
+}
+
+/**
+ * @brief 在后端 Backend 上执行一个随机操作序列，返回发现的错误数量
+*/
+template <template <typename> class Backend>
+int check(const char * name, unsigned seed, int steps) {
+    typedef timer_queue<counted, Backend> queue_type;
+    typedef check_context<queue_type> context;
+    const int conn_number = 512;
+    context::handles.assign(conn_number, nullptr);
+    context::pending.clear();
+    error_count = 0;
+    srand(seed);
+    cur_time = 1000 + rand() % 100000;
+    {
+        queue_type queue(cur_time);
+        for (int step=0; step<steps; ++step) {
+            cur_time = next_time(cur_time);
+            queue.expire(cur_time);
+            for (std::map<int, long long>::iterator it=context::pending.begin();
+                 it!=context::pending.end(); ++it) {
+                if (it->second <= cur_time) {
+                    printf("  %s: timer %d not fired: expire %lld now %lld\n",
+                           name, it->first, it->second, cur_time);
+                    ++error_count;
+                }
+            }
+            int ops = rand() % 8;
+            for (int i=0; i<ops; ++i) {
+                int conn = rand() % conn_number;
+                long long expire = cur_time + 1 + rand() % (rand() % 4 == 0 ? 100000 : 600);
+                if (!context::handles[conn]) {
+                    context::handles[conn] = queue.add(expire, counted(conn),
+                                                       context::on_expire);
+                    context::pending[conn] = expire;
+                } else if (rand() % 4 == 0) {
+                    queue.cancel(context::handles[conn]);
+                    context::handles[conn] = nullptr;
+                    context::pending.erase(conn);
+                } else {
+                    queue.adjust(context::handles[conn], expire);
+                    context::pending[conn] = expire;
+                }
+            }
+            long long earliest = -1;
+            for (std::map<int, long long>::iterator it=context::pending.begin();
+                 it!=context::pending.end(); ++it) {
+                if (earliest < 0 || it->second < earliest) earliest = it->second;
+            }
+            int timeout = queue.next_timeout(cur_time);
+            if (earliest < 0) {
+                if (timeout != -1) {
+                    printf("  %s: next_timeout %d on an empty queue\n", name, timeout);
+                    ++error_count;
+                }
+            } else if (timeout < 0 || cur_time + timeout > earliest) {
+                printf("  %s: next_timeout late %d vs %lld\n",
+                       name, timeout, earliest - cur_time);
+                ++error_count;
+            }
+            if (error_count > 10) break;
+        }
+        if ((size_t)queue.size() != context::pending.size()) {
+            printf("  %s: size %zu, expected %zu\n",
+                   name, queue.size(), context::pending.size());
+            ++error_count;
+        }
+    }
+    if (counted::live != 0) {
+        printf("  %s: %d user data objects not destroyed\n", name, counted::live);
+        ++error_count;
+        counted::live = 0;
+    }
+    return error_count;
+}
+
+int main(int argc, char * argv[]) {
+    int seed_number = argc > 1 ? atoi(argv[1]) : 20;
+    if (seed_number <= 0) {
+        printf("usage: %s [seed_number]\n", argv[0]);
+        return 1;
+    }
+    int total = 0;
+    for (int seed=1; seed<=seed_number; ++seed) {
+        total += check<sorted_list_backend>("sorted_list", seed, 20000);
+        total += check<heap2_backend>("heap2", seed, 20000);
+        total += check<heap4_backend>("heap4", seed, 20000);
+        total += check<wheel_backend>("wheel", seed, 20000);
+    }
+    printf("%d seeds, %d errors\n", seed_number, total);
+    return total == 0 ? 0 : 1;
+}
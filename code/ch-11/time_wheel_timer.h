@@ -8,8 +8,9 @@
 #define TIME_WHEEL_TIMER
 
 #include <netinet/in.h>
-#include <ctime>
 #include <cstdio>
+#include "timer_clock.h"
+#include "timer_stats.h"
 
 #define BUFFER_SIZE 64
 
@@ -24,11 +25,12 @@ struct client_data {
 
 class tw_timer {
 public:
-    tw_timer(int rot, int ts)
-    : rotation(rot), time_slot(ts), prev(nullptr), next(nullptr) {}
+    tw_timer(int rot, int ts, long long exp)
+    : rotation(rot), time_slot(ts), expire(exp), prev(nullptr), next(nullptr) {}
 public:
     int rotation;   // 记录定时器在时间轮转动多少圈后生效
-    int time_slot;  // 记录定时器属于时间轮的哪个槽
+    int time_slot;  // 记录定时器属于时间轮的哪个槽，-1 表示已到期、等待执行
+    long long expire;  // 定时器所在的槽被处理的时间（单调时钟，毫秒）
     void (*cb_func)(client_data *);  // 定时器回调函数
     client_data * user_data;         // 客户数据
     tw_timer * prev;
@@ -37,7 +39,8 @@ public:
 
 class time_wheel {
 public:
-    time_wheel(): cur_slot(0) {
+    time_wheel(): cur_slot(0), next_tick(timer_clock::now() + SI),
+        pending_head(nullptr), pending_tail(nullptr), pending_number(0) {
         for (int i=0; i<N; ++i) {
             slots[i] = nullptr;  // 初始化每个槽的头节点
         }
@@ -53,9 +56,14 @@ public:
                 tmp = slots[i];
             }
         }
+        while (pending_head) {
+            tw_timer * tmp = pending_head;
+            pending_head = tmp->next;
+            delete tmp;
+        }
     }
 
-    // 根据定时值 timeout 来创建一个定时器，并把它插入到合适的槽中
+    // 根据定时值 timeout（毫秒）来创建一个定时器，并把它插入到合适的槽中
     tw_timer * add_timer(int timeout) {
         if (timeout < 0) return nullptr;
         // 根据待插入的定时器的定时值 timeout 来计算它将在时间轮转动多少个滴答后被触发，
@@ -71,12 +79,12 @@ public:
         int rotation = ticks / N;
         // 计算待插入的定时器应该被插入到哪个槽中
         int ts = (cur_slot + ticks%N) % N;
-        tw_timer * timer = new tw_timer(rotation, ts);
+        // 当前槽将在 next_tick 时被处理，之后每个槽间隔 SI
+        tw_timer * timer = new tw_timer(rotation, ts,
+                                next_tick + (long long)(ticks%N + rotation*N) * SI);
         // 如果第 ts 个时间槽中尚无任何定时器，则将新创建的定时器插入其中，并将该
         // 定时器设置为该槽的头结点。
         if (!slots[ts]) {
-            printf("add timer, rotation is %d, ts slot is %d, cur_slot is %d\n",
-                rotation, ts, cur_slot);
             slots[ts] = timer;
         } else {
             slots[ts]->prev = timer;
@@ -90,7 +98,10 @@ public:
     void del_timer(tw_timer * timer) {
         if (!timer) return;
         int ts = timer->time_slot;
-        if (slots[ts] == timer) {
+        if (ts == PENDING) {
+            unlink_pending(timer);
+            delete timer;
+        } else if (slots[ts] == timer) {
             slots[ts] = slots[ts]->next;
             if (slots[ts]) {
                 slots[ts]->prev = nullptr;
@@ -105,43 +116,108 @@ public:
         }
     }
 
-    // SI 时间到后，调用该函数，时间轮向前滚动一个槽的间隔
-    void tick() {
+    // 距离时间轮下一次转动还有多少毫秒，可直接用作 epoll_wait 的超时参数。
+    // 仍有积压的到期定时器时返回 0，让事件循环尽快回来继续处理。
+    int next_timeout() const {
+        if (pending_number > 0) return 0;
+        long long delta = next_tick - timer_clock::now();
+        return delta > 0 ? (int)delta : 0;
+    }
+
+    // 每轮事件循环结束时调用该函数。根据单调时钟计算已经流逝了多少个槽间隔，
+    // 并让时间轮向前滚动相应的槽数，这样即使某次唤醒迟到，也不会丢失滴答。
+    // 到期的定时器先被收集到等待队列中，本次至多执行 max_number 个回调
+    // （负数表示不限制），其余的留到下一次 tick，以免大量连接同时超时时长时间
+    // 阻塞事件循环。
+    void tick(int max_number = -1) {
+        long long cur = timer_clock::now();
+        while (cur >= next_tick) {
+            tick_slot();
+            next_tick += SI;
+        }
+        m_stats.expired = 0;
+        while (pending_head && (max_number < 0 || m_stats.expired < max_number)) {
+            tw_timer * tmp = pending_head;
+            unlink_pending(tmp);
+            m_stats.record(cur - tmp->expire);
+            tmp->cb_func(tmp->user_data);
+            delete tmp;
+        }
+        m_stats.finish_tick(pending_number);
+    }
+
+    // 到期处理的统计信息
+    const timer_stats & stats() const {
+        return m_stats;
+    }
+private:
+    // 时间轮向前滚动一个槽的间隔，把当前槽中到期的定时器移入等待队列
+    void tick_slot() {
         tw_timer * tmp = slots[cur_slot];
-        printf("current slot is %d\n", cur_slot);
         while (tmp) {
-            printf("tick the timer once\n");
             if (tmp->rotation > 0) {
                 tmp->rotation--;
                 tmp = tmp->next;
             } else {
-                tmp->cb_func(tmp->user_data);
+                tw_timer * tmp2 = tmp->next;
                 if (tmp == slots[cur_slot]) {
-                    printf("delete header in current slot\n");
-                    slots[cur_slot] = slots[cur_slot]->next;
-                    delete tmp;
-                    if (slots[cur_slot]) {
-                        slots[cur_slot]->prev = nullptr;
+                    slots[cur_slot] = tmp2;
+                    if (tmp2) {
+                        tmp2->prev = nullptr;
                     }
-                    tmp = slots[cur_slot];
                 } else {
-                    tmp->prev->next = tmp->next;
-                    if (tmp->next) {
-                        tmp->next->prev = tmp->prev;
+                    tmp->prev->next = tmp2;
+                    if (tmp2) {
+                        tmp2->prev = tmp->prev;
                     }
-                    tw_timer * tmp2 = tmp->next;
-                    delete tmp;
-                    tmp = tmp2;
                 }
+                append_pending(tmp);
+                tmp = tmp2;
             }
         }
-        cur_slot = ++cur_slot % N;
+        cur_slot = (cur_slot + 1) % N;
+    }
+
+    // 将到期的定时器追加到等待队列尾部
+    void append_pending(tw_timer * timer) {
+        timer->time_slot = PENDING;
+        timer->next = nullptr;
+        timer->prev = pending_tail;
+        if (pending_tail) {
+            pending_tail->next = timer;
+        } else {
+            pending_head = timer;
+        }
+        pending_tail = timer;
+        ++pending_number;
+    }
+
+    // 将定时器从等待队列中摘下
+    void unlink_pending(tw_timer * timer) {
+        if (timer->prev) {
+            timer->prev->next = timer->next;
+        } else {
+            pending_head = timer->next;
+        }
+        if (timer->next) {
+            timer->next->prev = timer->prev;
+        } else {
+            pending_tail = timer->prev;
+        }
+        timer->prev = timer->next = nullptr;
+        --pending_number;
     }
 private:
-    static const int N = 60;  // 时间轮上槽的个数
-    static const int SI = 1;  // 槽间隔 (slot interval) 为 1s
-    tw_timer * slots[N];      // 时间轮的槽，其中每个元素指向一个定时器链表
-    int cur_slot;             // 时间轮的当前槽
+    static const int N = 60;     // 时间轮上槽的个数
+    static const int SI = 1000;  // 槽间隔 (slot interval) 为 1000ms
+    static const int PENDING = -1;
+    tw_timer * slots[N];         // 时间轮的槽，其中每个元素指向一个定时器链表
+    int cur_slot;                // 时间轮的当前槽
+    long long next_tick;         // 时间轮下一次转动的时间（单调时钟，毫秒）
+    tw_timer * pending_head;     // 已到期、等待执行的定时器队列
+    tw_timer * pending_tail;
+    int pending_number;          // 等待执行的定时器数量
+    timer_stats m_stats;         // 到期处理的统计信息
 };
 
 #endif
\ No newline at end of file
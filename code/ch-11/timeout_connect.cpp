@@ -5,9 +5,10 @@
  * @brief 设置connect超时时间。
 */
 #include <sys/types.h>
-#include <sys/socket.h> // socket, setsockopt, connect
+#include <sys/socket.h> // socket, getsockopt, connect
 #include <netinet/in.h> // sockaddr_in, htons
 #include <arpa/inet.h>  // inet_pton
+#include <poll.h>   // poll
 #include <fcntl.h>
 #include <unistd.h> // close
 #include <cstring>  // basename, bzero
@@ -15,8 +16,11 @@
 #include <cstdlib>  // atoi
 #include <cassert>  // assert
 #include <cerrno>   // errno
+#include "timer_clock.h"
 
-// 超时连接函数
+// 超时连接函数。time 为超时时间（毫秒）。
+// 使用非阻塞 connect 加 poll 等待，并以单调时钟计算剩余时间，这样被信号打断
+// 后重新等待也不会延长总的超时时间，且不受系统时间调整的影响。
 int timeout_connect(const char * ip, int port, int time) {
     int ret = 0;
     sockaddr_in address;
@@ -27,24 +31,52 @@ int timeout_connect(const char * ip, int port, int time) {
 
     int sockfd = socket(PF_INET, SOCK_STREAM, 0);
     assert(sockfd >= 0);
-
-    timeval timeout;
-    timeout.tv_sec = time;
-    timeout.tv_usec = 0;
-    socklen_t len = sizeof(timeout);
-    ret = setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, len);
-    assert(ret != -1);
+    int old_option = fcntl(sockfd, F_GETFL);
+    fcntl(sockfd, F_SETFL, old_option | O_NONBLOCK);
 
     ret = connect(sockfd, (sockaddr *)&address, sizeof(address));
-    if (ret == -1) {
-        if (errno == EINPROGRESS) {
+    if (ret == 0) {
+        fcntl(sockfd, F_SETFL, old_option);
+        return sockfd;
+    } else if (errno != EINPROGRESS) {
+        printf("error occur when connecting to server\n");
+        close(sockfd);
+        return -1;
+    }
+
+    long long deadline = timer_clock::precise_now() + time;
+    pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = POLLOUT;
+    while (true) {
+        long long remain = deadline - timer_clock::precise_now();
+        if (remain <= 0) {
             printf("connection timeout, process timeout logic\n");
+            close(sockfd);
             return -1;
         }
+        pfd.revents = 0;
+        ret = poll(&pfd, 1, (int)remain);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("poll failure\n");
+            close(sockfd);
+            return -1;
+        } else if (ret > 0) {
+            break;
+        }
+    }
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
         printf("error occur when connecting to server\n");
+        close(sockfd);
         return -1;
     }
-
+    fcntl(sockfd, F_SETFL, old_option);
     return sockfd;
 }
 
@@ -56,7 +88,7 @@ int main(int argc, char * argv[]) {
     const char * ip = argv[1];
     int port = atoi(argv[2]);
 
-    int sockfd = timeout_connect(ip, port, 10);
+    int sockfd = timeout_connect(ip, port, 10000);
     if (sockfd < 0) {
         return 1;
     }
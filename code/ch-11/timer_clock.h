@@ -0,0 +1,68 @@
+/**
+ * @file timer_clock.h
+ * @author
+ * @date 2026-10-18
+ * @brief 定时器使用的毫秒级单调时钟
+ *
+ * 定时器以 CLOCK_MONOTONIC 计时，不受 NTP 或手动修改系统时间的影响。
+ * 事件循环每轮迭代只调用一次 update() 读取时钟并缓存结果，同一轮中的
+ * 其他代码通过 now() 直接使用缓存值，避免反复陷入 clock_gettime。
+*/
+#ifndef TIMER_CLOCK_H
+#define TIMER_CLOCK_H
+
+#include <ctime>
+
+class timer_clock {
+public:
+    /**
+     * @brief 读取单调时钟并更新缓存。应在每轮 epoll_wait 返回后调用一次。
+     * @return 当前时间（毫秒）
+    */
+    static long long update() {
+        cached() = read_ms(coarse_id());
+        return cached();
+    }
+
+    /**
+     * @brief 获取缓存的当前时间（毫秒）。缓存尚未初始化时会读取一次时钟。
+    */
+    static long long now() {
+        if (cached() == 0) {
+            update();
+        }
+        return cached();
+    }
+
+    /**
+     * @brief 获取精确的当前时间（毫秒），不使用也不更新缓存。
+    */
+    static long long precise_now() {
+        return read_ms(CLOCK_MONOTONIC);
+    }
+private:
+    static long long & cached() {
+        static long long ms = 0;
+        return ms;
+    }
+
+    // CLOCK_MONOTONIC_COARSE 的读取开销极小，但精度只有一个 jiffy（通常 1~4ms），
+    // 对于毫秒级的空闲超时已经足够。不支持它的系统退回到 CLOCK_MONOTONIC。
+    static clockid_t coarse_id() {
+        #ifdef CLOCK_MONOTONIC_COARSE
+        return CLOCK_MONOTONIC_COARSE;
+        #else
+        return CLOCK_MONOTONIC;
+        #endif
+    }
+
+    static long long read_ms(clockid_t id) {
+        timespec ts;
+        if (clock_gettime(id, &ts) != 0) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+        }
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+};
+
+#endif
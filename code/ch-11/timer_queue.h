@@ -0,0 +1,566 @@
+/**
+ * @file timer_queue.h
+ * @author
+ * @date 2026-10-18
+ * @brief 通用定时器队列模板
+ *
+ * timer_queue<P, Backend> 以任意类型 P 作为定时器携带的用户数据，以 Backend
+ * 作为底层的数据结构，对外提供统一的 add/cancel/adjust/expire 接口。可选的
+ * 后端有：
+ *   - sorted_list_backend：升序双向链表（从尾部开始查找插入位置）
+ *   - heap2_backend / heap4_backend：带下标的二叉 / 4 叉最小堆
+ *   - wheel_backend：分层时间轮（1ms 精度，第一层 256 个槽，其余四层各 64 个槽）
+ * 时间均以毫秒为单位，通常取自 timer_clock::now()。创建队列时需传入当前时间，
+ * 时间轮以它作为起点。
+*/
+#ifndef TIMER_QUEUE_H
+#define TIMER_QUEUE_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * @brief 定时器的公共部分：超时时间、回调函数和用户数据
+*/
+template <typename P>
+struct timer_entry {
+    long long expire;          // 超时时间（毫秒）
+    void (*cb_func)(P &);      // 定时器回调函数
+    P user_data;               // 用户数据
+};
+
+/**
+ * @brief 双向循环链表的挂钩，链表和时间轮后端用它把定时器串起来
+*/
+struct timer_hook {
+    timer_hook(): prev(this), next(this) {}
+
+    bool linked() const { return next != this; }
+
+    // 将 node 插入到本结点之前（当本结点是哨兵时，即插入到链表尾部）
+    void insert_before(timer_hook * node) {
+        node->prev = prev;
+        node->next = this;
+        prev->next = node;
+        prev = node;
+    }
+
+    void unlink() {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+    }
+
+    timer_hook * prev;
+    timer_hook * next;
+};
+
+/**
+ * @brief 升序链表后端。新定时器的超时时间通常晚于已有的定时器，因此从尾部
+ * 开始向前查找插入位置，常见情况下插入和刷新都是 O(1)。
+*/
+template <typename E>
+class sorted_list_backend {
+public:
+    struct node : public E, public timer_hook {};
+
+    sorted_list_backend(): m_size(0) {}
+
+    void start(long long) {}
+
+    void insert(node * timer) {
+        timer_hook * pos = m_head.prev;
+        while (pos != &m_head && static_cast<node *>(pos)->expire > timer->expire) {
+            pos = pos->prev;
+        }
+        pos->next->prev = timer;
+        timer->next = pos->next;
+        timer->prev = pos;
+        pos->next = timer;
+        ++m_size;
+    }
+
+    void erase(node * timer) {
+        timer->timer_hook::unlink();
+        --m_size;
+    }
+
+    void update(node * timer) {
+        erase(timer);
+        insert(timer);
+    }
+
+    // 取出一个超时时间不晚于 now 的定时器，没有则返回 nullptr
+    node * pop_expired(long long now) {
+        if (!m_head.linked()) return nullptr;
+        node * first = static_cast<node *>(m_head.next);
+        if (first->expire > now) return nullptr;
+        erase(first);
+        return first;
+    }
+
+    // 最早的超时时间，队列为空时返回 -1
+    long long next_expire(long long) const {
+        if (!m_head.linked()) return -1;
+        return static_cast<const node *>(m_head.next)->expire;
+    }
+
+    // 移除所有定时器，对每个定时器调用 func
+    template <typename F>
+    void clear(F func) {
+        while (m_head.linked()) {
+            node * first = static_cast<node *>(m_head.next);
+            erase(first);
+            func(first);
+        }
+    }
+
+    size_t size() const { return m_size; }
+    size_t memory_bytes() const { return sizeof(*this); }
+private:
+    timer_hook m_head;   // 哨兵结点
+    size_t m_size;
+};
+
+/**
+ * @brief D 叉最小堆后端，每个定时器记录自己在堆数组中的下标。
+*/
+template <typename E, int D>
+class dary_heap_backend {
+public:
+    struct node : public E {
+        int index;   // 定时器在堆数组中的下标
+    };
+
+    void start(long long) {}
+
+    void insert(node * timer) {
+        timer->index = (int)m_array.size();
+        m_array.push_back(timer);
+        percolate_up(timer->index);
+    }
+
+    void erase(node * timer) {
+        int hole = timer->index;
+        node * last = m_array.back();
+        m_array.pop_back();
+        timer->index = -1;
+        if (last == timer) return;
+        m_array[hole] = last;
+        last->index = hole;
+        update(last);
+    }
+
+    void update(node * timer) {
+        int hole = timer->index;
+        if (hole > 0 && timer->expire < m_array[(hole-1)/D]->expire) {
+            percolate_up(hole);
+        } else {
+            percolate_down(hole);
+        }
+    }
+
+    node * pop_expired(long long now) {
+        if (m_array.empty() || m_array[0]->expire > now) return nullptr;
+        node * first = m_array[0];
+        erase(first);
+        return first;
+    }
+
+    long long next_expire(long long) const {
+        return m_array.empty() ? -1 : m_array[0]->expire;
+    }
+
+    template <typename F>
+    void clear(F func) {
+        std::vector<node *> array;
+        array.swap(m_array);
+        for (size_t i=0; i<array.size(); ++i) {
+            array[i]->index = -1;
+            func(array[i]);
+        }
+    }
+
+    size_t size() const { return m_array.size(); }
+    size_t memory_bytes() const {
+        return sizeof(*this) + m_array.capacity() * sizeof(node *);
+    }
+private:
+    void percolate_up(int hole) {
+        node * tmp = m_array[hole];
+        while (hole > 0) {
+            int parent = (hole - 1) / D;
+            if (m_array[parent]->expire <= tmp->expire) break;
+            m_array[hole] = m_array[parent];
+            m_array[hole]->index = hole;
+            hole = parent;
+        }
+        m_array[hole] = tmp;
+        tmp->index = hole;
+    }
+
+    void percolate_down(int hole) {
+        int size = (int)m_array.size();
+        node * tmp = m_array[hole];
+        while (hole * D + 1 < size) {
+            int child = hole * D + 1;
+            int end = child + D < size ? child + D : size;
+            for (int c=child+1; c<end; ++c) {
+                if (m_array[c]->expire < m_array[child]->expire) child = c;
+            }
+            if (m_array[child]->expire >= tmp->expire) break;
+            m_array[hole] = m_array[child];
+            m_array[hole]->index = hole;
+            hole = child;
+        }
+        m_array[hole] = tmp;
+        tmp->index = hole;
+    }
+private:
+    std::vector<node *> m_array;   // 堆数组
+};
+
+template <typename E>
+using heap2_backend = dary_heap_backend<E, 2>;
+template <typename E>
+using heap4_backend = dary_heap_backend<E, 4>;
+
+/**
+ * @brief 分层时间轮后端（与 Linux 内核早期的 timer wheel 相同的布局）。
+ *
+ * 第一层有 256 个槽，每槽 1ms；之后四层各有 64 个槽，每层一个槽的跨度是上一层
+ * 一整圈。时间轮转到第一层的 0 号槽时，把上一层对应槽中的定时器重新分配到下层。
+ * 插入和删除都是 O(1)，到期的定时器先移入就绪链表再逐个取出。
+*/
+template <typename E>
+class wheel_backend {
+public:
+    struct node : public E, public timer_hook {};
+
+    wheel_backend(): m_cur(0), m_size(0) {}
+
+    // 设置时间轮的起点
+    void start(long long now) {
+        m_cur = now;
+    }
+
+    void insert(node * timer) {
+        place(timer);
+        ++m_size;
+    }
+
+    void erase(node * timer) {
+        timer->timer_hook::unlink();
+        --m_size;
+    }
+
+    void update(node * timer) {
+        timer->timer_hook::unlink();
+        place(timer);
+    }
+
+    node * pop_expired(long long now) {
+        if (m_size == 0) {
+            // 空闲时也让时间轮跟上 now，之后加入的定时器不会以过时的起点分配
+            if (m_cur <= now) m_cur = now + 1;
+            return nullptr;
+        }
+        if (!m_ready.linked()) {
+            advance(now);
+            if (!m_ready.linked()) return nullptr;
+        }
+        node * first = static_cast<node *>(m_ready.next);
+        erase(first);
+        return first;
+    }
+
+    // 时间轮无法以 O(1) 得到最早的超时时间。这里只查看第一层，找不到时返回第一层
+    // 转完一圈的时刻，结果不晚于真正的最早超时时间，用作 epoll_wait 的超时是安全的。
+    // m_cur 恰好位于一圈的起点时，本圈的定时器还留在上层等待 advance() 下放，
+    // 需要把这些槽中最早的超时时间也考虑进来。
+    long long next_expire(long long now) const {
+        if (m_size == 0) return -1;
+        if (m_ready.linked()) return now;
+        long long earliest = (m_cur | ROOT_MASK) + 1;
+        if ((m_cur & ROOT_MASK) == 0) {
+            for (int level=0; level<LEVEL_NUMBER; ++level) {
+                int slot = (m_cur >> (ROOT_BITS + level * LEVEL_BITS)) & LEVEL_MASK;
+                const timer_hook & head = m_levels[level][slot];
+                for (const timer_hook * pos=head.next; pos!=&head; pos=pos->next) {
+                    long long expire = static_cast<const node *>(pos)->expire;
+                    if (expire < earliest) earliest = expire;
+                }
+                if (slot != 0) break;
+            }
+        }
+        for (long long t=m_cur; t<earliest; ++t) {
+            if (m_root[t & ROOT_MASK].linked()) return t;
+        }
+        return earliest;
+    }
+
+    template <typename F>
+    void clear(F func) {
+        timer_hook list;
+        move_all(m_ready, list);
+        for (int i=0; i<ROOT_SIZE; ++i) {
+            move_all(m_root[i], list);
+        }
+        for (int level=0; level<LEVEL_NUMBER; ++level) {
+            for (int i=0; i<LEVEL_SIZE; ++i) {
+                move_all(m_levels[level][i], list);
+            }
+        }
+        while (list.linked()) {
+            node * tmp = static_cast<node *>(list.next);
+            erase(tmp);
+            func(tmp);
+        }
+    }
+
+    size_t size() const { return m_size; }
+    size_t memory_bytes() const { return sizeof(*this); }
+private:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int ROOT_SIZE = 1 << ROOT_BITS;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const int ROOT_MASK = ROOT_SIZE - 1;
+    static const int LEVEL_MASK = LEVEL_SIZE - 1;
+    static const int LEVEL_NUMBER = 4;
+
+    // 根据超时时间与当前时刻的差值，把定时器放入合适的层和槽
+    void place(node * timer) {
+        long long expire = timer->expire;
+        long long delta = expire - m_cur;
+        if (delta < 0) {
+            m_ready.insert_before(timer);
+            return;
+        }
+        if (delta < ROOT_SIZE) {
+            m_root[expire & ROOT_MASK].insert_before(timer);
+            return;
+        }
+        for (int level=0; level<LEVEL_NUMBER; ++level) {
+            int shift = ROOT_BITS + (level + 1) * LEVEL_BITS;
+            if (delta < (1LL << shift) || level == LEVEL_NUMBER-1) {
+                if (delta >= (1LL << shift)) {
+                    // 超出时间轮的最大跨度，放到最高层最远的槽中，到时再重新分配
+                    expire = m_cur + (1LL << shift) - 1;
+                }
+                int slot = (expire >> (shift - LEVEL_BITS)) & LEVEL_MASK;
+                m_levels[level][slot].insert_before(timer);
+                return;
+            }
+        }
+    }
+
+    // 把链表 head 中的定时器全部移到链表 list 的尾部
+    static void move_all(timer_hook & head, timer_hook & list) {
+        while (head.linked()) {
+            timer_hook * tmp = head.next;
+            tmp->unlink();
+            list.insert_before(tmp);
+        }
+    }
+
+    // 把链表 list 中的定时器按当前的 m_cur 重新放入时间轮
+    void place_all(timer_hook & list) {
+        while (list.linked()) {
+            node * tmp = static_cast<node *>(list.next);
+            tmp->timer_hook::unlink();
+            place(tmp);
+        }
+    }
+
+    // 把第 level 层 slot 号槽中的定时器重新分配到更低的层，返回 slot
+    int cascade(int level, int slot) {
+        timer_hook list;
+        move_all(m_levels[level][slot], list);
+        place_all(list);
+        return slot;
+    }
+
+    // 取出所有定时器，以 now 为起点重新分配，到期的定时器进入就绪链表
+    void rebase(long long now) {
+        timer_hook list;
+        for (int i=0; i<ROOT_SIZE; ++i) {
+            move_all(m_root[i], list);
+        }
+        for (int level=0; level<LEVEL_NUMBER; ++level) {
+            for (int i=0; i<LEVEL_SIZE; ++i) {
+                move_all(m_levels[level][i], list);
+            }
+        }
+        m_cur = now + 1;
+        place_all(list);
+    }
+
+    // 时间轮转动到 now，把沿途到期的定时器移入就绪链表
+    void advance(long long now) {
+        // 时间轮空闲很久之后才加入定时器时，m_cur 远远落后于 now。重新分配所有定时器
+        // 的代价与定时器和槽的数量成正比，比逐毫秒转动过整段空闲时间小时就重新分配
+        if (now - m_cur > (long long)m_size + ROOT_SIZE + LEVEL_NUMBER * LEVEL_SIZE) {
+            rebase(now);
+            return;
+        }
+        while (m_cur <= now) {
+            int index = m_cur & ROOT_MASK;
+            if (index == 0) {
+                for (int level=0; level<LEVEL_NUMBER; ++level) {
+                    int slot = (m_cur >> (ROOT_BITS + level * LEVEL_BITS)) & LEVEL_MASK;
+                    if (cascade(level, slot) != 0) break;
+                }
+            }
+            timer_hook & head = m_root[index];
+            while (head.linked()) {
+                timer_hook * tmp = head.next;
+                tmp->unlink();
+                m_ready.insert_before(tmp);
+            }
+            ++m_cur;
+            if (m_ready.linked()) break;
+        }
+    }
+private:
+    long long m_cur;                                // 时间轮下一个要处理的时刻
+    size_t m_size;
+    timer_hook m_ready;                             // 已到期的定时器
+    timer_hook m_root[ROOT_SIZE];                   // 第一层
+    timer_hook m_levels[LEVEL_NUMBER][LEVEL_SIZE];  // 其余各层
+};
+
+/**
+ * @brief 通用定时器队列
+ * @tparam P 定时器携带的用户数据的类型
+ * @tparam Backend 底层数据结构
+*/
+template <typename P, template <typename> class Backend>
+class timer_queue {
+public:
+    typedef Backend<timer_entry<P> > backend_type;
+    typedef typename backend_type::node node;
+    typedef node * handle;     // 定时器句柄，用于取消和调整定时器
+    typedef void (*callback)(P &);
+
+    explicit timer_queue(long long now): m_free(nullptr), m_allocated(0) {
+        m_backend.start(now);
+    }
+
+    ~timer_queue() {
+        // 先析构仍在队列中的定时器，其用户数据可能持有资源
+        m_backend.clear([](node * timer) { timer->~node(); });
+        for (size_t i=0; i<m_chunks.size(); ++i) {
+            ::operator delete(m_chunks[i]);
+        }
+    }
+public:
+    /**
+     * @brief 添加一个定时器
+     * @param expire 超时时间（毫秒）
+     * @param user_data 用户数据
+     * @param cb_func 超时后调用的回调函数
+     * @return 定时器句柄
+    */
+    handle add(long long expire, const P & user_data, callback cb_func) {
+        node * timer = alloc_node();
+        timer->expire = expire;
+        timer->cb_func = cb_func;
+        timer->user_data = user_data;
+        m_backend.insert(timer);
+        return timer;
+    }
+
+    /**
+     * @brief 取消定时器，句柄随即失效
+    */
+    void cancel(handle timer) {
+        if (!timer) return;
+        m_backend.erase(timer);
+        free_node(timer);
+    }
+
+    /**
+     * @brief 将定时器的超时时间修改为 expire
+    */
+    void adjust(handle timer, long long expire) {
+        if (!timer || timer->expire == expire) return;
+        timer->expire = expire;
+        m_backend.update(timer);
+    }
+
+    /**
+     * @brief 执行超时时间不晚于 now 的定时器的回调函数。回调函数执行时定时器
+     * 已经从队列中移除，回调返回后其句柄失效。
+     * @param now 当前时间（毫秒）
+     * @param max_number 本次至多执行的定时器数量，负数表示不限制。未执行的到期
+     * 定时器仍留在队列中，下次调用时继续处理。
+     * @return 本次执行的定时器数量
+    */
+    int expire(long long now, int max_number = -1) {
+        int count = 0;
+        node * timer = nullptr;
+        while ((max_number < 0 || count < max_number) &&
+               (timer = m_backend.pop_expired(now)) != nullptr) {
+            if (timer->cb_func) {
+                timer->cb_func(timer->user_data);
+            }
+            free_node(timer);
+            ++count;
+        }
+        return count;
+    }
+
+    /**
+     * @brief 距离下一个定时器到期还有多少毫秒，队列为空时返回 -1
+    */
+    int next_timeout(long long now) const {
+        long long expire = m_backend.next_expire(now);
+        if (expire < 0) return -1;
+        return expire > now ? (int)(expire - now) : 0;
+    }
+
+    size_t size() const { return m_backend.size(); }
+
+    /**
+     * @brief 队列占用的内存（定时器结点池与后端数据结构）
+    */
+    size_t memory_bytes() const {
+        return sizeof(*this) - sizeof(m_backend) + m_backend.memory_bytes() +
+               m_allocated * sizeof(node) + m_chunks.capacity() * sizeof(void *);
+    }
+private:
+    // 定时器结点按块分配，释放的结点挂在空闲链表上供下次复用
+    node * alloc_node() {
+        if (!m_free) {
+            node * chunk = static_cast<node *>(::operator new(CHUNK_SIZE * sizeof(node)));
+            m_chunks.push_back(chunk);
+            m_allocated += CHUNK_SIZE;
+            for (int i=0; i<CHUNK_SIZE; ++i) {
+                free_node(chunk + i, false);
+            }
+        }
+        free_link * tmp = m_free;
+        m_free = tmp->next;
+        return new (tmp) node();
+    }
+
+    void free_node(node * timer, bool destroy=true) {
+        if (destroy) {
+            timer->~node();
+        }
+        free_link * tmp = reinterpret_cast<free_link *>(timer);
+        tmp->next = m_free;
+        m_free = tmp;
+    }
+private:
+    struct free_link { free_link * next; };
+    static const int CHUNK_SIZE = 1024;
+    backend_type m_backend;
+    free_link * m_free;             // 空闲结点链表
+    std::vector<void *> m_chunks;   // 已分配的结点块
+    size_t m_allocated;             // 已分配的结点总数
+};
+
+#endif
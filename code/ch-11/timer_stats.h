@@ -0,0 +1,54 @@
+/**
+ * @file timer_stats.h
+ * @author
+ * @date 2026-10-18
+ * @brief 定时器到期处理的统计信息
+*/
+#ifndef TIMER_STATS_H
+#define TIMER_STATS_H
+
+#include <cstdio>
+
+/**
+ * @brief 定时器容器在 tick 中处理到期定时器的统计信息。
+ *
+ * 到期的定时器先被收集到一个批次中，每次 tick 至多执行其中的若干个，其余的
+ * 留到下一次 tick。backlog 即留下来的数量，lateness 是定时器的回调被执行时
+ * 距离其超时时间已经过去的毫秒数。
+*/
+struct timer_stats {
+    timer_stats(): expired(0), total_expired(0), backlog(0), max_backlog(0),
+        max_lateness(0), total_lateness(0) {}
+
+    // 记录一个定时器的回调被执行
+    void record(long long lateness) {
+        if (lateness < 0) lateness = 0;
+        ++expired;
+        ++total_expired;
+        total_lateness += lateness;
+        if (lateness > max_lateness) max_lateness = lateness;
+    }
+
+    // 一次 tick 结束时记录剩余的积压数量
+    void finish_tick(int remain) {
+        backlog = remain;
+        if (remain > max_backlog) max_backlog = remain;
+    }
+
+    void dump(FILE * fp) const {
+        fprintf(fp, "expired %d (total %lld), backlog %d (max %d), "
+                "lateness avg %.1f ms max %lld ms\n", expired, total_expired,
+                backlog, max_backlog,
+                total_expired ? (double)total_lateness / total_expired : 0.0,
+                max_lateness);
+    }
+
+    int expired;                // 最近一次 tick 执行的定时器数量
+    long long total_expired;    // 累计执行的定时器数量
+    int backlog;                // 最近一次 tick 结束时尚未执行的到期定时器数量
+    int max_backlog;            // 积压数量的最大值
+    long long max_lateness;     // 回调执行时刻相对超时时间的最大延迟（毫秒）
+    long long total_lateness;   // 累计延迟，用于计算平均延迟
+};
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * @file broadcast_ring.h
+ * @author
+ * @date 2026-10-18
+ * @brief 放在共享内存中的多生产者广播环形缓冲区
+ *
+ * 任意进程都可以发布消息：先用 fetch_add 从 m_tail 取得消息的序号，再把消息写入
+ * 序号对应的槽位。每个读者在 m_cursors 中有自己的游标，按序号依次读取，读取不会
+ * 影响其他读者。写者从不等待读者：读者落后超过 SLOT_NUMBER 条消息时，旧消息被
+ * 覆盖，读者跳到仍然有效的最旧消息处，并得知丢失了多少条。
+ *
+ * 每个槽位的 m_seq 相当于一个顺序锁：写入序号为 seq 的消息之前置为 2*seq+1，
+ * 写完之后置为 2*seq+2。读者在复制消息前后各读一次 m_seq，两次相同且等于期望值，
+ * 才说明读到的消息是完整的。
+ *
+ * 每条消息带有房间名，所有房间共用一个环形缓冲区，由读者按房间名筛选。
+ *
+ * 写者先提交的消息不一定序号小。读者遇到还没有提交的序号时停下，等该消息提交后
+ * 再继续，因此每个读者看到的消息顺序都相同。如果写者在写入过程中被杀死，读者会
+ * 在这个槽位停留，直到它被 SLOT_NUMBER 条之后的消息覆盖。
+*/
+#ifndef BROADCAST_RING_H
+#define BROADCAST_RING_H
+
+#include <stdint.h>
+#include <atomic>
+#include <cstring>
+
+class broadcast_ring {
+public:
+    // 槽位数量，必须是 2 的幂
+    static const int SLOT_NUMBER = 256;
+    // 一条消息的最大长度
+    static const int SLOT_SIZE = 1024;
+    // 读者的最大数量
+    static const int MAX_READERS = 64;
+    // 房间名的最大长度（含结尾的 '\0'）
+    static const int ROOM_NAME_SIZE = 32;
+
+    // read 的返回值
+    enum READ_STATUS {
+        READ_OK = 0,    // 读到一条消息
+        READ_EMPTY,     // 没有新消息
+        READ_LAPPED     // 读者落后太多，部分消息已被覆盖
+    };
+public:
+    /**
+     * @brief 初始化。由创建共享内存的进程在其他进程使用之前调用一次
+    */
+    void init() {
+        m_tail.store(0);
+        for (int i=0; i<SLOT_NUMBER; ++i) {
+            m_slots[i].m_seq.store(0);
+        }
+        for (int i=0; i<MAX_READERS; ++i) {
+            m_cursors[i].store(0);
+        }
+    }
+
+    /**
+     * @brief 发布一条消息
+     * @param sender 发送者的编号，原样交给读者
+     * @param room 房间名，超过 ROOM_NAME_SIZE - 1 的部分被截断
+     * @param data 消息内容
+     * @param len 消息长度，超过 SLOT_SIZE 的部分被截断
+     * @return 消息的序号
+    */
+    uint64_t publish(int sender, const char * room, const char * data, int len) {
+        if (len > SLOT_SIZE) {
+            len = SLOT_SIZE;
+        }
+        uint64_t seq = m_tail.fetch_add(1, std::memory_order_acq_rel);
+        slot & s = m_slots[seq & (SLOT_NUMBER - 1)];
+        s.m_seq.store(2 * seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.m_sender = sender;
+        strncpy(s.m_room, room, ROOM_NAME_SIZE - 1);
+        s.m_room[ROOM_NAME_SIZE - 1] = '\0';
+        s.m_len = len;
+        memcpy(s.m_data, data, len);
+        s.m_seq.store(2 * seq + 2, std::memory_order_release);
+        return seq;
+    }
+
+    /**
+     * @brief 登记一个读者，它将从下一条发布的消息开始读取
+     * @param reader 读者编号，小于 MAX_READERS
+    */
+    void attach(int reader) {
+        m_cursors[reader].store(m_tail.load(std::memory_order_acquire),
+                                std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 读取读者的下一条消息
+     * @param reader 读者编号
+     * @param sender 保存发送者编号
+     * @param room 保存房间名，长度至少为 ROOM_NAME_SIZE
+     * @param buf 保存消息内容，长度至少为 SLOT_SIZE
+     * @param len 保存消息长度
+     * @param lost 返回 READ_LAPPED 时保存丢失的消息数量
+     * @return READ_STATUS
+    */
+    int read(int reader, int & sender, char * room, char * buf, int & len,
+             uint64_t & lost) {
+        uint64_t cursor = m_cursors[reader].load(std::memory_order_relaxed);
+        slot & s = m_slots[cursor & (SLOT_NUMBER - 1)];
+        uint64_t expected = 2 * cursor + 2;
+        uint64_t before = s.m_seq.load(std::memory_order_acquire);
+        if (before < expected) {
+            return READ_EMPTY;
+        }
+        if (before == expected) {
+            sender = s.m_sender;
+            memcpy(room, s.m_room, ROOM_NAME_SIZE);
+            room[ROOM_NAME_SIZE - 1] = '\0';
+            len = s.m_len;
+            if (len < 0 || len > SLOT_SIZE) {
+                len = 0;
+            }
+            memcpy(buf, s.m_data, len);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.m_seq.load(std::memory_order_relaxed) == before) {
+                m_cursors[reader].store(cursor + 1, std::memory_order_relaxed);
+                return READ_OK;
+            }
+        }
+        // 槽位已经被更新的消息覆盖，跳到仍然有效的最旧消息
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        uint64_t oldest = tail > (uint64_t)SLOT_NUMBER ? tail - SLOT_NUMBER + 1 : 0;
+        if (oldest <= cursor) {
+            oldest = cursor + 1;
+        }
+        lost = oldest - cursor;
+        m_cursors[reader].store(oldest, std::memory_order_relaxed);
+        return READ_LAPPED;
+    }
+
+    /**
+     * @brief 读者落后的消息数量
+    */
+    uint64_t lag(int reader) const {
+        return m_tail.load(std::memory_order_relaxed)
+               - m_cursors[reader].load(std::memory_order_relaxed);
+    }
+private:
+    struct slot {
+        std::atomic<uint64_t> m_seq;    // 顺序锁，见文件开头的说明
+        int32_t m_sender;
+        int32_t m_len;
+        char m_room[ROOM_NAME_SIZE];
+        char m_data[SLOT_SIZE];
+    };
+    alignas(64) std::atomic<uint64_t> m_tail;            // 下一条消息的序号
+    alignas(64) std::atomic<uint64_t> m_cursors[MAX_READERS];  // 每个读者下一条要读的序号
+    alignas(64) slot m_slots[SLOT_NUMBER];
+};
+
+#endif
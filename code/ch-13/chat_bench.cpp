@@ -0,0 +1,237 @@
+/**
+ * @file chat_bench.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief chatroom_server 的广播延迟测试客户端
+ *
+ * 建立 members 个客户连接，其中第一个连接作为发送者，逐条发送带有时间戳的消息：
+ * 发出一条之后，等其余所有连接都收到它（或者超时）再发下一条。统计两个延迟：
+ * 每个客户收到消息的延迟，以及最后一个客户收到消息的延迟（广播延迟）。改变
+ * members 多次运行，即可得到延迟随聊天室人数的变化：
+ *
+ *     chatroom_server -w 4 127.0.0.1 12345
+ *     for n in 10 100 1000 10000; do chat_bench -n $n 127.0.0.1 12345; done
+*/
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../ch-16/latency_histogram.h"
+
+// 测试消息。服务器原样转发字节流，收到的数据按 sizeof(record) 切分
+struct record {
+    int64_t m_seq;      // 消息序号，0 表示预热消息
+    int64_t m_send_us;  // 发送时间
+};
+
+struct member {
+    int m_fd;
+    char m_buf[sizeof(record)]; // 不完整的消息
+    int m_len;
+    int64_t m_last_seq;         // 收到的最大消息序号
+};
+
+static int64_t now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int connect_to(const sockaddr_in & address) {
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+    if (connect(sockfd, (sockaddr *)&address, sizeof(address)) < 0) {
+        close(sockfd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    return sockfd;
+}
+
+/**
+ * @brief 读取一个客户收到的所有数据
+ * @param seq 正在测量的消息序号
+ * @param send_us 这条消息的发送时间
+ * @param latency 记录收到消息的延迟
+ * @return 是否收到了序号为 seq 的消息，连接出错时返回 false 并把 m_fd 置为 -1
+*/
+static bool read_member(member & m, int64_t seq, int64_t send_us,
+                        latency_histogram & latency) {
+    char buf[4096];
+    bool got = false;
+    while (true) {
+        int ret = recv(m.m_fd, buf, sizeof(buf), 0);
+        if (ret <= 0) {
+            if (ret == 0 || errno != EAGAIN) {
+                close(m.m_fd);
+                m.m_fd = -1;
+            }
+            break;
+        }
+        int64_t now = now_us();
+        for (int i=0; i<ret; ++i) {
+            m.m_buf[m.m_len++] = buf[i];
+            if (m.m_len < (int)sizeof(record)) {
+                continue;
+            }
+            m.m_len = 0;
+            record r;
+            memcpy(&r, m.m_buf, sizeof(r));
+            if (r.m_seq > m.m_last_seq) {
+                m.m_last_seq = r.m_seq;
+            }
+            if (r.m_seq == seq && seq > 0) {
+                latency.record(now - send_us);
+                got = true;
+            }
+        }
+    }
+    return got;
+}
+
+int main(int argc, char * argv[]) {
+    const char * name = basename(argv[0]);
+    int member_number = 10;
+    int message_number = 1000;
+    int timeout_ms = 1000;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:t:")) != -1) {
+        switch (opt) {
+            case 'n': member_number = atoi(optarg); break;
+            case 'm': message_number = atoi(optarg); break;
+            case 't': timeout_ms = atoi(optarg); break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || argc - optind < 2 || member_number < 2
+        || message_number <= 0 || timeout_ms <= 0) {
+        printf("usage: %s [-n members] [-m messages] [-t timeout_ms] "
+               "ip_address port_number\n", name);
+        return 1;
+    }
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[optind], &address.sin_addr);
+    address.sin_port = htons(atoi(argv[optind + 1]));
+
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int sender = connect_to(address);
+    if (sender < 0) {
+        printf("connect failed: %s\n", strerror(errno));
+        return 1;
+    }
+    int epollfd = epoll_create(5);
+    std::vector<member> members(member_number - 1);
+    for (size_t i=0; i<members.size(); ++i) {
+        members[i].m_fd = connect_to(address);
+        if (members[i].m_fd < 0) {
+            printf("connect failed after %d members: %s\n", (int)i + 1, strerror(errno));
+            return 1;
+        }
+        members[i].m_len = 0;
+        members[i].m_last_seq = -1;
+        epoll_event event;
+        event.data.u32 = i;
+        event.events = EPOLLIN;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, members[i].m_fd, &event);
+    }
+
+    std::vector<epoll_event> events(members.size());
+    latency_histogram delivery;     // 每个客户收到消息的延迟
+    latency_histogram fanout;       // 最后一个客户收到消息的延迟
+
+    // 预热：服务器异步接受连接，反复发送序号为 0 的消息，直到所有客户都收到过
+    int64_t deadline = now_us() + 10 * 1000000LL;
+    int ready = 0;
+    while (ready < (int)members.size() && now_us() < deadline) {
+        record r = {0, now_us()};
+        if (send(sender, &r, sizeof(r), MSG_NOSIGNAL) != sizeof(r)) {
+            printf("send failed: %s\n", strerror(errno));
+            return 1;
+        }
+        int number = epoll_wait(epollfd, events.data(), events.size(), 100);
+        for (int i=0; i<number; ++i) {
+            member & m = members[events[i].data.u32];
+            bool was_ready = m.m_last_seq >= 0;
+            read_member(m, -1, 0, delivery);
+            if (!was_ready && m.m_last_seq >= 0) {
+                ++ready;
+            }
+        }
+    }
+    if (ready < (int)members.size()) {
+        printf("only %d of %d members joined the room\n", ready, (int)members.size());
+        return 1;
+    }
+
+    long long lost = 0;
+    for (int seq=1; seq<=message_number; ++seq) {
+        record r = {seq, now_us()};
+        if (send(sender, &r, sizeof(r), MSG_NOSIGNAL) != sizeof(r)) {
+            printf("send failed: %s\n", strerror(errno));
+            return 1;
+        }
+        int pending = members.size();
+        int64_t last = r.m_send_us;
+        deadline = r.m_send_us + timeout_ms * 1000LL;
+        while (pending > 0) {
+            int wait_ms = (deadline - now_us()) / 1000;
+            if (wait_ms <= 0) {
+                break;
+            }
+            int number = epoll_wait(epollfd, events.data(), events.size(), wait_ms);
+            for (int i=0; i<number; ++i) {
+                member & m = members[events[i].data.u32];
+                if (m.m_fd >= 0 && read_member(m, seq, r.m_send_us, delivery)) {
+                    --pending;
+                    last = now_us();
+                }
+            }
+        }
+        lost += pending;
+        if (pending == 0) {
+            fanout.record(last - r.m_send_us);
+        }
+    }
+
+    printf("%d members, %d messages, %lld deliveries lost\n",
+           member_number, message_number, lost);
+    printf("delivery latency (us): min %lld mean %.0f p50 %lld p90 %lld p99 %lld max %lld\n",
+           delivery.min(), delivery.mean(), delivery.percentile(50),
+           delivery.percentile(90), delivery.percentile(99), delivery.max());
+    printf("fan-out latency (us):  min %lld mean %.0f p50 %lld p90 %lld p99 %lld max %lld\n",
+           fanout.min(), fanout.mean(), fanout.percentile(50),
+           fanout.percentile(90), fanout.percentile(99), fanout.max());
+
+    close(sender);
+    for (size_t i=0; i<members.size(); ++i) {
+        if (members[i].m_fd >= 0) {
+            close(members[i].m_fd);
+        }
+    }
+    close(epollfd);
+    return 0;
+}
@@ -3,6 +3,22 @@
  * @author
  * @date 2024-03-14
  * @brief 使用共享内存的聊天室服务器程序
+ *
+ * 默认为每个客户连接 fork 一个子进程，最多 USER_LIMIT 个客户。用 -w 指定工作进程
+ * 数量时改为事件驱动模式：固定数量的工作进程共享监听 socket，每个工作进程用 epoll
+ * 同时服务大量客户，客户数只受文件描述符数量的限制。两种模式下消息都经过共享内存
+ * 中的广播环形缓冲区，在事件驱动模式下每个工作进程是一个读者。
+ *
+ *     chatroom_server 127.0.0.1 12345          # 每个客户一个进程
+ *     chatroom_server -w 4 127.0.0.1 12345     # 4 个工作进程
+ *
+ * 每个客户有一个有界的发送队列，暂时发不出去的消息留在队列中，socket 可写时再发送。
+ * 事件驱动模式下一批消息在工作进程中只保存一份，由同一房间所有客户的队列共享。
+ * -q 和 -p 选项指定队列容量和溢出策略，见 room.h。
+ *
+ * 客户发送 "/join 房间名" 切换房间（默认在 lobby 房间），发送 "/stats" 查看自己所在
+ * 的房间和发送队列的深度、峰值和丢弃的消息数量，其他数据广播给同一房间的其他客户。
+ * 房间名随消息一起写入广播环形缓冲区，由各个读者筛选。
 */
 #include <sys/socket.h> // socket, setsockopt, connect, send
 #include <netinet/in.h> // sockaddr_in, htons
@@ -11,6 +27,9 @@
 #include <signal.h> // sigaction, sigfillset
 #include <sys/mman.h>  // shm_unlink
 #include <sys/wait.h>  // waitpid
+#include <sys/eventfd.h>   // eventfd
+#include <sys/resource.h>  // setrlimit
+#include <sys/uio.h>   // writev
 #include <fcntl.h>  // fcntl
 #include <unistd.h> // close, ftruncate
 #include <cstring>  // basename, bzero
@@ -18,19 +37,35 @@
 #include <cstdlib>  // atoi
 #include <cassert>  // assert
 #include <cerrno>   // errno
+#include <ctime>    // clock_gettime
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "broadcast_ring.h"
+#include "../ch-09/chat_room/room.h"
 
 #define USER_LIMIT 5
 #define BUFFER_SIZE 1024
 #define FD_LIMIT 65535
 #define MAX_EVENT_NUMBER 1024
-#define PROCESS_LIMIT 4194304
+#define IOV_LIMIT 16    // 一次 writev 最多发送的消息数量
+#define DEFAULT_ROOM "lobby"    // 客户连接后所在的房间
+// 工作进程崩溃后重新创建之前的最短和最长等待时间（毫秒）
+#define RESPAWN_MIN_BACKOFF 100
+#define RESPAWN_MAX_BACKOFF 10000
+// 工作进程运行超过这个时间（毫秒）后退出，不再视为连续崩溃，等待时间恢复为最短
+#define STABLE_UPTIME 5000
+
+static_assert(USER_LIMIT <= broadcast_ring::MAX_READERS, "too many users for the ring");
 
 // 处理一个客户连接必要的数据
 struct client_data {
     sockaddr_in address;    // 客户端的 socket 地址
     int connfd;             // socket 文件描述符
     pid_t pid;              // 处理这个连接的子进程的pid
-    int pipefd[2];          // 和父进程通信用的管道
+    int pipefd[2];          // 和父进程通信用的管道，子进程读到 EOF 说明父进程已退出
+    int reader;             // 子进程在广播环形缓冲区中的读者编号
 };
 
 static const char * shm_name = "/my_shm";
@@ -38,15 +73,24 @@ int sig_pipefd[2];
 int epollfd;
 int listenfd;
 int shmfd;
-char * share_mem = nullptr;
+// 共享内存中的广播环形缓冲区，所有客户发来的消息都发布到这里
+broadcast_ring * ring = nullptr;
+// 有新消息时写这个 eventfd。它从不被读取，计数始终大于 0，每个子进程以 EPOLLET
+// 方式监听它，每次写入都会唤醒所有子进程。
+int ring_eventfd;
+// 读者编号是否已被使用
+bool reader_used[broadcast_ring::MAX_READERS];
 // 客户连接数组。进程用客户连接的编号来索引这个数组，即可获得相关的客户连接数据。
 client_data * users = nullptr;
-// 子进程和客户连接的映射关系表。用进程的pid来索引这个数组，即可获得该进程所处理的
-// 客户连接的编号。
-int * sub_process = nullptr;
+// 子进程和客户连接（事件驱动模式下是工作进程）的映射关系表。用进程的pid来查询，
+// 即可获得该进程所处理的客户连接的编号。
+std::unordered_map<pid_t, int> sub_process;
 // 当前客户数量
 int user_count = 0;
 bool stop_child = false;
+// 客户发送队列的容量和溢出策略
+int queue_capacity = 64;
+OVERFLOW_POLICY overflow_policy = DISCONNECT;
 
 int set_nonblocking(int fd) {
     int old_option = fcntl(fd, F_GETFL);
@@ -63,6 +107,12 @@ void add_fd(int epollfd, int fd) {
     set_nonblocking(fd);
 }
 
+long long current_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 void sig_handler(int sig) {
     int save_errno = errno;
     int msg = sig;
@@ -86,35 +136,121 @@ void del_resourse() {
     close(sig_pipefd[1]);
     close(listenfd);
     close(epollfd);
+    close(ring_eventfd);
     shm_unlink(shm_name);
     delete [] users;
-    delete [] sub_process;
 }
 
 void child_term_handler(int sig) {
     stop_child = true;
 }
 
+/* 一次 writev 尽量多发送几条消息，直到发送完或者 socket 不可写
+return: 是否出错
+*/
+bool flush_queue(int fd, subscriber_queue & queue) {
+    iovec iov[IOV_LIMIT];
+    while (!queue.empty()) {
+        int count = queue.fill_iov(iov, IOV_LIMIT);
+        int ret = writev(fd, iov, count);
+        if (ret < 0) {
+            return errno == EAGAIN;
+        }
+        queue.consume(ret);
+    }
+    return true;
+}
+
+// 客户发来的命令
+enum COMMAND {
+    CMD_NONE = 0,   // 不是命令，照常广播
+    CMD_JOIN,       // "/join 房间名"
+    CMD_STATS       // "/stats"
+};
+
+/* 识别客户发来的命令。数据按字节流转发，没有消息边界，只有一次 recv 读到的数据
+恰好是一条命令（可以带换行符）时才当作命令
+room: 保存 /join 的房间名，超出 ROOM_NAME_SIZE - 1 的部分被截断
+return: COMMAND
+*/
+int parse_command(const char * data, int len, std::string & room) {
+    while (len > 0 && (data[len-1] == '\n' || data[len-1] == '\r')) {
+        --len;
+    }
+    if (len == 6 && memcmp(data, "/stats", 6) == 0) {
+        return CMD_STATS;
+    }
+    if (len > 6 && memcmp(data, "/join ", 6) == 0 && !memchr(data + 6, '\0', len - 6)
+        && !memchr(data + 6, '\n', len - 6)) {
+        room.assign(data + 6, std::min(len - 6, broadcast_ring::ROOM_NAME_SIZE - 1));
+        return CMD_JOIN;
+    }
+    return CMD_NONE;
+}
+
+// 生成 /stats 的回复
+std::string format_stats(const std::string & room, const subscriber_queue & queue) {
+    char info[256];
+    snprintf(info, sizeof(info), "room %s; queue depth %d, peak %d, dropped %lld\n",
+             room.c_str(), queue.depth(), queue.peak(), queue.dropped());
+    return info;
+}
+
+// 客户断开时，如果它的发送队列丢弃过消息，输出队列的峰值和丢弃数量
+void report_queue(const char * who, const subscriber_queue & queue) {
+    if (queue.dropped() > 0) {
+        printf("%s closed: queue peak %d, dropped %lld\n", who, queue.peak(),
+               queue.dropped());
+    }
+}
+
+/* 把服务器生成的文本放入发送队列，队列原来为空时马上发送
+return: 是否出错
+*/
+bool queue_reply(int fd, subscriber_queue & queue, const std::string & text) {
+    chat_message * msg = chat_message::create(-1, text.data(), text.size());
+    bool idle = queue.empty();
+    bool ok = queue.push(msg) && (!idle || flush_queue(fd, queue));
+    msg->unref();
+    return ok;
+}
+
 /* 子进程运行函数
 idx: 该子进程处理的客户连接编号
 users: 保存所有客户连接数据的数组
-share_mem: 共享内存的起始地址
+ring: 共享内存中的广播环形缓冲区
 */
-int run_child(int idx, client_data *users, char *share_mem) {
+int run_child(int idx, client_data *users, broadcast_ring *ring) {
     epoll_event events[MAX_EVENT_NUMBER];
     int child_epollfd = epoll_create(5);
     assert(child_epollfd != -1);
     
-    // 子进程使用I/O复用技术来同时监听两个文件描述符：
+    // 子进程使用I/O复用技术来同时监听三个文件描述符：
     //   （1）客户连接 socket
     //   （2）与父进程通信的管道文件描述符
+    //   （3）广播环形缓冲区的 eventfd
     int connfd = users[idx].connfd;
-    add_fd(child_epollfd, connfd);
+    // 一开始就关注 EPOLLOUT，发送队列中积压的消息在 socket 重新变为可写时发送
+    epoll_event event;
+    event.data.fd = connfd;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    epoll_ctl(child_epollfd, EPOLL_CTL_ADD, connfd, &event);
+    set_nonblocking(connfd);
     int pipefd = users[idx].pipefd[1];
     add_fd(child_epollfd, pipefd);
+    add_fd(child_epollfd, ring_eventfd);
+    int reader = users[idx].reader;
 
     add_sig(SIGTERM, child_term_handler, false);
 
+    // 暂时发不出去的消息留在发送队列中，与事件驱动模式相同
+    subscriber_queue queue;
+    queue.set_policy(queue_capacity, overflow_policy);
+    std::string room = DEFAULT_ROOM;
+    std::string arg;
+    std::string batch;
+    char buf[BUFFER_SIZE];
+    char msg_room[broadcast_ring::ROOM_NAME_SIZE];
     int ret;
     while (!stop_child) {
         int number = epoll_wait(child_epollfd, events, MAX_EVENT_NUMBER, -1);
@@ -125,35 +261,83 @@ int run_child(int idx, client_data *users, char *share_mem) {
 
         for (int i=0; i<number; ++i) {
             int sockfd = events[i].data.fd;
-            // 本子进程负责的客户连接有数据到达
-            if ((sockfd == connfd) && (events[i].events & EPOLLIN)) {
-                memset(share_mem+idx*BUFFER_SIZE, '\0', BUFFER_SIZE);
-                ret = recv(connfd, share_mem+idx*BUFFER_SIZE, BUFFER_SIZE-1, 0);
-                if (ret < 0) {
-                    if (errno != EAGAIN) {
-                        stop_child = true;
+            if (sockfd == connfd) {
+                // 本子进程负责的客户连接有数据到达。ET 模式下要读到 EAGAIN 为止
+                if (events[i].events & EPOLLIN) {
+                    bool published = false;
+                    while (true) {
+                        ret = recv(connfd, buf, BUFFER_SIZE, 0);
+                        if (ret < 0) {
+                            if (errno != EAGAIN) {
+                                stop_child = true;
+                            }
+                            break;
+                        } else if (ret == 0) {
+                            stop_child = true;
+                            break;
+                        }
+                        int cmd = parse_command(buf, ret, arg);
+                        if (cmd != CMD_NONE) {
+                            if (cmd == CMD_JOIN) {
+                                room = arg;
+                            }
+                            std::string info = cmd == CMD_JOIN ? "joined " + room + "\n"
+                                                               : format_stats(room, queue);
+                            if (!queue_reply(connfd, queue, info)) {
+                                stop_child = true;
+                                break;
+                            }
+                            continue;
+                        }
+                        // 把客户数据发布到广播环形缓冲区，其他子进程自己读取，不经过父进程
+                        ring->publish(reader, room.c_str(), buf, ret);
+                        published = true;
                     }
-                } else if (ret == 0) {
+                    if (published) {
+                        uint64_t one = 1;
+                        ret = write(ring_eventfd, &one, sizeof(one));
+                    }
+                }
+                // socket 重新变为可写，发送队列中积压的消息
+                if ((events[i].events & EPOLLOUT) && !flush_queue(connfd, queue)) {
                     stop_child = true;
-                } else {
-                    // 成功读取客户数据后就通知主进程（通过管道）来处理
-                    send(pipefd, (char *)&idx, sizeof(idx), 0);
                 }
             }
-            // 主进程通知本进程（通过管道）将第client个客户的数据发送到本进程负责的
-            // 客户端
-            else if ((sockfd == pipefd) && (events[i].events & EPOLLIN)) {
-                int client = 0;
-                // 接收主进程发来的数据，即有客户数据到达的连接编号
-                ret = recv(pipefd, (char *)&client, sizeof(client), 0);
-                if (ret < 0) {
-                    if (errno != EAGAIN) {
+            // 广播环形缓冲区中有新消息，把其他客户的消息发送到本进程负责的客户端
+            else if ((sockfd == ring_eventfd) && (events[i].events & EPOLLIN)) {
+                int sender, len;
+                uint64_t lost;
+                batch.clear();
+                while (true) {
+                    ret = ring->read(reader, sender, msg_room, buf, len, lost);
+                    if (ret == broadcast_ring::READ_EMPTY) {
+                        break;
+                    } else if (ret == broadcast_ring::READ_LAPPED) {
+                        printf("client %d lost %llu messages\n", idx,
+                               (unsigned long long)lost);
+                    } else if (sender != reader && room == msg_room) {
+                        // 只发送同一房间其他客户的消息，只发送消息的实际长度
+                        batch.append(buf, len);
+                    }
+                }
+                if (!batch.empty()) {
+                    // 这一批消息合并成一条放入队列，队列原来不空说明正在等待 EPOLLOUT
+                    chat_message * msg = chat_message::create(-1, batch.data(), batch.size());
+                    bool idle = queue.empty();
+                    if (!queue.push(msg)) {
+                        printf("client %d send queue full, disconnect\n", idx);
+                        stop_child = true;
+                    } else if (idle && !flush_queue(connfd, queue)) {
                         stop_child = true;
                     }
-                } else if (ret == 0) {
+                    msg->unref();
+                }
+            }
+            // 父进程退出
+            else if ((sockfd == pipefd) && (events[i].events & EPOLLIN)) {
+                ret = recv(pipefd, buf, sizeof(buf), 0);
+                if (ret == 0 || (ret < 0 && errno != EAGAIN)) {
                     stop_child = true;
-                } else {
-                    send(connfd, share_mem+client*BUFFER_SIZE, BUFFER_SIZE, 0);
                 }
             } else {
                 // others
@@ -162,19 +346,533 @@ int run_child(int idx, client_data *users, char *share_mem) {
         }
     }
 
+    char who[32];
+    snprintf(who, sizeof(who), "client %d", idx);
+    report_queue(who, queue);
     close(connfd);
     close(pipefd);
     close(child_epollfd);
     return 0;
 }
 
+/**
+ * @brief 事件驱动模式的工作进程，用一个 epoll 服务多个客户
+ *
+ * 客户发来的数据发布到广播环形缓冲区，发送者编号由工作进程编号和客户的连接序号
+ * 组成。工作进程读取环形缓冲区时把一批消息按房间合并，每个房间一个 chat_message，
+ * 放入本进程中该房间每个客户的发送队列，暂时发不出去的消息留在队列中，等 EPOLLOUT
+ * 时再发送。
+*/
+class chat_worker {
+public:
+    chat_worker(int idx, int listen_fd, int pipefd)
+        : m_idx(idx), m_listenfd(listen_fd), m_pipefd(pipefd), m_epollfd(-1), m_next_id(0) {
+        rlimit limit;
+        getrlimit(RLIMIT_NOFILE, &limit);
+        m_max_clients = (int)limit.rlim_cur - 16;
+    }
+    ~chat_worker() {
+        for (size_t i=0; i<m_clients.size(); ++i) {
+            delete m_clients[i];
+        }
+    }
+
+    int run() {
+        m_epollfd = epoll_create(5);
+        assert(m_epollfd != -1);
+        // 所有工作进程共享监听 socket，EPOLLEXCLUSIVE 让一个新连接只唤醒一个工作进程
+        epoll_event event;
+        event.data.fd = m_listenfd;
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+        add_fd(m_epollfd, m_pipefd);
+        add_fd(m_epollfd, ring_eventfd);
+        ring->attach(m_idx);
+
+        add_sig(SIGTERM, child_term_handler, false);
+
+        epoll_event events[MAX_EVENT_NUMBER];
+        while (!stop_child) {
+            int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+            if ((number < 0) && (errno != EINTR)) {
+                printf("epoll failure\n");
+                break;
+            }
+            for (int i=0; i<number; ++i) {
+                int sockfd = events[i].data.fd;
+                if (sockfd == m_listenfd) {
+                    accept_clients();
+                } else if (sockfd == ring_eventfd) {
+                    broadcast();
+                } else if (sockfd == m_pipefd) {
+                    // 父进程退出
+                    char buf[64];
+                    int ret = recv(m_pipefd, buf, sizeof(buf), 0);
+                    if (ret == 0 || (ret < 0 && errno != EAGAIN)) {
+                        stop_child = true;
+                    }
+                } else {
+                    if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                        close_client(sockfd);
+                        continue;
+                    }
+                    if (events[i].events & EPOLLIN) {
+                        read_client(sockfd);
+                    }
+                    if ((events[i].events & EPOLLOUT) && is_member(sockfd)
+                        && !flush(sockfd)) {
+                        close_client(sockfd);
+                    }
+                }
+            }
+            close_pending();
+        }
+
+        while (!m_members.empty()) {
+            close_client(m_members.back());
+        }
+        close(m_epollfd);
+        return 0;
+    }
+private:
+    struct chat_client {
+        int m_pos;                  // 在 m_members 中的下标，-1 表示这个 socket 不是客户连接
+        int m_sender;               // 发送者编号，见 sender_of
+        chat_room * m_room;         // 所在的房间
+        subscriber_queue m_queue;   // 还没有发送出去的消息
+    };
+
+    // 消息的发送者编号。不能用 socket：客户断开后 socket 马上会被新的客户使用，而环形
+    // 缓冲区中可能还有旧客户的消息。连接序号取低 24 位，工作进程编号小于 MAX_READERS
+    int sender_of(int fd) const {
+        return m_clients[fd]->m_sender;
+    }
+
+    bool is_member(int fd) const {
+        return fd < (int)m_clients.size() && m_clients[fd] && m_clients[fd]->m_pos >= 0;
+    }
+
+    void accept_clients() {
+        while (true) {
+            sockaddr_in client_address;
+            socklen_t client_addr_len = sizeof(client_address);
+            int connfd = accept(m_listenfd, (sockaddr *)&client_address,
+                                &client_addr_len);
+            if (connfd < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    printf("errno is: %d\n", errno);
+                }
+                break;
+            }
+            if ((int)m_members.size() >= m_max_clients) {
+                const char * info = "too many users\n";
+                send(connfd, info, strlen(info), 0);
+                close(connfd);
+                continue;
+            }
+            if (connfd >= (int)m_clients.size()) {
+                m_clients.resize(connfd + 1, nullptr);
+            }
+            // 客户关闭后对象保留下来，给使用同一个 socket 的下一个客户使用
+            if (!m_clients[connfd]) {
+                m_clients[connfd] = new chat_client;
+            }
+            m_clients[connfd]->m_pos = m_members.size();
+            m_clients[connfd]->m_sender = (m_idx << 24) | (m_next_id++ & 0xffffff);
+            m_clients[connfd]->m_queue.set_policy(queue_capacity, overflow_policy);
+            m_clients[connfd]->m_room = m_rooms.join(DEFAULT_ROOM, connfd);
+            m_members.push_back(connfd);
+
+            epoll_event event;
+            event.data.fd = connfd;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            epoll_ctl(m_epollfd, EPOLL_CTL_ADD, connfd, &event);
+            set_nonblocking(connfd);
+        }
+    }
+
+    // 读取客户数据并发布到广播环形缓冲区。ET 模式下要读到 EAGAIN 为止
+    void read_client(int fd) {
+        if (!is_member(fd)) {
+            return;
+        }
+        char buf[BUFFER_SIZE];
+        bool published = false;
+        while (true) {
+            int ret = recv(fd, buf, BUFFER_SIZE, 0);
+            if (ret < 0) {
+                if (errno != EAGAIN) {
+                    m_closing.push_back(fd);
+                }
+                break;
+            } else if (ret == 0) {
+                m_closing.push_back(fd);
+                break;
+            }
+            chat_client * client = m_clients[fd];
+            int cmd = parse_command(buf, ret, m_arg);
+            if (cmd != CMD_NONE) {
+                if (cmd == CMD_JOIN) {
+                    m_rooms.leave(client->m_room, fd);
+                    client->m_room = m_rooms.join(m_arg, fd);
+                }
+                std::string info = cmd == CMD_JOIN ? "joined " + m_arg + "\n"
+                                   : format_stats(client->m_room->name(), client->m_queue);
+                if (!queue_reply(fd, client->m_queue, info)) {
+                    m_closing.push_back(fd);
+                    break;
+                }
+                continue;
+            }
+            ring->publish(sender_of(fd), client->m_room->name().c_str(), buf, ret);
+            published = true;
+        }
+        if (published) {
+            uint64_t one = 1;
+            int ret = write(ring_eventfd, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+
+    // 读出环形缓冲区中的所有新消息，发送给本进程中同一房间的客户
+    void broadcast() {
+        char buf[BUFFER_SIZE];
+        char room[broadcast_ring::ROOM_NAME_SIZE];
+        while (true) {
+            // 一批最多合并 MAX_BATCH 条消息
+            m_batch.clear();
+            m_batch_senders.clear();
+            m_batch_rooms.clear();
+            int sender, len, ret = broadcast_ring::READ_OK;
+            uint64_t lost;
+            for (int n=0; n<MAX_BATCH; ++n) {
+                ret = ring->read(m_idx, sender, room, buf, len, lost);
+                if (ret == broadcast_ring::READ_EMPTY) {
+                    break;
+                } else if (ret == broadcast_ring::READ_LAPPED) {
+                    printf("worker %d lost %llu messages\n", m_idx,
+                           (unsigned long long)lost);
+                    continue;
+                }
+                int r = std::find(m_batch_rooms.begin(), m_batch_rooms.end(), room)
+                        - m_batch_rooms.begin();
+                if (r == (int)m_batch_rooms.size()) {
+                    m_batch_rooms.push_back(room);
+                }
+                m_batch_senders.push_back(message{sender, (int)m_batch.size(), len, r});
+                m_batch.append(buf, len);
+            }
+            for (int r=0; r<(int)m_batch_rooms.size(); ++r) {
+                chat_room * target = m_rooms.find(m_batch_rooms[r]);
+                if (!target) {
+                    continue;
+                }
+                // 这批消息只属于一个房间时直接使用 m_batch
+                const std::string * content = &m_batch;
+                if (m_batch_rooms.size() > 1) {
+                    m_room_batch.clear();
+                    for (size_t i=0; i<m_batch_senders.size(); ++i) {
+                        const message & m = m_batch_senders[i];
+                        if (m.m_room == r) {
+                            m_room_batch.append(m_batch, m.m_offset, m.m_len);
+                        }
+                    }
+                    content = &m_room_batch;
+                }
+                if (content->empty()) {
+                    continue;
+                }
+                chat_message * batch = chat_message::create(-1, content->data(),
+                                                            content->size());
+                const std::vector<int> & members = target->members();
+                for (size_t i=0; i<members.size(); ++i) {
+                    deliver(members[i], batch, r);
+                }
+                batch->unref();
+            }
+            if (ret == broadcast_ring::READ_EMPTY) {
+                break;
+            }
+        }
+    }
+
+    // 把当前这批消息中第 room 个房间的部分放入客户 fd 的发送队列，跳过它自己发送的消息
+    void deliver(int fd, chat_message * batch, int room) {
+        int self = sender_of(fd);
+        bool own = false;
+        for (size_t i=0; i<m_batch_senders.size(); ++i) {
+            if (m_batch_senders[i].m_sender == self && m_batch_senders[i].m_room == room) {
+                own = true;
+                break;
+            }
+        }
+        chat_message * msg = batch;
+        if (own) {
+            m_filtered.clear();
+            for (size_t i=0; i<m_batch_senders.size(); ++i) {
+                const message & m = m_batch_senders[i];
+                if (m.m_sender != self && m.m_room == room) {
+                    m_filtered.append(m_batch, m.m_offset, m.m_len);
+                }
+            }
+            if (m_filtered.empty()) {
+                return;
+            }
+            msg = chat_message::create(-1, m_filtered.data(), m_filtered.size());
+        }
+        subscriber_queue & queue = m_clients[fd]->m_queue;
+        // 队列原来不空说明正在等待 EPOLLOUT，保持顺序，不直接发送
+        bool idle = queue.empty();
+        if (!queue.push(msg)) {
+            printf("worker %d: client %d send queue full, disconnect\n", m_idx, fd);
+            m_closing.push_back(fd);
+        } else if (idle && !flush(fd)) {
+            m_closing.push_back(fd);
+        }
+        if (own) {
+            msg->unref();
+        }
+    }
+
+    bool flush(int fd) {
+        return flush_queue(fd, m_clients[fd]->m_queue);
+    }
+
+    void close_client(int fd) {
+        if (!is_member(fd)) {
+            return;
+        }
+        int pos = m_clients[fd]->m_pos;
+        m_members[pos] = m_members.back();
+        m_clients[m_members[pos]]->m_pos = pos;
+        m_members.pop_back();
+        m_clients[fd]->m_pos = -1;
+        m_rooms.leave(m_clients[fd]->m_room, fd);
+        m_clients[fd]->m_room = nullptr;
+        char who[32];
+        snprintf(who, sizeof(who), "worker %d: client %d", m_idx, fd);
+        report_queue(who, m_clients[fd]->m_queue);
+        m_clients[fd]->m_queue.clear();
+        close(fd);
+    }
+
+    // 在遍历客户的过程中不能关闭连接，先记下来，一轮事件处理完后统一关闭
+    void close_pending() {
+        for (size_t i=0; i<m_closing.size(); ++i) {
+            close_client(m_closing[i]);
+        }
+        m_closing.clear();
+    }
+private:
+    // 一次合并发送的最大消息数量
+    static const int MAX_BATCH = 64;
+
+    struct message {
+        int m_sender;
+        int m_offset;   // 在 m_batch 中的位置
+        int m_len;
+        int m_room;     // 房间在 m_batch_rooms 中的下标
+    };
+
+    int m_idx;                          // 工作进程编号，也是它在环形缓冲区中的读者编号
+    int m_listenfd;
+    int m_pipefd;                       // 和父进程通信用的管道，读到 EOF 说明父进程已退出
+    int m_epollfd;
+    int m_max_clients;                  // 客户数量的上限，由文件描述符数量决定
+    unsigned int m_next_id;             // 下一个客户的连接序号
+    std::vector<chat_client *> m_clients;   // 以 socket 为下标
+    std::vector<int> m_members;         // 所有客户的 socket
+    room_manager m_rooms;               // 本进程的客户所在的房间
+    std::vector<int> m_closing;         // 等待关闭的客户
+    std::string m_batch;                // 一批消息的内容
+    std::vector<message> m_batch_senders;
+    std::vector<std::string> m_batch_rooms;     // 这批消息涉及的房间
+    std::string m_room_batch;           // 一个房间的消息的内容
+    std::string m_filtered;             // 去掉客户自己的消息之后的内容
+    std::string m_arg;                  // 命令的参数
+};
+
+/* 创建第 idx 个工作进程
+listen_fd: 监听 socket
+pipefd: 父进程持有写端的管道
+*/
+pid_t spawn_worker(int idx, int listen_fd, int pipefd[2]) {
+    // 避免标准输出缓冲区中的内容被子进程再输出一次
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(epollfd);
+        close(pipefd[1]);
+        close(sig_pipefd[0]);
+        close(sig_pipefd[1]);
+        chat_worker worker(idx, listen_fd, pipefd[0]);
+        worker.run();
+        exit(0);
+    } else if (pid > 0) {
+        sub_process[pid] = idx;
+    }
+    return pid;
+}
+
+// 事件驱动模式下父进程记录的一个工作进程
+struct worker_slot {
+    pid_t pid;              // -1 表示没有运行
+    long long start;        // 启动时间（毫秒）
+    long long respawn_at;   // 计划重新创建的时间（毫秒），0 表示没有计划
+    int backoff;            // 连续崩溃时，下次重新创建之前等待的时间（毫秒）
+};
+
+/* 事件驱动模式下父进程的运行函数：创建工作进程，在工作进程异常退出时重新创建。
+连续崩溃的工作进程按退避时间重新创建：等待时间从 RESPAWN_MIN_BACKOFF 开始加倍，
+最长 RESPAWN_MAX_BACKOFF，避免启动即崩溃的工作进程让父进程不停地 fork。
+listen_fd: 监听 socket
+worker_number: 工作进程数量
+*/
+int run_workers(int listen_fd, int worker_number) {
+    // 把文件描述符数量的软限制提高到硬限制
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    set_nonblocking(listen_fd);
+
+    int pipefd[2];
+    int ret = pipe(pipefd);
+    assert(ret != -1);
+    std::vector<worker_slot> workers(worker_number);
+    int alive = 0;
+    for (int i=0; i<worker_number; ++i) {
+        workers[i].pid = spawn_worker(i, listen_fd, pipefd);
+        workers[i].start = current_ms();
+        workers[i].respawn_at = 0;
+        workers[i].backoff = 0;
+        if (workers[i].pid > 0) {
+            ++alive;
+        }
+    }
+
+    epoll_event events[MAX_EVENT_NUMBER];
+    bool terminate = false;
+    while (true) {
+        // 等到最近一个计划重新创建的时间
+        long long now = current_ms();
+        long long next = -1;
+        for (int k=0; k<worker_number; ++k) {
+            if (workers[k].respawn_at && (next < 0 || workers[k].respawn_at < next)) {
+                next = workers[k].respawn_at;
+            }
+        }
+        if (alive == 0 && (terminate || next < 0)) {
+            break;
+        }
+        int timeout = next < 0 ? -1 : (next > now ? (int)(next - now) : 0);
+        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, timeout);
+        if (number < 0 && errno != EINTR) {
+            printf("epoll failure\n");
+            break;
+        }
+        for (int i=0; i<number; ++i) {
+            if (events[i].data.fd != sig_pipefd[0]) {
+                continue;
+            }
+            char signals[1024];
+            ret = recv(sig_pipefd[0], signals, sizeof(signals), 0);
+            for (int j=0; j<ret; ++j) {
+                if (signals[j] == SIGCHLD) {
+                    pid_t pid;
+                    int stat;
+                    while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
+                        std::unordered_map<pid_t, int>::iterator it = sub_process.find(pid);
+                        if (it == sub_process.end()) {
+                            continue;
+                        }
+                        int idx = it->second;
+                        worker_slot & worker = workers[idx];
+                        sub_process.erase(it);
+                        worker.pid = -1;
+                        --alive;
+                        if (terminate) {
+                            continue;
+                        }
+                        // 工作进程异常退出，它的客户连接已经断开，等待一段时间后重新创建
+                        now = current_ms();
+                        if (now - worker.start >= STABLE_UPTIME || worker.backoff == 0) {
+                            worker.backoff = RESPAWN_MIN_BACKOFF;
+                        } else {
+                            worker.backoff = worker.backoff * 2 < RESPAWN_MAX_BACKOFF ?
+                                             worker.backoff * 2 : RESPAWN_MAX_BACKOFF;
+                        }
+                        worker.respawn_at = now + worker.backoff;
+                        printf("worker %d exited, respawn in %d ms\n", idx, worker.backoff);
+                    }
+                } else if (signals[j] == SIGTERM || signals[j] == SIGINT) {
+                    printf("kill all the child now\n");
+                    for (int k=0; k<worker_number; ++k) {
+                        workers[k].respawn_at = 0;
+                        if (workers[k].pid > 0) {
+                            kill(workers[k].pid, SIGTERM);
+                        }
+                    }
+                    terminate = true;
+                }
+            }
+        }
+
+        now = current_ms();
+        for (int k=0; k<worker_number && !terminate; ++k) {
+            worker_slot & worker = workers[k];
+            if (!worker.respawn_at || worker.respawn_at > now) {
+                continue;
+            }
+            worker.pid = spawn_worker(k, listen_fd, pipefd);
+            if (worker.pid > 0) {
+                worker.respawn_at = 0;
+                worker.start = now;
+                ++alive;
+            } else {
+                printf("respawn worker %d failure, errno is: %d\n", k, errno);
+                worker.respawn_at = now + RESPAWN_MAX_BACKOFF;
+            }
+        }
+    }
+    // 父进程同时持有管道的读端，以便重新创建的工作进程继承
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return 0;
+}
+
 int main(int argc, char * argv[]) {
-    if (argc <= 2) {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
+    const char * name = basename(argv[0]);
+    int worker_number = 0;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:q:p:")) != -1) {
+        switch (opt) {
+            case 'w': worker_number = atoi(optarg); break;
+            case 'q': queue_capacity = atoi(optarg); break;
+            case 'p':
+                if (strcmp(optarg, "drop-newest") == 0) {
+                    overflow_policy = DROP_NEWEST;
+                } else if (strcmp(optarg, "drop-oldest") == 0) {
+                    overflow_policy = DROP_OLDEST;
+                } else if (strcmp(optarg, "disconnect") == 0) {
+                    overflow_policy = DISCONNECT;
+                } else {
+                    bad_option = true;
+                }
+                break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || argc - optind < 2 || worker_number < 0
+        || worker_number > broadcast_ring::MAX_READERS || queue_capacity <= 0) {
+        printf("usage: %s [-w worker_number] [-q queue_capacity] "
+               "[-p drop-newest|drop-oldest|disconnect] ip_address port_number\n", name);
         return 1;
     }
-    const char * ip = argv[1];
-    int port = atoi(argv[2]);
+    const char * ip = argv[optind];
+    int port = atoi(argv[optind + 1]);
 
     int ret = 0;
     sockaddr_in address;
@@ -187,20 +885,24 @@ int main(int argc, char * argv[]) {
     assert(listen_fd >= 0);
     ret = bind(listen_fd, (sockaddr *)&address, sizeof(address));
     assert(ret != -1);
-    ret = listen(listen_fd, 5);
+    ret = listen(listen_fd, worker_number > 0 ? SOMAXCONN : 5);
     assert(ret != -1);
 
     user_count = 0;
     users = new client_data[USER_LIMIT+1];
-    sub_process = new int[PROCESS_LIMIT];
-    for (int i=0; i<PROCESS_LIMIT; ++i) {
-        sub_process[i] = -1;
-    }
 
     epoll_event events[MAX_EVENT_NUMBER];
     epollfd = epoll_create(5);
     assert(epollfd != -1);
-    add_fd(epollfd, listen_fd);
+    // 事件驱动模式下由工作进程接受连接
+    if (worker_number == 0) {
+        // 每次事件只接受一个连接，监听 socket 要用 LT 模式，否则同时到达的连接会被漏掉
+        add_fd(epollfd, listen_fd);
+        epoll_event event;
+        event.data.fd = listen_fd;
+        event.events = EPOLLIN;
+        epoll_ctl(epollfd, EPOLL_CTL_MOD, listen_fd, &event);
+    }
 
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sig_pipefd);
     assert(ret != -1);
@@ -214,15 +916,27 @@ int main(int argc, char * argv[]) {
     bool stop_server = false;
     bool terminate = false;
 
-    // 创建共享内存，作为所有客户 socket 连接的读缓存
+    // 创建共享内存，存放所有客户消息的广播环形缓冲区
     shmfd = shm_open(shm_name, O_CREAT | O_RDWR, 0666);
     assert(shmfd != -1);
-    ret = ftruncate(shmfd, USER_LIMIT * BUFFER_SIZE);
+    ret = ftruncate(shmfd, sizeof(broadcast_ring));
     assert(ret != -1);
-    share_mem = (char *)mmap(nullptr, USER_LIMIT*BUFFER_SIZE,
+    void * share_mem = mmap(nullptr, sizeof(broadcast_ring),
                 PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
     assert(share_mem != MAP_FAILED);
     close(shmfd);
+    ring = (broadcast_ring *)share_mem;
+    ring->init();
+
+    ring_eventfd = eventfd(0, EFD_NONBLOCK);
+    assert(ring_eventfd != -1);
+
+    if (worker_number > 0) {
+        ret = run_workers(listen_fd, worker_number);
+        close(listen_fd);
+        del_resourse();
+        return ret;
+    }
 
     while (!stop_server) {
         int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
@@ -253,11 +967,20 @@ int main(int argc, char * argv[]) {
                 // 保存第 user_count 个客户连接的相关数据
                 users[user_count].address = client_address;
                 users[user_count].connfd = connfd;
+                // 分配一个空闲的读者编号。在 fork 之前登记，子进程不会漏掉此后的消息
+                int reader = 0;
+                while (reader_used[reader]) {
+                    ++reader;
+                }
+                reader_used[reader] = true;
+                users[user_count].reader = reader;
+                ring->attach(reader);
                 // 在主进程和子进程之间建立管道，以传递必要的数据
                 ret = socketpair(PF_UNIX, SOCK_STREAM, 0, users[user_count].pipefd);
                 assert(ret != -1);
                 pid_t pid = fork();
                 if (pid < 0) {
+                    reader_used[reader] = false;
                     close(connfd);
                     continue;
                 } else if (pid == 0) {
@@ -266,13 +989,12 @@ int main(int argc, char * argv[]) {
                     close(users[user_count].pipefd[0]);  // ???
                     close(sig_pipefd[0]);
                     close(sig_pipefd[1]);
-                    run_child(user_count, users, share_mem);
-                    munmap((void *)share_mem, USER_LIMIT*BUFFER_SIZE);
+                    run_child(user_count, users, ring);
+                    munmap(share_mem, sizeof(broadcast_ring));
                     exit(0);
                 } else {
                     close(connfd);
                     close(users[user_count].pipefd[1]);  // ???
-                    add_fd(epollfd, users[user_count].pipefd[0]);
                     users[user_count].pid = pid;
                     sub_process[pid] = user_count;
                     ++user_count;
@@ -296,17 +1018,20 @@ int main(int argc, char * argv[]) {
                                 int stat;
                                 while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
                                     // 用子进程的 pid 获取被关闭的客户连接的编号
-                                    int del_user = sub_process[pid];
-                                    sub_process[pid] = -1;
-                                    if (del_user<0 || del_user>USER_LIMIT) {
+                                    std::unordered_map<pid_t, int>::iterator it =
+                                        sub_process.find(pid);
+                                    if (it == sub_process.end()) {
                                         continue;
                                     }
+                                    int del_user = it->second;
+                                    sub_process.erase(it);
                                     // 清除第 del_user 个客户连接使用的相关数据
-                                    epoll_ctl(epollfd, EPOLL_CTL_DEL,
-                                            users[del_user].pipefd[0], 0);
                                     close(users[del_user].pipefd[0]);
-                                    users[del_user] = users[--user_count];
-                                    sub_process[users[del_user].pid] = del_user;
+                                    reader_used[users[del_user].reader] = false;
+                                    if (del_user != --user_count) {
+                                        users[del_user] = users[user_count];
+                                        sub_process[users[del_user].pid] = del_user;
+                                    }
                                 }
                                 if (terminate && user_count==0) {
                                     stop_server = true;
@@ -333,27 +1058,6 @@ int main(int argc, char * argv[]) {
                     }
                 }
             }
-            // 某个子进程向父进程写入了数据
-            else if (events[i].events & EPOLLIN) {
-                int child = 0;
-                // 读取管道数据，child 变量记录了是哪个客户连接有数据到达
-                ret = recv(sockfd, (char *)&child, sizeof(child), 0);
-                if (ret == -1) {
-                    continue;
-                } else if (ret == 0) {
-                    continue;
-                } else {
-                    // 向除了负责第 child 个客户连接的子进程之外的其他子进程发送
-                    // 消息，通知它们有客户数据要写
-                    for (int j=0; j<user_count; ++j) {
-                        if (users[j].pipefd[0] != sockfd) {
-                            printf("send data to child across pipe\n");
-                            send(users[j].pipefd[0], (char *)&child,
-                                sizeof(child), 0);
-                        }
-                    }
-                }
-            }
         }
     }
 
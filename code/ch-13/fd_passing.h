@@ -0,0 +1,258 @@
+/**
+ * @file fd_passing.h
+ * @author
+ * @date 2026-10-18
+ * @brief 通过 UNIX 域 socket 成批传递连接
+ *
+ * 一条消息用 SCM_RIGHTS 辅助数据携带最多 fd_batch::MAX_FDS 个文件描述符，消息的
+ * 数据部分是每个连接的元数据：对端地址，以及发送方已经从连接上读到的数据（例如
+ * 为了决定交给哪个进程而预读的请求头）。格式如下：
+ *
+ *     | 头部 (连接数, 数据区长度) | 每个连接的条目 (地址长度, 预读长度) | 数据区 |
+ *
+ * 数据区依次存放每个连接的地址和预读数据。传递 socket 必须是 SOCK_SEQPACKET 或
+ * SOCK_DGRAM 类型，以保证一批连接的元数据和文件描述符在同一条消息中。
+ *
+ * 接收方的文件描述符不够用（EMFILE）时，内核只放入一部分文件描述符并设置
+ * MSG_CTRUNC，其余的由内核关闭。这时 fd_batch 只保留收到的那部分连接，丢弃的数量
+ * 由 dropped() 给出。
+*/
+#ifndef FD_PASSING_H
+#define FD_PASSING_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <cerrno>
+#include <cstring>
+
+class fd_batch {
+public:
+    // 一批最多传递的文件描述符数量，内核的上限是 253（SCM_MAX_FD）
+    static const int MAX_FDS = 64;
+    // 一批连接的预读数据的总长度上限
+    static const int MAX_PREREAD = 16384;
+
+    fd_batch() { clear(); }
+
+    void clear() {
+        m_count = 0;
+        m_blob_len = 0;
+        m_dropped = 0;
+    }
+
+    /**
+     * @brief 把一个连接加入批次。批次只保存文件描述符的值，不持有它
+     * @param fd 连接的 socket
+     * @param peer 对端地址，可以为空
+     * @param data 已经从连接上读到的数据，可以为空
+     * @return 批次已满或数据区放不下时返回 false
+    */
+    bool add(int fd, const sockaddr * peer, socklen_t peer_len,
+             const char * data = nullptr, int len = 0) {
+        if (!peer) {
+            peer_len = 0;
+        }
+        if (m_count == MAX_FDS || peer_len > sizeof(sockaddr_storage)
+            || len < 0 || m_blob_len + peer_len + len > (int)sizeof(m_blob)) {
+            return false;
+        }
+        entry & e = m_entries[m_count];
+        e.m_peer_len = peer_len;
+        e.m_data_len = len;
+        m_offsets[m_count] = m_blob_len;
+        if (peer_len > 0) {
+            memcpy(m_blob + m_blob_len, peer, peer_len);
+        }
+        if (len > 0) {
+            memcpy(m_blob + m_blob_len + peer_len, data, len);
+        }
+        m_blob_len += peer_len + len;
+        m_fds[m_count++] = fd;
+        return true;
+    }
+
+    int size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    bool full() const { return m_count == MAX_FDS; }
+    // 最近一次 recv 因为 MSG_CTRUNC 或格式错误丢弃的连接数量
+    int dropped() const { return m_dropped; }
+
+    int fd(int i) const { return m_fds[i]; }
+    const sockaddr * peer(int i) const { return (const sockaddr *)(m_blob + m_offsets[i]); }
+    socklen_t peer_len(int i) const { return m_entries[i].m_peer_len; }
+    const char * data(int i) const { return m_blob + m_offsets[i] + m_entries[i].m_peer_len; }
+    int data_len(int i) const { return m_entries[i].m_data_len; }
+
+    // 关闭批次中的所有文件描述符。发送方在发送之后、接收方不需要这些连接时调用
+    void close_all() {
+        for (int i=0; i<m_count; ++i) {
+            close(m_fds[i]);
+        }
+        m_count = 0;
+    }
+
+    /**
+     * @brief 用一条 sendmsg 发送整批连接，发送之后发送方仍然持有这些文件描述符
+     * @param sock 传递连接的 UNIX 域 socket
+     * @param flags 额外的 sendmsg 标志，例如 MSG_DONTWAIT
+     * @return 1 表示发送成功，0 表示 socket 缓冲区已满（EAGAIN），-1 表示出错
+    */
+    int send(int sock, int flags = 0) const {
+        if (m_count == 0) {
+            return 1;
+        }
+        header h;
+        h.m_count = m_count;
+        h.m_blob_len = m_blob_len;
+        iovec iov[3];
+        iov[0].iov_base = &h;
+        iov[0].iov_len = sizeof(h);
+        iov[1].iov_base = (void *)m_entries;
+        iov[1].iov_len = sizeof(entry) * m_count;
+        iov[2].iov_base = (void *)m_blob;
+        iov[2].iov_len = m_blob_len;
+
+        control_buffer control;
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 3;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * m_count);
+        cmsghdr * cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * m_count);
+        memcpy(CMSG_DATA(cm), m_fds, sizeof(int) * m_count);
+
+        int ret;
+        while ((ret = sendmsg(sock, &msg, flags | MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+        }
+        if (ret < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        return 1;
+    }
+
+    /**
+     * @brief 接收一批连接，替换批次中原有的内容。收到的文件描述符带有 FD_CLOEXEC，
+     * 由调用者负责关闭
+     * @param sock 传递连接的 UNIX 域 socket
+     * @param flags 额外的 recvmsg 标志，例如 MSG_DONTWAIT
+     * @return 1 表示收到一条消息（size() 可能为 0，见 dropped()），0 表示没有数据，
+     * -1 表示出错或对端关闭
+    */
+    int recv(int sock, int flags = 0) {
+        clear();
+        iovec iov;
+        iov.iov_base = m_wire;
+        iov.iov_len = sizeof(m_wire);
+        control_buffer control;
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        int ret;
+        while ((ret = recvmsg(sock, &msg, flags | MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+        }
+        if (ret < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        } else if (ret == 0) {
+            return -1;
+        }
+
+        // 收集内核放入的文件描述符，即使消息被截断也要拿到它们，否则会泄漏
+        for (cmsghdr * cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int number = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i=0; i<number; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cm) + sizeof(int) * i, sizeof(int));
+                if (m_count < MAX_FDS) {
+                    m_fds[m_count++] = fd;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+
+        // 检查元数据。格式错误时整批丢弃
+        header h;
+        if (ret < (int)sizeof(h) || (msg.msg_flags & MSG_TRUNC)) {
+            return reject(m_count);
+        }
+        memcpy(&h, m_wire, sizeof(h));
+        size_t entries_len = sizeof(entry) * h.m_count;
+        if (h.m_count > (uint32_t)MAX_FDS || h.m_blob_len > sizeof(m_blob)
+            || (size_t)ret != sizeof(h) + entries_len + h.m_blob_len) {
+            return reject(m_count);
+        }
+        memcpy(m_entries, m_wire + sizeof(h), entries_len);
+        memcpy(m_blob, m_wire + sizeof(h) + entries_len, h.m_blob_len);
+        int offset = 0;
+        for (uint32_t i=0; i<h.m_count; ++i) {
+            m_offsets[i] = offset;
+            offset += m_entries[i].m_peer_len + m_entries[i].m_data_len;
+        }
+        if (offset != (int)h.m_blob_len) {
+            return reject(h.m_count);
+        }
+
+        // MSG_CTRUNC：内核按顺序放入了前面一部分文件描述符，它们仍然与条目一一对应
+        if (m_count > (int)h.m_count) {
+            return reject(m_count);
+        }
+        if (m_count < (int)h.m_count) {
+            if (!(msg.msg_flags & MSG_CTRUNC)) {
+                return reject(h.m_count);
+            }
+            m_dropped = h.m_count - m_count;
+        }
+        m_blob_len = h.m_blob_len;
+        return 1;
+    }
+private:
+    struct header {
+        uint32_t m_count;
+        uint32_t m_blob_len;
+    };
+
+    struct entry {
+        uint16_t m_peer_len;
+        uint16_t m_data_len;
+    };
+
+    union control_buffer {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    };
+
+    // 关闭收到的文件描述符，丢弃整条消息
+    int reject(int dropped) {
+        close_all();
+        m_blob_len = 0;
+        m_dropped = dropped;
+        return 1;
+    }
+
+    int m_fds[MAX_FDS];
+    entry m_entries[MAX_FDS];
+    int m_offsets[MAX_FDS];     // 每个连接的地址在 m_blob 中的位置
+    int m_count;
+    char m_blob[sizeof(sockaddr_storage) * MAX_FDS + MAX_PREREAD];
+    int m_blob_len;
+    int m_dropped;
+    // 接收时的消息缓冲区
+    char m_wire[sizeof(header) + sizeof(entry) * MAX_FDS
+                + sizeof(sockaddr_storage) * MAX_FDS + MAX_PREREAD];
+};
+
+#endif
@@ -11,65 +11,31 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
-
-static const int CONTROL_LEN = CMSG_LEN(sizeof(int));
+#include "fd_passing.h"
 
 /**
  * @brief 发送文件描述符。
  * @param fd 用来传递信息的UNIX域socket。
  * @param fd_to_send 待发送的文件描述符。
- * @return
- * @exception
+ * @return 是否发送成功
 */
-void send_fd(int fd, int fd_to_send) {
-    struct iovec iov[1];
-    struct msghdr msg;
-    char buf[0];
-
-    iov[0].iov_base = buf;
-    iov[0].iov_len = 1;
-    msg.msg_name = nullptr;
-    msg.msg_namelen = 0;
-    msg.msg_iov = iov;
-    msg.msg_iovlen = 1;
-
-    cmsghdr cm;
-    cm.cmsg_len = CONTROL_LEN;
-    cm.cmsg_level = SOL_SOCKET;
-    cm.cmsg_type = SCM_RIGHTS;
-    *(int *)CMSG_DATA(&cm) = fd_to_send;
-    msg.msg_control = &cm;  // 设置辅助数据
-    msg.msg_controllen = CONTROL_LEN;
-
-    sendmsg(fd, &msg, 0);
+bool send_fd(int fd, int fd_to_send) {
+    fd_batch batch;
+    batch.add(fd_to_send, nullptr, 0);
+    return batch.send(fd) == 1;
 }
 
 /**
  * @brief 接收文件描述符。
  * @param fd 用来传递信息的UNIX域socket。
- * @return 接收到的文件描述符。
- * @exception
+ * @return 接收到的文件描述符，失败时返回 -1
 */
 int recv_fd(int fd) {
-    struct iovec iov[1];
-    struct msghdr msg;
-    char buf[0];
-
-    iov[0].iov_base = buf;
-    iov[0].iov_len = 1;
-    msg.msg_name = nullptr;
-    msg.msg_namelen = 0;
-    msg.msg_iov = iov;
-    msg.msg_iovlen = 1;
-
-    cmsghdr cm;
-    msg.msg_control = &cm;
-    msg.msg_controllen = CONTROL_LEN;
-
-    recvmsg(fd, &msg, 0);
-
-    int fd_to_read = *(int *)CMSG_DATA(&cm);
-    return fd_to_read;
+    fd_batch batch;
+    if (batch.recv(fd) != 1 || batch.size() != 1) {
+        return -1;
+    }
+    return batch.fd(0);
 }
 
 int main() {
@@ -94,6 +60,10 @@ int main() {
     close(pipefd[1]);
     // 父进程从管道接收目标文件描述符
     fd_to_pass = recv_fd(pipefd[0]);
+    if (fd_to_pass < 0) {
+        printf("recv_fd failed\n");
+        return 1;
+    }
     char buf[1024];
     memset(buf, '\0', sizeof(buf));
     // 读目标文件描述符，验证其有效性
@@ -0,0 +1,156 @@
+/**
+ * @file shm_queue.h
+ * @author
+ * @date 2026-10-18
+ * @brief 放在共享内存中的单生产者单消费者队列，以及按需唤醒消费者的门铃
+ *
+ * 父子进程之间用 socket 传递通知时，每条通知都是一次 send 和一次 recv。把通知放进
+ * 共享内存中的 spsc_queue 后，入队和出队只是读写内存。消费者没有事件可处理、准备
+ * 睡眠时，先在 queue_doorbell 上登记；生产者入队后只在消费者登记过的情况下写一次
+ * eventfd 唤醒它。消费者忙碌时生产者不做任何系统调用，消费者每轮事件循环一次取出
+ * 所有积压的通知。
+ *
+ * 消费者的用法：
+ *
+ *     bell.prepare_wait();
+ *     int timeout = queue.empty() ? -1 : 0;   // 登记之后必须再检查一次队列
+ *     epoll_wait(epollfd, events, max, timeout);
+ *     bell.cancel_wait();
+ *     while (queue.pop(item)) { ... }
+ *
+ * 生产者的用法：queue.push(item); bell.ring();
+ *
+ * 两个类都要在 fork 之前放进 MAP_SHARED 的内存并调用 init，eventfd 由 fork 继承，
+ * 因此父子进程中的文件描述符值相同。
+*/
+#ifndef SHM_QUEUE_H
+#define SHM_QUEUE_H
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * @brief 有界单生产者单消费者队列
+ * @tparam T 元素类型，必须可以直接复制（不含指针等进程私有的数据）
+ * @tparam N 容量，必须是 2 的幂
+*/
+template<typename T, int N>
+class spsc_queue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+public:
+    void init() {
+        m_head.store(0);
+        m_tail.store(0);
+    }
+
+    /**
+     * @brief 入队，只能由生产者调用
+     * @return 队列满时返回 false
+    */
+    bool push(const T & item) {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == (uint32_t)N) {
+            return false;
+        }
+        m_slots[tail & (N - 1)] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 出队，只能由消费者调用
+     * @return 队列空时返回 false
+    */
+    bool pop(T & item) {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = m_slots[head & (N - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return m_head.load(std::memory_order_seq_cst) == m_tail.load(std::memory_order_seq_cst);
+    }
+
+    int size() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+private:
+    // 消费者和生产者各自修改的位置放在不同的缓存行
+    alignas(64) std::atomic<uint32_t> m_head;
+    alignas(64) std::atomic<uint32_t> m_tail;
+    alignas(64) T m_slots[N];
+};
+
+/**
+ * @brief 消费者空闲时才写 eventfd 的门铃
+*/
+class queue_doorbell {
+public:
+    queue_doorbell(): m_idle(0), m_fd(-1) {}
+
+    /**
+     * @brief 创建 eventfd
+     * @return 是否成功
+    */
+    bool init() {
+        m_idle.store(0);
+        m_fd = eventfd(0, EFD_NONBLOCK);
+        return m_fd >= 0;
+    }
+
+    void destroy() {
+        if (m_fd >= 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    // 消费者把它注册到 epoll，可读时说明被唤醒过
+    int fd() const { return m_fd; }
+
+    /**
+     * @brief 消费者准备睡眠。之后必须再检查一次队列，避免错过登记之前入队的元素
+    */
+    void prepare_wait() {
+        m_idle.store(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief 消费者醒来，取消登记
+    */
+    void cancel_wait() {
+        m_idle.store(0, std::memory_order_relaxed);
+    }
+
+    // 读空 eventfd 的计数，消费者在 eventfd 可读时调用
+    void clear() {
+        uint64_t count;
+        while (read(m_fd, &count, sizeof(count)) > 0) {
+        }
+    }
+
+    /**
+     * @brief 生产者入队之后调用，消费者空闲时唤醒它
+     * @return 是否写了 eventfd
+    */
+    bool ring() {
+        // 入队的写和这里对 m_idle 的读不能重排，与消费者的 prepare_wait 配对
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_idle.load(std::memory_order_relaxed) == 0 || m_idle.exchange(0) == 0) {
+            return false;
+        }
+        uint64_t one = 1;
+        return write(m_fd, &one, sizeof(one)) == sizeof(one);
+    }
+private:
+    std::atomic<uint32_t> m_idle;   // 消费者是否正在或即将睡眠
+    int m_fd;
+};
+
+#endif
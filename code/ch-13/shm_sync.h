@@ -0,0 +1,249 @@
+/**
+ * @file shm_sync.h
+ * @author
+ * @date 2026-10-18
+ * @brief 放在共享内存中、供多个进程使用的互斥锁和信号量
+ *
+ * System V 信号量的每次 P、V 操作都是一次 semop 系统调用。这里的互斥锁和信号量
+ * 只是共享内存中的几个原子变量：没有竞争时只需要一次 CAS 或 fetch_add，只有需要
+ * 等待或唤醒时才调用 futex。共享内存必须用 MAP_SHARED 映射（或 shmat），futex 也
+ * 因此不能使用 FUTEX_PRIVATE_FLAG。
+ *
+ * shm_mutex 的锁变量保存持有者的线程 ID。等待者每隔 ROBUST_CHECK_MS 毫秒检查一次
+ * 持有者是否还活着，持有者死亡时由等待者接管锁，lock 返回 EOWNERDEAD，调用者应当
+ * 先修复被保护的数据再继续使用。已经退出但还没有被回收的僵尸进程也视为死亡，所以
+ * 父进程不必先 waitpid。线程 ID 可能被复用，所以这只是尽力而为的恢复：持有者死后
+ * 它的 ID 恰好被新进程使用时，等待者会一直等下去。
+*/
+#ifndef SHM_SYNC_H
+#define SHM_SYNC_H
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "futex word must be a plain 32-bit integer");
+
+/**
+ * @brief futex 系统调用的封装
+*/
+inline int futex_wait(std::atomic<uint32_t> * addr, uint32_t expected,
+                      const timespec * timeout = nullptr) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT, expected, timeout, nullptr, 0);
+}
+
+inline int futex_wake(std::atomic<uint32_t> * addr, int number) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE, number, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief 当前线程的 ID。glibc 的 gettid 包装较新，这里自己缓存，并在 fork 之后
+ * 的子进程中清空缓存
+*/
+class shm_thread_id {
+public:
+    static uint32_t get() {
+        uint32_t & tid = cached();
+        if (tid == 0) {
+            static pthread_once_t once = PTHREAD_ONCE_INIT;
+            pthread_once(&once, register_atfork);
+            tid = syscall(SYS_gettid);
+        }
+        return tid;
+    }
+private:
+    static uint32_t & cached() {
+        static thread_local uint32_t tid = 0;
+        return tid;
+    }
+    static void reset() { cached() = 0; }
+    static void register_atfork() { pthread_atfork(nullptr, nullptr, reset); }
+};
+
+/**
+ * @brief 进程间互斥锁，不可重入
+ *
+ * 锁变量为 0 表示未加锁，否则低 30 位是持有者的线程 ID，WAITERS 位表示可能有
+ * 等待者，解锁时需要 futex_wake。
+*/
+class shm_mutex {
+public:
+    // 等待者检查持有者是否存活的间隔
+    static const int ROBUST_CHECK_MS = 100;
+    // 进入 futex 等待之前自旋的次数
+    static const int SPIN_COUNT = 100;
+
+    /**
+     * @brief 初始化。由创建共享内存的进程在其他进程使用之前调用一次
+    */
+    void init() { m_word.store(0); }
+
+    /**
+     * @brief 加锁
+     * @return 0 表示成功；EOWNERDEAD 表示原来的持有者已经死亡，锁已经由当前线程
+     * 持有，但被保护的数据可能不一致
+    */
+    int lock() {
+        uint32_t tid = shm_thread_id::get();
+        uint32_t expected = 0;
+        if (m_word.compare_exchange_strong(expected, tid, std::memory_order_acquire)) {
+            return 0;
+        }
+        for (int i=0; i<SPIN_COUNT; ++i) {
+            expected = m_word.load(std::memory_order_relaxed);
+            if (expected == 0 && m_word.compare_exchange_weak(
+                    expected, tid, std::memory_order_acquire)) {
+                return 0;
+            }
+            pause();
+        }
+        return lock_slow(tid);
+    }
+
+    /**
+     * @brief 尝试加锁，不等待
+    */
+    bool try_lock() {
+        uint32_t expected = 0;
+        return m_word.compare_exchange_strong(expected, shm_thread_id::get(),
+                                              std::memory_order_acquire);
+    }
+
+    void unlock() {
+        if (m_word.exchange(0, std::memory_order_release) & WAITERS) {
+            futex_wake(&m_word, 1);
+        }
+    }
+
+    // 当前持有者的线程 ID，未加锁时为 0
+    uint32_t owner() const { return m_word.load(std::memory_order_relaxed) & OWNER_MASK; }
+private:
+    static const uint32_t WAITERS = 1u << 31;
+    static const uint32_t OWNER_MASK = (1u << 30) - 1;
+
+    static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    /**
+     * @brief 线程 owner 是否已经死亡。kill 对僵尸进程仍然成功，所以还要检查
+     * /proc/<tid>/stat 中的进程状态，Z（僵尸）和 X（正在销毁）都视为死亡
+    */
+    static bool owner_dead(pid_t owner) {
+        if (kill(owner, 0) < 0 && errno == ESRCH) {
+            return true;
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int)owner);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return errno == ENOENT;
+        }
+        char buf[256];
+        int len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0) {
+            return false;
+        }
+        buf[len] = '\0';
+        // 格式为 "pid (comm) state ..."，comm 中可能有括号，从最后一个 ')' 开始找
+        const char * p = strrchr(buf, ')');
+        if (!p || p[1] != ' ') {
+            return false;
+        }
+        return p[2] == 'Z' || p[2] == 'X';
+    }
+
+    int lock_slow(uint32_t tid) {
+        timespec timeout;
+        timeout.tv_sec = ROBUST_CHECK_MS / 1000;
+        timeout.tv_nsec = (ROBUST_CHECK_MS % 1000) * 1000000L;
+        while (true) {
+            uint32_t v = m_word.load(std::memory_order_relaxed);
+            if (v == 0) {
+                // 不知道是否还有别的等待者，保守地带上 WAITERS
+                if (m_word.compare_exchange_weak(v, tid | WAITERS, std::memory_order_acquire)) {
+                    return 0;
+                }
+                continue;
+            }
+            if (!(v & WAITERS)) {
+                if (!m_word.compare_exchange_weak(v, v | WAITERS, std::memory_order_relaxed)) {
+                    continue;
+                }
+                v |= WAITERS;
+            }
+            if (futex_wait(&m_word, v, &timeout) < 0 && errno == ETIMEDOUT) {
+                if (owner_dead(v & OWNER_MASK)
+                    && m_word.compare_exchange_strong(v, tid | WAITERS,
+                                                      std::memory_order_acquire)) {
+                    return EOWNERDEAD;
+                }
+            }
+        }
+    }
+
+    std::atomic<uint32_t> m_word;
+};
+
+/**
+ * @brief 进程间计数信号量
+ *
+ * 信号量没有持有者，进程在 P 之后、V 之前死亡时不会自动归还（没有 SEM_UNDO）。
+ * 需要这种保证的场合应当使用 shm_mutex。
+*/
+class shm_semaphore {
+public:
+    void init(uint32_t value) {
+        m_value.store(value);
+        m_waiters.store(0);
+    }
+
+    // P 操作
+    void wait() {
+        while (!try_wait()) {
+            m_waiters.fetch_add(1, std::memory_order_seq_cst);
+            // 值仍然为 0 时才睡眠，否则 futex_wait 立即返回 EAGAIN
+            futex_wait(&m_value, 0);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_wait() {
+        uint32_t v = m_value.load(std::memory_order_relaxed);
+        while (v > 0) {
+            if (m_value.compare_exchange_weak(v, v - 1, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // V 操作
+    void post() {
+        m_value.fetch_add(1, std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_seq_cst) > 0) {
+            futex_wake(&m_value, 1);
+        }
+    }
+
+    uint32_t value() const { return m_value.load(std::memory_order_relaxed); }
+private:
+    std::atomic<uint32_t> m_value;
+    std::atomic<uint32_t> m_waiters;    // 正在等待或即将等待的进程数量
+};
+
+#endif
@@ -0,0 +1,210 @@
+/**
+ * @file sync_bench.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief 比较几种进程间互斥方式的开销
+ *
+ * 启动 processes 个进程，每个进程 iterations 次加锁、把共享内存中的计数器加一、
+ * 解锁，统计每次加锁解锁的平均耗时，并检查计数器的最终值。参加比较的有：
+ *
+ *     sysv     System V 信号量，semop 带 SEM_UNDO
+ *     pthread  放在共享内存中的 PTHREAD_PROCESS_SHARED 互斥锁
+ *     mutex    shm_mutex
+ *     sem      初值为 1 的 shm_semaphore
+ *
+ * 最后测试 shm_mutex 的持有者死亡恢复：子进程加锁后直接退出，父进程在回收它之前
+ * 加锁，应当返回 EOWNERDEAD。
+ *
+ *     sync_bench -p 1 -n 1000000      # 没有竞争
+ *     sync_bench -p 4 -n 1000000      # 4 个进程竞争
+*/
+#include <sys/sem.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sched.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "shm_sync.h"
+
+union semun {
+    int val;
+    struct semid_ds * buf;
+    unsigned short * array;
+    struct seminfo * __buf;
+};
+
+// 放在共享内存中的测试数据
+struct shared_data {
+    pthread_mutex_t m_pthread_mutex;
+    shm_mutex m_mutex;
+    shm_semaphore m_sem;
+    std::atomic<int> m_ready;   // 已经就绪的进程数
+    std::atomic<bool> m_start;
+    long long m_counter;        // 由锁保护
+};
+
+enum LOCK_TYPE { LOCK_SYSV, LOCK_PTHREAD, LOCK_MUTEX, LOCK_SEM };
+
+static const char * lock_names[] = {"sysv", "pthread", "mutex", "sem"};
+
+static long long now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sysv_pv(int sem_id, int op) {
+    sembuf sem_b;
+    sem_b.sem_num = 0;
+    sem_b.sem_op = op;
+    sem_b.sem_flg = SEM_UNDO;
+    semop(sem_id, &sem_b, 1);
+}
+
+static void worker(LOCK_TYPE type, shared_data * data, int sem_id, int iterations) {
+    data->m_ready.fetch_add(1);
+    while (!data->m_start.load()) {
+        sched_yield();
+    }
+    for (int i=0; i<iterations; ++i) {
+        switch (type) {
+            case LOCK_SYSV: sysv_pv(sem_id, -1); break;
+            case LOCK_PTHREAD: pthread_mutex_lock(&data->m_pthread_mutex); break;
+            case LOCK_MUTEX: data->m_mutex.lock(); break;
+            case LOCK_SEM: data->m_sem.wait(); break;
+        }
+        ++data->m_counter;
+        switch (type) {
+            case LOCK_SYSV: sysv_pv(sem_id, 1); break;
+            case LOCK_PTHREAD: pthread_mutex_unlock(&data->m_pthread_mutex); break;
+            case LOCK_MUTEX: data->m_mutex.unlock(); break;
+            case LOCK_SEM: data->m_sem.post(); break;
+        }
+    }
+}
+
+/**
+ * @brief 测试一种锁
+ * @return 是否所有进程都正常结束并且计数器正确
+*/
+static bool run(LOCK_TYPE type, shared_data * data, int sem_id,
+                int process_number, int iterations) {
+    data->m_ready.store(0);
+    data->m_start.store(false);
+    data->m_counter = 0;
+    for (int i=0; i<process_number; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return false;
+        } else if (pid == 0) {
+            worker(type, data, sem_id, iterations);
+            _exit(0);
+        }
+    }
+    while (data->m_ready.load() < process_number) {
+        usleep(1000);
+    }
+    long long start = now_ns();
+    data->m_start.store(true);
+    bool ok = true;
+    for (int i=0; i<process_number; ++i) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ok = false;
+        }
+    }
+    long long elapsed = now_ns() - start;
+    long long total = (long long)process_number * iterations;
+    ok = ok && data->m_counter == total;
+    printf("%-8s %10.1f ns/op %12.0f ops/s  counter %s\n", lock_names[type],
+           (double)elapsed / total, total * 1e9 / elapsed, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+/**
+ * @brief 子进程持有 shm_mutex 时死亡，父进程应当接管锁
+*/
+static bool check_owner_dead(shared_data * data) {
+    data->m_mutex.init();
+    pid_t pid = fork();
+    if (pid == 0) {
+        data->m_mutex.lock();
+        _exit(0);
+    }
+    // 在回收子进程之前加锁，持有者此时是僵尸进程
+    while (data->m_mutex.owner() == 0) {
+        sched_yield();
+    }
+    long long start = now_ns();
+    int ret = data->m_mutex.lock();
+    long long elapsed = now_ns() - start;
+    data->m_mutex.unlock();
+    waitpid(pid, nullptr, 0);
+    printf("owner death: lock returned %s after %.1f ms\n",
+           ret == EOWNERDEAD ? "EOWNERDEAD" : "0", elapsed / 1e6);
+    return ret == EOWNERDEAD;
+}
+
+int main(int argc, char * argv[]) {
+    const char * name = basename(argv[0]);
+    int process_number = 4;
+    int iterations = 1000000;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:")) != -1) {
+        switch (opt) {
+            case 'p': process_number = atoi(optarg); break;
+            case 'n': iterations = atoi(optarg); break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || process_number <= 0 || iterations <= 0) {
+        printf("usage: %s [-p processes] [-n iterations]\n", name);
+        return 1;
+    }
+
+    void * mem = mmap(nullptr, sizeof(shared_data), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    shared_data * data = new (mem) shared_data;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&data->m_pthread_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    data->m_mutex.init();
+    data->m_sem.init(1);
+
+    int sem_id = semget(IPC_PRIVATE, 1, 0666);
+    if (sem_id < 0) {
+        perror("semget");
+        return 1;
+    }
+    semun sem_un;
+    sem_un.val = 1;
+    semctl(sem_id, 0, SETVAL, sem_un);
+
+    printf("%d processes, %d iterations each\n", process_number, iterations);
+    bool ok = true;
+    ok = run(LOCK_SYSV, data, sem_id, process_number, iterations) && ok;
+    ok = run(LOCK_PTHREAD, data, sem_id, process_number, iterations) && ok;
+    ok = run(LOCK_MUTEX, data, sem_id, process_number, iterations) && ok;
+    ok = run(LOCK_SEM, data, sem_id, process_number, iterations) && ok;
+    ok = check_owner_dead(data) && ok;
+
+    semctl(sem_id, 0, IPC_RMID, sem_un);
+    pthread_mutex_destroy(&data->m_pthread_mutex);
+    munmap(mem, sizeof(shared_data));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+/**
+ * @file lock_bench.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief 测量 locker.h 中各种锁在不同线程数下的开销
+ *
+ * 线程数从 1 开始加倍，直到 threads。每个线程 iterations 次加锁、在临界区中
+ * 做 work 次简单运算并修改共享计数器、解锁。1 个线程时测到的是无竞争的开销，
+ * 线程越多竞争越激烈。参加比较的有：
+ *
+ *     locker    pthread 互斥锁
+ *     adaptive  adaptive_mutex
+ *     write     rwlock 的写锁
+ *     read      rwlock 的读锁，临界区只读，读者之间不互斥
+ *
+ *     lock_bench -t 64 -n 200000 -w 20
+ *
+ * 加上 -DLOCKER_PROFILE 编译，退出时还会输出每把锁的竞争报告。
+*/
+#include <pthread.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "locker.h"
+
+enum LOCK_TYPE { LOCK_LOCKER, LOCK_ADAPTIVE, LOCK_WRITE, LOCK_READ, LOCK_TYPE_NUMBER };
+
+static const char * lock_names[] = {"locker", "adaptive", "write", "read"};
+
+static locker mutex_lock("lock_bench::mutex_lock");
+static adaptive_mutex adaptive_lock("lock_bench::adaptive_lock");
+static rwlock table_lock("lock_bench::table_lock");
+
+static LOCK_TYPE lock_type;
+static int iterations = 200000;
+static int work = 20;
+static long long counter = 0;
+static pthread_barrier_t barrier;
+
+static long long now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief 临界区中的工作，返回值防止编译器把循环优化掉
+*/
+static long long critical_section(bool write) {
+    long long sum = counter;
+    for (int i=0; i<work; ++i) {
+        sum = sum * 31 + i;
+    }
+    if (write) {
+        ++counter;
+    }
+    return sum;
+}
+
+// 一个线程的测量结果
+struct result {
+    long long m_sum;
+    long long m_start;
+    long long m_end;
+};
+
+static void * worker(void * arg) {
+    result * r = (result *)arg;
+    long long sum = 0;
+    pthread_barrier_wait(&barrier);
+    r->m_start = now_ns();
+    for (int i=0; i<iterations; ++i) {
+        switch (lock_type) {
+            case LOCK_LOCKER: {
+                scoped_lock<locker> guard(mutex_lock);
+                sum += critical_section(true);
+                break;
+            }
+            case LOCK_ADAPTIVE: {
+                scoped_lock<adaptive_mutex> guard(adaptive_lock);
+                sum += critical_section(true);
+                break;
+            }
+            case LOCK_WRITE: {
+                write_guard guard(table_lock);
+                sum += critical_section(true);
+                break;
+            }
+            case LOCK_READ: {
+                read_guard guard(table_lock);
+                sum += critical_section(false);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    r->m_end = now_ns();
+    r->m_sum = sum;
+    return nullptr;
+}
+
+/**
+ * @brief 用 thread_number 个线程测试一种锁
+ * @return 平均每次加锁解锁的耗时（纳秒），计数器不正确时返回 -1
+*/
+static double run(LOCK_TYPE type, int thread_number) {
+    lock_type = type;
+    counter = 0;
+    pthread_barrier_init(&barrier, nullptr, thread_number + 1);
+    std::vector<pthread_t> threads(thread_number);
+    std::vector<result> results(thread_number);
+    for (int i=0; i<thread_number; ++i) {
+        pthread_create(&threads[i], nullptr, worker, &results[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    for (int i=0; i<thread_number; ++i) {
+        pthread_join(threads[i], nullptr);
+    }
+    pthread_barrier_destroy(&barrier);
+    // 从第一个线程开始到最后一个线程结束，不包括创建线程的时间
+    long long start = results[0].m_start;
+    long long end = results[0].m_end;
+    for (int i=1; i<thread_number; ++i) {
+        start = results[i].m_start < start ? results[i].m_start : start;
+        end = results[i].m_end > end ? results[i].m_end : end;
+    }
+    long long elapsed = end - start;
+
+    long long total = (long long)thread_number * iterations;
+    long long expected = type == LOCK_READ ? 0 : total;
+    return counter == expected ? (double)elapsed / total : -1;
+}
+
+int main(int argc, char * argv[]) {
+    const char * name = basename(argv[0]);
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:w:")) != -1) {
+        switch (opt) {
+            case 't': max_threads = atoi(optarg); break;
+            case 'n': iterations = atoi(optarg); break;
+            case 'w': work = atoi(optarg); break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || max_threads <= 0 || iterations <= 0 || work < 0) {
+        printf("usage: %s [-t max_threads] [-n iterations] [-w work]\n", name);
+        return 1;
+    }
+
+    printf("ns per lock/unlock, %d iterations per thread, work %d\n", iterations, work);
+    printf("%8s", "threads");
+    for (int type=0; type<LOCK_TYPE_NUMBER; ++type) {
+        printf(" %10s", lock_names[type]);
+    }
+    printf("\n");
+    bool ok = true;
+    for (int n=1; ; n*=2) {
+        if (n > max_threads) {
+            n = max_threads;
+        }
+        printf("%8d", n);
+        for (int type=0; type<LOCK_TYPE_NUMBER; ++type) {
+            double cost = run((LOCK_TYPE)type, n);
+            if (cost < 0) {
+                printf(" %10s", "WRONG");
+                ok = false;
+            } else {
+                printf(" %10.1f", cost);
+            }
+            fflush(stdout);
+        }
+        printf("\n");
+        if (n == max_threads) {
+            break;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -3,13 +3,293 @@
  * @author
  * @date 2024-03-15
  * @brief 线程同步机制包装类
+ *
+ * sem、locker、cond、rwlock 封装对应的 pthread 对象；adaptive_mutex 是先自旋、
+ * 再用 futex 睡眠的互斥锁，适合临界区很短的场合。scoped_lock、read_guard、
+ * write_guard 在构造时加锁、析构时解锁，避免提前返回时忘记解锁。
+ *
+ * 定义 LOCKER_PROFILE 编译时，locker、adaptive_mutex 和 rwlock 统计每个加锁
+ * 位置（构造时给出的名字，名字相同的锁合并统计）的加锁次数、发生竞争的次数、
+ * 等待时间和持有时间的分布，程序退出时把按总等待时间排序的报告写到标准错误，
+ * 也可以随时调用 lock_profile_dump。没有竞争时只多一次 trylock 和一次原子
+ * 加法；持有时间每 LOCKER_PROFILE_SAMPLE 次加锁测量一次。不定义时名字被忽略，
+ * 没有任何额外开销。
 */
 #ifndef LOCKER_H
 #define LOCKER_H
 
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <semaphore.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#include <atomic>
 #include <exception>
+#include <cstdio>
+
+#ifdef LOCKER_PROFILE
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+// 每隔多少次加锁测量一次持有时间，必须是 2 的幂
+#ifndef LOCKER_PROFILE_SAMPLE
+#define LOCKER_PROFILE_SAMPLE 16
+#endif
+
+/**
+ * @brief 一个加锁位置的统计。所有位置登记在一个固定大小的表中，从不释放
+*/
+class lock_site {
+public:
+    // 加锁位置的最大数量，超过后新的位置不再统计
+    static const int MAX_SITES = 256;
+    // 持有时间直方图的桶数，第 i 个桶是 [2^i, 2^(i+1)) 纳秒
+    static const int HOLD_BUCKETS = 40;
+
+    /**
+     * @brief 按名字查找加锁位置，不存在时创建
+     * @param name 名字，必须在整个程序运行期间有效（通常是字符串常量）
+     * @return 表满时返回 nullptr
+    */
+    static lock_site * get(const char * name) {
+        if (!name) {
+            name = "(unnamed)";
+        }
+        pthread_mutex_lock(&registry_mutex());
+        lock_site * sites = table();
+        int & number = site_number();
+        lock_site * site = nullptr;
+        for (int i=0; i<number && !site; ++i) {
+            if (strcmp(sites[i].m_name, name) == 0) {
+                site = &sites[i];
+            }
+        }
+        if (!site && number < MAX_SITES) {
+            if (number == 0) {
+                atexit(dump_at_exit);
+            }
+            site = &sites[number++];
+            site->m_name = name;
+        }
+        pthread_mutex_unlock(&registry_mutex());
+        return site;
+    }
+
+    static long long now_ns() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    void record_acquire(bool contended, long long wait_ns) {
+        m_acquires.fetch_add(1, std::memory_order_relaxed);
+        if (!contended) {
+            return;
+        }
+        m_contended.fetch_add(1, std::memory_order_relaxed);
+        m_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+        long long max = m_max_wait_ns.load(std::memory_order_relaxed);
+        while (wait_ns > max && !m_max_wait_ns.compare_exchange_weak(
+                   max, wait_ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void record_hold(long long hold_ns) {
+        int bucket = 63 - __builtin_clzll(hold_ns | 1);
+        if (bucket >= HOLD_BUCKETS) {
+            bucket = HOLD_BUCKETS - 1;
+        }
+        m_hold[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 输出所有加锁位置的统计，按总等待时间从大到小排序
+    */
+    static void dump(FILE * out) {
+        // 其他线程在输出期间仍在累加计数，先把每个位置的计数复制出来再排序，
+        // 否则排序过程中比较结果会变化
+        pthread_mutex_lock(&registry_mutex());
+        int number = site_number();
+        pthread_mutex_unlock(&registry_mutex());
+        lock_site * sites = table();
+        snapshot order[MAX_SITES];
+        for (int i=0; i<number; ++i) {
+            sites[i].take_snapshot(order[i]);
+        }
+        std::sort(order, order + number, more_wait);
+        fprintf(out, "%-32s %12s %10s %7s %10s %9s %9s %9s %9s\n", "lock site", "acquires",
+                "contended", "ratio", "wait(ms)", "avg(us)", "max(us)", "hold p50", "hold p99");
+        for (int i=0; i<number; ++i) {
+            const snapshot & s = order[i];
+            fprintf(out, "%-32s %12lld %10lld %6.2f%% %10.3f %9.2f %9.2f %9s %9s\n",
+                    s.m_name, s.m_acquires, s.m_contended,
+                    s.m_acquires ? 100.0 * s.m_contended / s.m_acquires : 0.0,
+                    s.m_wait_ns / 1e6,
+                    s.m_contended ? s.m_wait_ns / 1e3 / s.m_contended : 0.0,
+                    s.m_max_wait_ns / 1e3,
+                    hold_percentile(s, 50).c_str(), hold_percentile(s, 99).c_str());
+        }
+        fflush(out);
+    }
+private:
+    struct text {
+        char m_buf[16];
+        const char * c_str() const { return m_buf; }
+    };
+
+    // 输出报告时某个位置的计数的副本
+    struct snapshot {
+        const char * m_name;
+        long long m_acquires;
+        long long m_contended;
+        long long m_wait_ns;
+        long long m_max_wait_ns;
+        long long m_hold[HOLD_BUCKETS];
+    };
+
+    static pthread_mutex_t & registry_mutex() {
+        static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+        return mutex;
+    }
+
+    static lock_site * table() {
+        static lock_site sites[MAX_SITES];
+        return sites;
+    }
+
+    static int & site_number() {
+        static int number = 0;
+        return number;
+    }
+
+    static void dump_at_exit() {
+        dump(stderr);
+    }
+
+    void take_snapshot(snapshot & s) const {
+        s.m_name = m_name;
+        s.m_acquires = m_acquires.load(std::memory_order_relaxed);
+        s.m_contended = m_contended.load(std::memory_order_relaxed);
+        s.m_wait_ns = m_wait_ns.load(std::memory_order_relaxed);
+        s.m_max_wait_ns = m_max_wait_ns.load(std::memory_order_relaxed);
+        for (int i=0; i<HOLD_BUCKETS; ++i) {
+            s.m_hold[i] = m_hold[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static bool more_wait(const snapshot & a, const snapshot & b) {
+        return a.m_wait_ns > b.m_wait_ns;
+    }
+
+    /**
+     * @brief 持有时间的百分位数，取所在桶的上界，例如 "<=4us"
+    */
+    static text hold_percentile(const snapshot & s, int percent) {
+        text t;
+        long long total = 0;
+        for (int i=0; i<HOLD_BUCKETS; ++i) {
+            total += s.m_hold[i];
+        }
+        if (total == 0) {
+            snprintf(t.m_buf, sizeof(t.m_buf), "-");
+            return t;
+        }
+        long long rank = (total * percent + 99) / 100;
+        long long seen = 0;
+        int bucket = 0;
+        for (; bucket<HOLD_BUCKETS - 1; ++bucket) {
+            seen += s.m_hold[bucket];
+            if (seen >= rank) {
+                break;
+            }
+        }
+        long long bound = 2LL << bucket;
+        if (bound < 10000) {
+            snprintf(t.m_buf, sizeof(t.m_buf), "<=%lldns", bound);
+        } else if (bound < 10000000) {
+            snprintf(t.m_buf, sizeof(t.m_buf), "<=%lldus", bound / 1000);
+        } else {
+            snprintf(t.m_buf, sizeof(t.m_buf), "<=%lldms", bound / 1000000);
+        }
+        return t;
+    }
+
+    const char * m_name;
+    // 每个位置独占缓存行，不同的锁之间没有伪共享
+    alignas(64) std::atomic<long long> m_acquires;
+    std::atomic<long long> m_contended;
+    std::atomic<long long> m_wait_ns;
+    std::atomic<long long> m_max_wait_ns;
+    std::atomic<long long> m_hold[HOLD_BUCKETS];
+};
+
+/**
+ * @brief 一把锁的探针，记录到它所属的加锁位置
+*/
+class lock_probe {
+public:
+    explicit lock_probe(const char * name)
+        : m_site(lock_site::get(name)), m_acquired_ns(0), m_sequence(0) {}
+
+    /**
+     * @brief 取得独占锁之后调用
+     * @param start 开始等待的时间，没有等待时为 0
+    */
+    void acquired(long long start) {
+        if (!m_site) {
+            return;
+        }
+        long long now = 0;
+        if (start) {
+            now = lock_site::now_ns();
+        }
+        m_site->record_acquire(start != 0, now - start);
+        // 持有锁时才修改，m_sequence 和 m_acquired_ns 不需要是原子的
+        if ((++m_sequence & (LOCKER_PROFILE_SAMPLE - 1)) == 0) {
+            m_acquired_ns = now ? now : lock_site::now_ns();
+        } else {
+            m_acquired_ns = 0;
+        }
+    }
+
+    /**
+     * @brief 取得共享锁（读锁）之后调用，不统计持有时间
+    */
+    void acquired_shared(long long start) {
+        if (m_site) {
+            m_site->record_acquire(start != 0, start ? lock_site::now_ns() - start : 0);
+        }
+    }
+
+    /**
+     * @brief 释放独占锁之前调用
+    */
+    void released() {
+        if (m_acquired_ns) {
+            m_site->record_hold(lock_site::now_ns() - m_acquired_ns);
+            m_acquired_ns = 0;
+        }
+    }
+private:
+    lock_site * m_site;
+    long long m_acquired_ns;    // 本次加锁的时间，不测量时为 0
+    unsigned int m_sequence;
+};
+#endif
+
+/**
+ * @brief 输出锁竞争报告。没有定义 LOCKER_PROFILE 时什么也不做
+*/
+inline void lock_profile_dump(FILE * out = stderr) {
+#ifdef LOCKER_PROFILE
+    lock_site::dump(out);
+#else
+    (void)out;
+#endif
+}
 
 /**
  * @brief 封装信号量的类。
@@ -18,9 +298,10 @@ class sem {
 public:
     /**
      * @brief 创建并初始化信号量。
+     * @param num 信号量的初始值
     */
-    sem() {
-        if (sem_init(&m_sem, 0, 0) != 0) {
+    explicit sem(unsigned int num = 0) {
+        if (sem_init(&m_sem, 0, num) != 0) {
             throw std::exception();
         }
     }
@@ -39,6 +320,13 @@ public:
         return sem_wait(&m_sem) == 0;
     }
 
+    /**
+     * @brief 不等待，信号量为 0 时返回 false。
+    */
+    bool try_wait() {
+        return sem_trywait(&m_sem) == 0;
+    }
+
     /**
      * @brief 增加信号量。
     */
@@ -46,6 +334,9 @@ public:
         return sem_post(&m_sem) == 0;
     }
 private:
+    sem(const sem &);
+    sem & operator=(const sem &);
+
     sem_t m_sem;
 };
 
@@ -57,8 +348,14 @@ class locker {
 public:
     /**
      * @brief 创建并初始化互斥锁。
+     * @param name 加锁位置的名字，只用于 LOCKER_PROFILE
     */
-    locker() {
+    explicit locker(const char * name = nullptr)
+#ifdef LOCKER_PROFILE
+        : m_probe(name)
+#endif
+    {
+        (void)name;
         if (pthread_mutex_init(&m_mutex, nullptr) != 0) {
             throw std::exception();
         }
@@ -75,34 +372,91 @@ public:
      * @brief 获取互斥锁。
     */
     bool lock() {
+#ifdef LOCKER_PROFILE
+        long long start = 0;
+        if (pthread_mutex_trylock(&m_mutex) != 0) {
+            start = lock_site::now_ns();
+            if (pthread_mutex_lock(&m_mutex) != 0) {
+                return false;
+            }
+        }
+        m_probe.acquired(start);
+        return true;
+#else
         return pthread_mutex_lock(&m_mutex) == 0;
+#endif
+    }
+
+    /**
+     * @brief 尝试获取互斥锁，不等待。
+    */
+    bool try_lock() {
+        if (pthread_mutex_trylock(&m_mutex) != 0) {
+            return false;
+        }
+#ifdef LOCKER_PROFILE
+        m_probe.acquired(0);
+#endif
+        return true;
     }
 
     /**
      * @brief 释放互斥锁。
     */
     bool unlock() {
+#ifdef LOCKER_PROFILE
+        m_probe.released();
+#endif
         return pthread_mutex_unlock(&m_mutex) == 0;
     }
+
+    /**
+     * @brief 获取互斥锁对象，供 cond 使用。
+    */
+    pthread_mutex_t * get() {
+        return &m_mutex;
+    }
 private:
+    friend class cond;
+
+    locker(const locker &);
+    locker & operator=(const locker &);
+
+    // 在条件变量上等待时互斥锁被释放，持有时间到此为止
+    void before_wait() {
+#ifdef LOCKER_PROFILE
+        m_probe.released();
+#endif
+    }
+
     pthread_mutex_t m_mutex;
+#ifdef LOCKER_PROFILE
+    lock_probe m_probe;
+#endif
 };
 
 
 /**
  * @brief 封装条件变量的类。
+ *
+ * 条件变量必须和保护条件的互斥锁一起使用：调用者先持有互斥锁，检查条件，
+ * 条件不满足时调用 wait，wait 原子地释放互斥锁并睡眠，被唤醒后重新持有
+ * 互斥锁。被唤醒不代表条件已经满足（可能是虚假唤醒，或者条件又被其他线程
+ * 改变了），所以要在循环中检查条件，带谓词的 wait 就是这个循环。
 */
 class cond {
 public:
     /**
-     * @brief 创建并初始化条件变量。
+     * @brief 创建并初始化条件变量。wait_for 的超时按 CLOCK_MONOTONIC 计算，
+     * 不受系统时间被调整的影响。
     */
     cond() {
-        if (pthread_mutex_init(&m_mutex, nullptr) != 0) {
-            throw std::exception();
-        }
-        if (pthread_cond_init(&m_cond, nullptr) != 0) {
-            pthread_mutex_destroy(&m_mutex);
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        int ret = pthread_cond_init(&m_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        if (ret != 0) {
             throw std::exception();
         }
     }
@@ -111,30 +465,309 @@ public:
      * @brief 销毁条件变量。
     */
     ~cond() {
-        pthread_mutex_destroy(&m_mutex);
         pthread_cond_destroy(&m_cond);
     }
 
     /**
-     * @brief 等待条件变量。
+     * @brief 等待条件变量，调用者必须持有 mutex。
     */
-    bool wait() {
-        int ret = 0;
-        pthread_mutex_lock(&m_mutex);
-        ret = pthread_cond_wait(&m_cond, &m_mutex);
-        pthread_mutex_unlock(&m_mutex);
-        return ret == 0;
+    bool wait(locker & mutex) {
+        mutex.before_wait();
+        return pthread_cond_wait(&m_cond, mutex.get()) == 0;
     }
 
     /**
-     * @brief 唤醒等待条件变量的线程。
+     * @brief 等待直到 pred() 为真，调用者必须持有 mutex。
+    */
+    template<typename Predicate>
+    void wait(locker & mutex, Predicate pred) {
+        while (!pred()) {
+            mutex.before_wait();
+            pthread_cond_wait(&m_cond, mutex.get());
+        }
+    }
+
+    /**
+     * @brief 最多等待 ms 毫秒直到 pred() 为真，调用者必须持有 mutex。
+     * @return 超时时 pred() 仍为假则返回 false
+    */
+    template<typename Predicate>
+    bool wait_for(locker & mutex, int ms, Predicate pred) {
+        timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += ms / 1000;
+        deadline.tv_nsec += (ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!pred()) {
+            mutex.before_wait();
+            if (pthread_cond_timedwait(&m_cond, mutex.get(), &deadline) == ETIMEDOUT) {
+                return pred();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief 唤醒一个等待条件变量的线程。
     */
     bool signal() {
         return pthread_cond_signal(&m_cond) == 0;
     }
+
+    /**
+     * @brief 唤醒所有等待条件变量的线程。
+    */
+    bool broadcast() {
+        return pthread_cond_broadcast(&m_cond) == 0;
+    }
 private:
-    pthread_mutex_t m_mutex;
+    cond(const cond &);
+    cond & operator=(const cond &);
+
     pthread_cond_t m_cond;
 };
 
-#endif
\ No newline at end of file
+
+/**
+ * @brief 封装读写锁的类。
+ *
+ * 适合读多写少的数据，例如文件缓存：多个读者可以同时持有读锁。glibc 默认
+ * 读者优先，读者源源不断时写者会一直等待，这里设置为写者优先。
+*/
+class rwlock {
+public:
+    explicit rwlock(const char * name = nullptr)
+#ifdef LOCKER_PROFILE
+        : m_probe(name)
+#endif
+    {
+        (void)name;
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        int ret = pthread_rwlock_init(&m_rwlock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+        if (ret != 0) {
+            throw std::exception();
+        }
+    }
+
+    ~rwlock() {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+
+    bool read_lock() {
+#ifdef LOCKER_PROFILE
+        long long start = 0;
+        if (pthread_rwlock_tryrdlock(&m_rwlock) != 0) {
+            start = lock_site::now_ns();
+            if (pthread_rwlock_rdlock(&m_rwlock) != 0) {
+                return false;
+            }
+        }
+        m_probe.acquired_shared(start);
+        return true;
+#else
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+#endif
+    }
+
+    bool write_lock() {
+#ifdef LOCKER_PROFILE
+        long long start = 0;
+        if (pthread_rwlock_trywrlock(&m_rwlock) != 0) {
+            start = lock_site::now_ns();
+            if (pthread_rwlock_wrlock(&m_rwlock) != 0) {
+                return false;
+            }
+        }
+        m_probe.acquired(start);
+        return true;
+#else
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+#endif
+    }
+
+    bool unlock() {
+#ifdef LOCKER_PROFILE
+        // 读锁没有开始测量持有时间，released 什么也不做
+        m_probe.released();
+#endif
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+private:
+    rwlock(const rwlock &);
+    rwlock & operator=(const rwlock &);
+
+    pthread_rwlock_t m_rwlock;
+#ifdef LOCKER_PROFILE
+    lock_probe m_probe;
+#endif
+};
+
+
+/**
+ * @brief 先自旋、再用 futex 睡眠的互斥锁，只能在一个进程的线程之间使用。
+ *
+ * 锁变量为 0 表示未加锁，1 表示已加锁且没有等待者，2 表示可能有等待者。
+ * 加锁失败时先自旋等待持有者释放，自旋次数根据最近几次加锁实际需要的次数
+ * 调整：临界区很短时通常自旋一会儿就能拿到锁，省去睡眠和唤醒的两次系统调用；
+ * 持有者长时间不释放时自旋次数逐渐减少，很快转入睡眠，不浪费 CPU。
+*/
+class adaptive_mutex {
+public:
+    // 自旋次数的上限
+    static const int MAX_SPIN = 1000;
+
+    explicit adaptive_mutex(const char * name = nullptr)
+        : m_state(0), m_spin(100)
+#ifdef LOCKER_PROFILE
+        , m_probe(name)
+#endif
+    {
+        (void)name;
+    }
+
+    void lock() {
+        int expected = 0;
+        if (m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+#ifdef LOCKER_PROFILE
+            m_probe.acquired(0);
+#endif
+            return;
+        }
+#ifdef LOCKER_PROFILE
+        long long start = lock_site::now_ns();
+        lock_slow();
+        m_probe.acquired(start);
+#else
+        lock_slow();
+#endif
+    }
+
+    bool try_lock() {
+        int expected = 0;
+        if (!m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+            return false;
+        }
+#ifdef LOCKER_PROFILE
+        m_probe.acquired(0);
+#endif
+        return true;
+    }
+
+    void unlock() {
+#ifdef LOCKER_PROFILE
+        m_probe.released();
+#endif
+        if (m_state.exchange(0, std::memory_order_release) == 2) {
+            syscall(SYS_futex, &m_state, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+    }
+private:
+    adaptive_mutex(const adaptive_mutex &);
+    adaptive_mutex & operator=(const adaptive_mutex &);
+
+    static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    void lock_slow() {
+        int expected;
+        int limit = m_spin.load(std::memory_order_relaxed) * 2 + 10;
+        if (limit > MAX_SPIN) {
+            limit = MAX_SPIN;
+        }
+        for (int i=0; i<limit; ++i) {
+            pause();
+            expected = 0;
+            if (m_state.load(std::memory_order_relaxed) == 0
+                && m_state.compare_exchange_weak(expected, 1, std::memory_order_acquire)) {
+                // 自旋成功，按 1/8 的权重更新平均自旋次数
+                int spin = m_spin.load(std::memory_order_relaxed);
+                m_spin.store(spin + (i - spin) / 8, std::memory_order_relaxed);
+                return;
+            }
+        }
+        // 自旋失败，按 1/8 的权重把平均自旋次数向 0 衰减。持有者一直不释放时
+        // 每次自旋的次数逐渐减少到 20 次左右，等待者很快转入睡眠
+        int spin = m_spin.load(std::memory_order_relaxed);
+        m_spin.store(spin - spin / 8, std::memory_order_relaxed);
+        // 睡眠之前把状态置为 2，释放者看到 2 才会唤醒等待者
+        while (m_state.exchange(2, std::memory_order_acquire) != 0) {
+            syscall(SYS_futex, &m_state, FUTEX_WAIT_PRIVATE, 2, nullptr, nullptr, 0);
+        }
+    }
+
+    std::atomic<int> m_state;
+    std::atomic<int> m_spin;    // 最近加锁时平均需要的自旋次数，自旋失败记为 0
+#ifdef LOCKER_PROFILE
+    lock_probe m_probe;
+#endif
+};
+
+
+/**
+ * @brief 构造时加锁、析构时解锁，L 可以是 locker 或 adaptive_mutex。
+*/
+template<typename L>
+class scoped_lock {
+public:
+    explicit scoped_lock(L & lock): m_lock(lock) {
+        m_lock.lock();
+    }
+
+    ~scoped_lock() {
+        m_lock.unlock();
+    }
+private:
+    scoped_lock(const scoped_lock &);
+    scoped_lock & operator=(const scoped_lock &);
+
+    L & m_lock;
+};
+
+/**
+ * @brief 构造时加读锁、析构时解锁。
+*/
+class read_guard {
+public:
+    explicit read_guard(rwlock & lock): m_lock(lock) {
+        m_lock.read_lock();
+    }
+
+    ~read_guard() {
+        m_lock.unlock();
+    }
+private:
+    read_guard(const read_guard &);
+    read_guard & operator=(const read_guard &);
+
+    rwlock & m_lock;
+};
+
+/**
+ * @brief 构造时加写锁、析构时解锁。
+*/
+class write_guard {
+public:
+    explicit write_guard(rwlock & lock): m_lock(lock) {
+        m_lock.write_lock();
+    }
+
+    ~write_guard() {
+        m_lock.unlock();
+    }
+private:
+    write_guard(const write_guard &);
+    write_guard & operator=(const write_guard &);
+
+    rwlock & m_lock;
+};
+
+#endif
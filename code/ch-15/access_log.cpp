@@ -0,0 +1,226 @@
+/**
+ * @file access_log.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief WEB 服务器的访问日志的实现
+*/
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include "access_log.h"
+
+std::atomic<int> access_log::m_fd(-1);
+char access_log::m_path[512];
+locker access_log::m_buffers_lock("access_log::m_buffers_lock");
+std::vector<access_log::buffer *> access_log::m_buffers;
+pthread_t access_log::m_thread;
+std::atomic<bool> access_log::m_stop(false);
+
+static int open_log_file(const char * path) {
+    return ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+/**
+ * @brief 打开日志文件并启动后台线程
+ * @param path 日志文件路径
+ * @return 是否成功
+*/
+bool access_log::open(const char * path) {
+    int fd = open_log_file(path);
+    if (fd < 0) {
+        return false;
+    }
+    strncpy(m_path, path, sizeof(m_path) - 1);
+    m_fd.store(fd);
+    m_stop.store(false);
+    if (pthread_create(&m_thread, nullptr, flusher, nullptr) != 0) {
+        ::close(fd);
+        m_fd.store(-1);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 重新打开日志文件，用于日志轮转
+ * @return 是否成功，失败时继续写原来的文件
+*/
+bool access_log::reopen() {
+    int fd = m_fd.load();
+    if (fd < 0) {
+        return false;
+    }
+    // 先写出已缓冲的记录，使它们留在旧文件中
+    flush_all();
+    int new_fd = open_log_file(m_path);
+    if (new_fd < 0) {
+        return false;
+    }
+    int ret = dup2(new_fd, fd);
+    ::close(new_fd);
+    return ret >= 0;
+}
+
+/**
+ * @brief 停止后台线程，写出所有缓冲的记录并关闭日志文件
+*/
+void access_log::close() {
+    int fd = m_fd.load();
+    if (fd < 0) {
+        return;
+    }
+    m_stop.store(true);
+    pthread_join(m_thread, nullptr);
+    flush_all();
+    m_fd.store(-1);
+    ::close(fd);
+}
+
+/**
+ * @brief 获取当前线程的缓冲区，第一次调用时分配并登记
+*/
+access_log::buffer * access_log::local_buffer() {
+    static thread_local buffer * buf = nullptr;
+    if (!buf) {
+        buf = new buffer;
+        buf->len = 0;
+        m_buffers_lock.lock();
+        m_buffers.push_back(buf);
+        m_buffers_lock.unlock();
+    }
+    return buf;
+}
+
+/**
+ * @brief 把缓冲区中的内容写入日志文件，调用者必须持有缓冲区的锁
+*/
+void access_log::flush(buffer * buf) {
+    int fd = m_fd.load(std::memory_order_relaxed);
+    int done = 0;
+    while (done < buf->len && fd >= 0) {
+        int ret = write(fd, buf->data + done, buf->len - done);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;   // 磁盘满等错误：丢弃这批记录，不影响请求处理
+        }
+        done += ret;
+    }
+    buf->len = 0;
+}
+
+/**
+ * @brief 写出所有线程的缓冲区
+*/
+void access_log::flush_all() {
+    m_buffers_lock.lock();
+    std::vector<buffer *> buffers(m_buffers);
+    m_buffers_lock.unlock();
+    for (size_t i=0; i<buffers.size(); ++i) {
+        buffers[i]->lock.lock();
+        flush(buffers[i]);
+        buffers[i]->lock.unlock();
+    }
+}
+
+/**
+ * @brief 后台线程：定期写出缓冲区，使访问量小的时候日志也能及时落盘
+*/
+void * access_log::flusher(void *) {
+    while (!m_stop.load()) {
+        for (int i=0; i<FLUSH_INTERVAL*10 && !m_stop.load(); ++i) {
+            usleep(100000);
+        }
+        flush_all();
+    }
+    return nullptr;
+}
+
+/**
+ * @brief 向 out 中追加一个字符串，最多追加 max 个字符
+ * @return 追加之后的位置
+*/
+static char * append_str(char * out, const char * s, int max) {
+    while (*s && max-- > 0) {
+        *out++ = *s++;
+    }
+    return out;
+}
+
+/**
+ * @brief 向 out 中追加一个整数的十进制表示
+ * @return 追加之后的位置
+*/
+static char * append_num(char * out, long long v) {
+    char tmp[24];
+    int n = 0;
+    if (v < 0) {
+        *out++ = '-';
+        v = -v;
+    }
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    while (n > 0) {
+        *out++ = tmp[--n];
+    }
+    return out;
+}
+
+/**
+ * @brief 记录一次访问，格式为
+ * 客户地址 - - [时间] "方法 URL HTTP/1.1" 状态码 字节数 耗时(微秒)
+ * @param addr 客户端 socket 地址
+ * @param method 请求方法
+ * @param url 请求的 URL
+ * @param status 应答的状态码
+ * @param bytes 发送的字节数
+ * @param latency_us 从开始处理请求到应答发送完毕的耗时（微秒）
+*/
+void access_log::record(const sockaddr_in & addr, const char * method,
+                        const char * url, int status, long long bytes,
+                        long long latency_us) {
+    if (!enabled()) {
+        return;
+    }
+    // 时间戳每秒只格式化一次
+    static thread_local time_t cached_sec = 0;
+    static thread_local char cached_time[32];
+    time_t now = time(nullptr);
+    if (now != cached_sec) {
+        struct tm tm;
+        localtime_r(&now, &tm);
+        strftime(cached_time, sizeof(cached_time), "%d/%b/%Y:%H:%M:%S %z", &tm);
+        cached_sec = now;
+    }
+
+    buffer * buf = local_buffer();
+    buf->lock.lock();
+    if (BUFFER_SIZE - buf->len < MAX_LINE) {
+        flush(buf);
+    }
+    // 这里每个请求都会执行，不用 snprintf 和 inet_ntop，直接拼接
+    char * out = buf->data + buf->len;
+    const unsigned char * ip = (const unsigned char *)&addr.sin_addr.s_addr;
+    for (int i=0; i<4; ++i) {
+        out = append_num(out, ip[i]);
+        *out++ = i < 3 ? '.' : ' ';
+    }
+    out = append_str(out, "- - [", 8);
+    out = append_str(out, cached_time, 32);
+    out = append_str(out, "] \"", 8);
+    out = append_str(out, method, 16);
+    *out++ = ' ';
+    out = append_str(out, url, MAX_URL);
+    out = append_str(out, " HTTP/1.1\" ", 16);
+    out = append_num(out, status);
+    *out++ = ' ';
+    out = append_num(out, bytes);
+    *out++ = ' ';
+    out = append_num(out, latency_us);
+    *out++ = '\n';
+    buf->len = out - buf->data;
+    buf->lock.unlock();
+}
@@ -0,0 +1,64 @@
+/**
+ * @file access_log.h
+ * @author
+ * @date 2026-10-18
+ * @brief WEB 服务器的访问日志
+ *
+ * 每个线程把访问记录格式化后追加到自己的缓冲区中，缓冲区满了才由该线程用一次
+ * write 写入日志文件；后台线程每秒把所有缓冲区中剩余的记录写出。日志文件以
+ * O_APPEND 方式打开，多个线程的写操作不会互相覆盖。
+ *
+ * 日志轮转：把日志文件改名后调用 reopen（web_server 在收到 SIGHUP 时调用），
+ * 新打开的文件通过 dup2 原子地替换旧的文件描述符，正在写日志的线程不受影响。
+*/
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include "../ch-14/locker.h"
+
+class access_log {
+public:
+    // 每个线程的缓冲区大小
+    static const int BUFFER_SIZE = 64 * 1024;
+    // 一条记录中 URL 的最大长度
+    static const int MAX_URL = 1024;
+    // 一条记录的最大长度
+    static const int MAX_LINE = MAX_URL + 256;
+    // 后台线程写出缓冲区的间隔（秒）
+    static const int FLUSH_INTERVAL = 1;
+public:
+    static bool open(const char * path);
+    static bool reopen();
+    static void close();
+    static bool enabled() {
+        return m_fd.load(std::memory_order_relaxed) >= 0;
+    }
+    static void record(const sockaddr_in & addr, const char * method,
+                       const char * url, int status, long long bytes,
+                       long long latency_us);
+    static void flush_all();
+private:
+    // 一个线程的缓冲区。锁只在该线程和后台线程之间竞争，几乎总是无争用的
+    struct buffer {
+        buffer(): lock("access_log::buffer::lock"), len(0) {}
+        locker lock;
+        char data[BUFFER_SIZE];
+        int len;
+    };
+    static buffer * local_buffer();
+    static void flush(buffer * buf);
+    static void * flusher(void * arg);
+private:
+    static std::atomic<int> m_fd;          // 日志文件描述符，-1 表示未启用
+    static char m_path[512];               // 日志文件路径
+    static locker m_buffers_lock;          // 保护 m_buffers
+    static std::vector<buffer *> m_buffers;
+    static pthread_t m_thread;             // 后台线程
+    static std::atomic<bool> m_stop;       // 通知后台线程退出
+};
+
+#endif
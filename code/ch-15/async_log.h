@@ -0,0 +1,583 @@
+/**
+ * @file async_log.h
+ * @author
+ * @date 2026-10-18
+ * @brief 异步日志
+ *
+ * 记录日志的线程只把格式串指针、时间戳和按二进制编码的参数写进自己的环形
+ * 缓冲区（单生产者单消费者，无锁），不做任何格式化和 I/O；后台线程定期取出
+ * 所有线程的记录，格式化之后用一次 writev 批量写出。缓冲区满时丢弃记录并计数，
+ * 绝不阻塞记录日志的线程。线程退出时它的缓冲区被标记为退役，后台线程写出其中
+ * 剩余的记录后释放它，线程频繁创建和退出时缓冲区不会越积越多。
+ *
+ * 格式串必须是字符串字面量（只保存了它的指针）；字符串参数会被复制。
+ * 编译时定义 LOG_COMPILE_LEVEL 可以把低于该级别的日志语句完全去掉，运行时用
+ * async_log::set_level 过滤。
+*/
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <ctime>
+#include <climits>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <vector>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_AT(level, fmt, ...) do { \
+    if ((level) >= LOG_COMPILE_LEVEL && async_log::enabled(level)) { \
+        async_log::instance()->log((level), fmt, ##__VA_ARGS__); \
+    } \
+} while (0)
+
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)  LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+class async_log {
+public:
+    static const int RING_SIZE = 1 << 16;          // 每个线程的环形缓冲区大小
+    static const int STAGING_SIZE = 1 << 16;       // 每个线程的格式化缓冲区大小
+    static const int MAX_STRING_ARG = 1024;        // 字符串参数最多保存的字节数
+    static const int FLUSH_INTERVAL_MS = 10;       // 没有日志时后台线程的休眠时间
+private:
+    // 参数的类型标记
+    enum ARG_TYPE { ARG_INT = 1, ARG_UINT, ARG_DOUBLE, ARG_STRING, ARG_POINTER };
+    static const unsigned int PADDING = 0xff;      // 环形缓冲区末尾的填充记录
+
+    // 一条日志记录的头部，之后紧跟编码后的参数
+    struct record {
+        unsigned int size;        // 整条记录的大小（按 8 字节对齐）
+        unsigned int level;
+        long long time_ns;        // 记录日志的时间（CLOCK_REALTIME）
+        const char * fmt;
+    };
+
+    // 一个线程的环形缓冲区，head 只由该线程修改，tail 只由后台线程修改
+    struct ring {
+        char buf[RING_SIZE];
+        std::atomic<unsigned long> head;
+        std::atomic<unsigned long> tail;
+        std::atomic<bool> retired;      // 所属线程已经退出，不会再写入
+        int tid;
+        char staging[STAGING_SIZE];
+        int staging_len;
+    };
+public:
+    /**
+     * @brief 获取日志实例，第一次调用时（以及 fork 之后在子进程中第一次调用时）
+     * 启动后台线程
+    */
+    static async_log * instance() {
+        async_log * log = storage();
+        if (!log->m_running.load(std::memory_order_acquire)) {
+            log->start();
+        }
+        return log;
+    }
+
+    static bool enabled(int level) {
+        return level >= level_ref().load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置运行时的日志级别，默认为 LOG_LEVEL_INFO
+    */
+    static void set_level(int level) {
+        level_ref().store(level, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置日志输出的文件描述符（默认为标准输出）
+    */
+    void set_output(int fd) {
+        m_fd.store(fd, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 记录一条日志
+     * @param level 日志级别
+     * @param fmt printf 风格的格式串，必须是字符串字面量
+    */
+    template <typename... Args>
+    void log(int level, const char * fmt, const Args &... args) {
+        ring * r = local_ring();
+        unsigned long size = align(sizeof(record) + args_size(args...));
+        char * p = reserve(r, size);
+        if (!p) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        record * rec = (record *)p;
+        rec->size = size;
+        rec->level = level;
+        rec->time_ns = now_ns();
+        rec->fmt = fmt;
+        encode(p + sizeof(record), args...);
+        r->head.store(r->head.load(std::memory_order_relaxed) + size,
+                      std::memory_order_release);
+    }
+
+    /**
+     * @brief 停止后台线程，并写出所有剩余的日志
+    */
+    void stop() {
+        if (m_has_thread) {
+            m_stop.store(true);
+            pthread_join(m_thread, nullptr);
+            m_has_thread = false;
+        }
+        drain();
+    }
+private:
+    async_log(): m_running(false), m_has_thread(false), m_stop(false),
+        m_fd(STDOUT_FILENO), m_dropped(0), m_reported_dropped(0) {
+        pthread_mutex_init(&m_rings_lock, nullptr);
+        pthread_key_create(&m_ring_key, retire_ring);
+        atexit(on_exit);
+        pthread_atfork(nullptr, nullptr, after_fork);
+    }
+
+    /**
+     * @brief 日志对象永不析构：进程退出时其他线程可能仍在记录日志
+    */
+    static async_log * storage() {
+        static async_log * log = new async_log;
+        return log;
+    }
+
+    static std::atomic<int> & level_ref() {
+        static std::atomic<int> level(LOG_LEVEL_INFO);
+        return level;
+    }
+
+    void start() {
+        pthread_mutex_lock(&m_rings_lock);
+        if (!m_running.load(std::memory_order_relaxed)) {
+            m_stop.store(false);
+            m_has_thread = pthread_create(&m_thread, nullptr, flusher, this) == 0;
+            m_running.store(true, std::memory_order_release);
+        }
+        pthread_mutex_unlock(&m_rings_lock);
+    }
+
+    /**
+     * @brief fork 之后子进程中只有调用 fork 的线程，后台线程需要重新启动；
+     * 缓冲区中复制自父进程的记录由父进程负责写出，子进程直接丢弃
+    */
+    static void after_fork() {
+        async_log * log = storage();
+        pthread_mutex_init(&log->m_rings_lock, nullptr);
+        ring * mine = log->local_ring();
+        for (size_t i=0; i<log->m_rings.size(); ++i) {
+            ring * r = log->m_rings[i];
+            r->tail.store(r->head.load());
+            r->staging_len = 0;
+            // 其他线程在子进程中不存在，它们的缓冲区由后台线程释放
+            if (r != mine) {
+                r->retired.store(true);
+            }
+        }
+        log->m_has_thread = false;
+        log->m_running.store(false);
+        // 子进程中调用 fork 的线程有了新的线程 id
+        mine->tid = syscall(SYS_gettid);
+    }
+
+    static void on_exit() {
+        storage()->stop();
+    }
+
+    static long long now_ns() {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    static unsigned long align(unsigned long size) {
+        return (size + 7) & ~7UL;
+    }
+
+    static ring *& thread_ring() {
+        static thread_local ring * r = nullptr;
+        return r;
+    }
+
+    /**
+     * @brief 获取当前线程的环形缓冲区，第一次调用时分配并登记
+    */
+    ring * local_ring() {
+        ring *& r = thread_ring();
+        if (!r) {
+            r = new ring;
+            r->head.store(0);
+            r->tail.store(0);
+            r->retired.store(false);
+            r->tid = syscall(SYS_gettid);
+            r->staging_len = 0;
+            pthread_mutex_lock(&m_rings_lock);
+            m_rings.push_back(r);
+            pthread_mutex_unlock(&m_rings_lock);
+            // 线程退出时由 retire_ring 把缓冲区标记为退役
+            pthread_setspecific(m_ring_key, r);
+        }
+        return r;
+    }
+
+    /**
+     * @brief 线程退出时调用。之后这个线程（在其他线程局部变量的析构中）再记录日志
+     * 会分配一个新的缓冲区
+    */
+    static void retire_ring(void * arg) {
+        ring * r = (ring *)arg;
+        thread_ring() = nullptr;
+        r->retired.store(true, std::memory_order_release);
+    }
+
+    /**
+     * @brief 在环形缓冲区中预留一段连续的空间，剩余空间不够时返回 nullptr。
+     * 缓冲区末尾不够放下整条记录时，用一条填充记录跳到缓冲区开头
+    */
+    static char * reserve(ring * r, unsigned long size) {
+        unsigned long head = r->head.load(std::memory_order_relaxed);
+        unsigned long tail = r->tail.load(std::memory_order_acquire);
+        unsigned long offset = head & (RING_SIZE - 1);
+        unsigned long contiguous = RING_SIZE - offset;
+        if (size > contiguous) {
+            if (head + contiguous + size - tail > (unsigned long)RING_SIZE) {
+                return nullptr;
+            }
+            record * pad = (record *)(r->buf + offset);
+            pad->size = contiguous;
+            pad->level = PADDING;
+            r->head.store(head + contiguous, std::memory_order_release);
+            head += contiguous;
+            offset = 0;
+        }
+        if (head + size - tail > (unsigned long)RING_SIZE) {
+            return nullptr;
+        }
+        return r->buf + offset;
+    }
+
+    // 这组函数计算参数编码后的大小
+
+    static unsigned long args_size() { return 0; }
+    template <typename T, typename... Rest>
+    static unsigned long args_size(const T & arg, const Rest &... rest) {
+        return arg_size(arg) + args_size(rest...);
+    }
+    template <typename T>
+    static unsigned long arg_size(const T &) { return 1 + 8; }
+    static unsigned long arg_size(const char * s) {
+        size_t len = s ? strnlen(s, MAX_STRING_ARG) : 6;
+        return 1 + 4 + len + 1;
+    }
+    static unsigned long arg_size(char * s) { return arg_size((const char *)s); }
+    template <size_t N>
+    static unsigned long arg_size(const char (&s)[N]) { return arg_size((const char *)s); }
+
+    // 这组函数把参数按 “类型标记 + 值” 编码
+
+    static void encode(char *) {}
+    template <typename T, typename... Rest>
+    static void encode(char * p, const T & arg, const Rest &... rest) {
+        encode(p + encode_arg(p, arg), rest...);
+    }
+    template <typename T>
+    static int encode_arg(char * p, const T & arg) {
+        return encode_value(p, arg);
+    }
+    static int encode_arg(char * p, const char * s) {
+        if (!s) s = "(null)";
+        unsigned int len = strnlen(s, MAX_STRING_ARG);
+        p[0] = ARG_STRING;
+        memcpy(p + 1, &len, 4);
+        memcpy(p + 5, s, len);
+        p[5 + len] = '\0';
+        return 1 + 4 + len + 1;
+    }
+    static int encode_arg(char * p, char * s) { return encode_arg(p, (const char *)s); }
+    template <size_t N>
+    static int encode_arg(char * p, const char (&s)[N]) {
+        return encode_arg(p, (const char *)s);
+    }
+    static int encode_value(char * p, bool v) { return encode_value(p, (long long)v); }
+    static int encode_value(char * p, double v) { return put(p, ARG_DOUBLE, &v); }
+    static int encode_value(char * p, float v) { return encode_value(p, (double)v); }
+    static int encode_value(char * p, const void * v) { return put(p, ARG_POINTER, &v); }
+    static int encode_value(char * p, char v) { return encode_value(p, (long long)v); }
+    static int encode_value(char * p, int v) { return encode_value(p, (long long)v); }
+    static int encode_value(char * p, long v) { return encode_value(p, (long long)v); }
+    static int encode_value(char * p, long long v) { return put(p, ARG_INT, &v); }
+    static int encode_value(char * p, unsigned int v) {
+        return encode_value(p, (unsigned long long)v);
+    }
+    static int encode_value(char * p, unsigned long v) {
+        return encode_value(p, (unsigned long long)v);
+    }
+    static int encode_value(char * p, unsigned long long v) { return put(p, ARG_UINT, &v); }
+    static int put(char * p, char type, const void * v) {
+        p[0] = type;
+        memcpy(p + 1, v, 8);
+        return 1 + 8;
+    }
+
+    /**
+     * @brief 按格式串和编码后的参数格式化一条记录，追加到 out 中
+     * @return 写入的字节数
+    */
+    static int format(const record * rec, char * out, int len) {
+        const char * args = (const char *)rec + sizeof(record);
+        const char * args_end = (const char *)rec + rec->size;
+        int n = 0;
+        for (const char * f = rec->fmt; *f && n < len; ++f) {
+            if (*f != '%') {
+                out[n++] = *f;
+                continue;
+            }
+            if (f[1] == '%') {
+                out[n++] = '%';
+                ++f;
+                continue;
+            }
+            // 取出转换说明，去掉其中的长度修饰符，再按实际编码的类型补上
+            char spec[32];
+            int s = 0;
+            const char * p = f;
+            spec[s++] = *p++;
+            while (*p && strchr("-+ #0123456789.", *p) && s < 24) spec[s++] = *p++;
+            while (*p && strchr("hlLqjzt", *p)) ++p;
+            char conv = *p;
+            if (!conv || args >= args_end || *args == 0) {
+                // 参数不够，原样输出
+                int l = (p - f) + (conv ? 1 : 0);
+                if (l > len - n) l = len - n;
+                memcpy(out + n, f, l);
+                n += l;
+                f = conv ? p : p - 1;
+                continue;
+            }
+            f = p;
+            char type = *args;
+            int w = 0;
+            if (type == ARG_STRING) {
+                unsigned int l;
+                memcpy(&l, args + 1, 4);
+                spec[s++] = 's';
+                spec[s] = '\0';
+                w = snprintf(out + n, len - n, spec, args + 5);
+                args += 1 + 4 + l + 1;
+            } else {
+                char v[8];
+                memcpy(v, args + 1, 8);
+                args += 1 + 8;
+                if (type == ARG_DOUBLE) {
+                    spec[s++] = strchr("eEfFgGaA", conv) ? conv : 'f';
+                    spec[s] = '\0';
+                    w = snprintf(out + n, len - n, spec, *(double *)v);
+                } else if (type == ARG_POINTER) {
+                    spec[s++] = 'p';
+                    spec[s] = '\0';
+                    w = snprintf(out + n, len - n, spec, *(void **)v);
+                } else if (conv == 'c') {
+                    spec[s++] = 'c';
+                    spec[s] = '\0';
+                    w = snprintf(out + n, len - n, spec, (int)*(long long *)v);
+                } else {
+                    spec[s++] = 'l';
+                    spec[s++] = 'l';
+                    spec[s++] = strchr("diouxX", conv) ? conv :
+                                (type == ARG_INT ? 'd' : 'u');
+                    spec[s] = '\0';
+                    w = snprintf(out + n, len - n, spec, *(long long *)v);
+                }
+            }
+            n += (w < len - n) ? w : len - n - 1;
+        }
+        return n;
+    }
+
+    /**
+     * @brief 把一条记录格式化为一行，追加到环形缓冲区的格式化缓冲区中
+     * @return 空间不足时返回 false
+    */
+    bool format_line(ring * r, const record * rec, time_t & last_sec, char * time_buf) {
+        static const char * level_names[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+        // 一行最长占用的空间，不够时先写出格式化缓冲区
+        const int MAX_LINE = MAX_STRING_ARG * 2;
+        if (STAGING_SIZE - r->staging_len < MAX_LINE) {
+            return false;
+        }
+        time_t sec = rec->time_ns / 1000000000LL;
+        if (sec != last_sec) {
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            strftime(time_buf, 32, "%Y-%m-%d %H:%M:%S", &tm);
+            last_sec = sec;
+        }
+        char * out = r->staging + r->staging_len;
+        int n = snprintf(out, MAX_LINE, "%s.%06lld %s [%d] ", time_buf,
+                         rec->time_ns % 1000000000LL / 1000,
+                         level_names[rec->level & 3], r->tid);
+        n += format(rec, out + n, MAX_LINE - n - 1);
+        if (n > 0 && out[n-1] != '\n') {
+            out[n++] = '\n';
+        }
+        r->staging_len += n;
+        return true;
+    }
+
+    /**
+     * @brief 取出所有线程缓冲区中的记录，格式化后用 writev 批量写出
+     * @return 是否写出了日志
+    */
+    bool drain() {
+        static time_t last_sec = 0;
+        static char time_buf[32];
+        bool wrote = false;
+        pthread_mutex_lock(&m_rings_lock);
+        std::vector<ring *> rings(m_rings);
+        pthread_mutex_unlock(&m_rings_lock);
+
+        bool more = true;
+        while (more) {
+            more = false;
+            std::vector<iovec> iov;
+            for (size_t i=0; i<rings.size(); ++i) {
+                ring * r = rings[i];
+                unsigned long tail = r->tail.load(std::memory_order_relaxed);
+                unsigned long head = r->head.load(std::memory_order_acquire);
+                while (tail < head) {
+                    const record * rec = (const record *)(r->buf + (tail & (RING_SIZE - 1)));
+                    if (rec->level != PADDING && !format_line(r, rec, last_sec, time_buf)) {
+                        more = true;
+                        break;
+                    }
+                    tail += rec->size;
+                }
+                r->tail.store(tail, std::memory_order_release);
+                if (r->staging_len > 0) {
+                    iovec v = { r->staging, (size_t)r->staging_len };
+                    iov.push_back(v);
+                }
+            }
+            long long dropped = m_dropped.load(std::memory_order_relaxed);
+            char note[64];
+            if (dropped != m_reported_dropped) {
+                int l = snprintf(note, sizeof(note), "async_log: %lld records dropped\n",
+                                 dropped - m_reported_dropped);
+                iovec v = { note, (size_t)l };
+                iov.push_back(v);
+                m_reported_dropped = dropped;
+            }
+            if (!iov.empty()) {
+                write_all(&iov[0], iov.size());
+                wrote = true;
+            }
+            for (size_t i=0; i<rings.size(); ++i) {
+                rings[i]->staging_len = 0;
+            }
+        }
+        release_retired(rings);
+        return wrote;
+    }
+
+    /**
+     * @brief 释放所属线程已经退出、记录也已全部写出的缓冲区
+    */
+    void release_retired(const std::vector<ring *> & rings) {
+        std::vector<ring *> done;
+        for (size_t i=0; i<rings.size(); ++i) {
+            ring * r = rings[i];
+            // 先读 retired：看到 true 时线程最后一次修改的 head 也可见
+            if (r->retired.load(std::memory_order_acquire)
+                && r->tail.load(std::memory_order_relaxed)
+                   == r->head.load(std::memory_order_acquire)) {
+                done.push_back(r);
+            }
+        }
+        if (done.empty()) {
+            return;
+        }
+        pthread_mutex_lock(&m_rings_lock);
+        for (size_t i=0; i<done.size(); ++i) {
+            for (size_t j=0; j<m_rings.size(); ++j) {
+                if (m_rings[j] == done[i]) {
+                    m_rings[j] = m_rings.back();
+                    m_rings.pop_back();
+                    break;
+                }
+            }
+        }
+        pthread_mutex_unlock(&m_rings_lock);
+        for (size_t i=0; i<done.size(); ++i) {
+            delete done[i];
+        }
+    }
+
+    /**
+     * @brief 写出全部 iovec，处理部分写的情况
+    */
+    void write_all(iovec * iov, int count) {
+        int fd = m_fd.load(std::memory_order_relaxed);
+        while (count > 0) {
+            int batch = count < IOV_MAX ? count : IOV_MAX;
+            ssize_t ret = writev(fd, iov, batch);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            while (batch > 0 && (size_t)ret >= iov->iov_len) {
+                ret -= iov->iov_len;
+                ++iov;
+                --count;
+                --batch;
+            }
+            if (batch > 0) {
+                iov->iov_base = (char *)iov->iov_base + ret;
+                iov->iov_len -= ret;
+            }
+        }
+    }
+
+    static void * flusher(void * arg) {
+        async_log * log = (async_log *)arg;
+        while (!log->m_stop) {
+            if (!log->drain()) {
+                timespec ts = { 0, FLUSH_INTERVAL_MS * 1000000L };
+                nanosleep(&ts, nullptr);
+            }
+        }
+        return nullptr;
+    }
+private:
+    std::atomic<bool> m_running;        // 是否已经（在当前进程中）启动过后台线程
+    bool m_has_thread;                  // 后台线程是否创建成功且尚未退出
+    std::atomic<bool> m_stop;           // 是否通知后台线程退出
+    pthread_t m_thread;                 // 后台线程
+    std::atomic<int> m_fd;              // 日志输出的文件描述符
+    std::atomic<long long> m_dropped;   // 因缓冲区满而丢弃的记录数
+    long long m_reported_dropped;       // 已经报告过的丢弃数
+    pthread_mutex_t m_rings_lock;       // 保护 m_rings，只在登记、释放缓冲区和取出列表时加锁
+    std::vector<ring *> m_rings;        // 所有线程的环形缓冲区
+    pthread_key_t m_ring_key;           // 线程退出时通过它的析构函数把缓冲区标记为退役
+};
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * @file cgi_bench.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief concurrent_cgi_server 的延迟测试客户端
+ *
+ * 每个线程循环执行：建立连接，发送 CGI 程序名，读取输出直到服务器关闭连接。
+ * 一次请求的延迟从开始建立连接算起，到读到 EOF 为止，用来比较 fork+exec 和
+ * 常驻工作进程两种模式：
+ *
+ *     concurrent_cgi_server 127.0.0.1 12345                       # fork+exec
+ *     concurrent_cgi_server -w ./say_hi 127.0.0.1 12345           # 常驻工作进程
+ *     cgi_bench -c 4 -d 10 127.0.0.1 12345 ./say_hi
+*/
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../ch-16/latency_histogram.h"
+
+struct options {
+    sockaddr_in address;
+    const char * program;
+    int concurrency;
+    int duration;
+};
+
+static options g_opt;
+
+struct worker {
+    pthread_t thread;
+    latency_histogram latency;   // 请求延迟（微秒）
+    long long errors;
+    long long bytes;
+};
+
+static long long now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 执行一次请求
+ * @return 收到的字节数，失败时返回 -1
+*/
+static long long do_request(const char * request, int len) {
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+    if (connect(sockfd, (sockaddr *)&g_opt.address, sizeof(g_opt.address)) < 0
+        || send(sockfd, request, len, MSG_NOSIGNAL) != len) {
+        close(sockfd);
+        return -1;
+    }
+    char buf[4096];
+    long long total = 0;
+    int ret;
+    while ((ret = recv(sockfd, buf, sizeof(buf), 0)) > 0) {
+        total += ret;
+    }
+    close(sockfd);
+    return ret < 0 ? -1 : total;
+}
+
+static void * run(void * arg) {
+    worker * w = (worker *)arg;
+    char request[1024];
+    int len = snprintf(request, sizeof(request), "%s\r\n", g_opt.program);
+    long long deadline = now_us() + g_opt.duration * 1000000LL;
+    long long start;
+    while ((start = now_us()) < deadline) {
+        long long bytes = do_request(request, len);
+        // 服务器没有输出就关闭连接，说明程序不存在或者执行失败
+        if (bytes <= 0) {
+            ++w->errors;
+            continue;
+        }
+        w->bytes += bytes;
+        w->latency.record(now_us() - start);
+    }
+    return nullptr;
+}
+
+int main(int argc, char * argv[]) {
+    const char * name = basename(argv[0]);
+    g_opt.concurrency = 1;
+    g_opt.duration = 10;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:")) != -1) {
+        switch (opt) {
+            case 'c': g_opt.concurrency = atoi(optarg); break;
+            case 'd': g_opt.duration = atoi(optarg); break;
+            default: bad_option = true; break;
+        }
+    }
+    if (bad_option || argc - optind < 3
+        || g_opt.concurrency <= 0 || g_opt.duration <= 0) {
+        printf("usage: %s [-c concurrency] [-d seconds] ip_address port_number "
+               "cgi_program\n", name);
+        return 1;
+    }
+    memset(&g_opt.address, 0, sizeof(g_opt.address));
+    g_opt.address.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[optind], &g_opt.address.sin_addr);
+    g_opt.address.sin_port = htons(atoi(argv[optind + 1]));
+    g_opt.program = argv[optind + 2];
+
+    worker * workers = new worker[g_opt.concurrency];
+    for (int i=0; i<g_opt.concurrency; ++i) {
+        workers[i].errors = 0;
+        workers[i].bytes = 0;
+        pthread_create(&workers[i].thread, nullptr, run, &workers[i]);
+    }
+    latency_histogram total;
+    long long errors = 0;
+    long long bytes = 0;
+    for (int i=0; i<g_opt.concurrency; ++i) {
+        pthread_join(workers[i].thread, nullptr);
+        total.merge(workers[i].latency);
+        errors += workers[i].errors;
+        bytes += workers[i].bytes;
+    }
+    delete [] workers;
+
+    printf("%lld requests, %lld errors, %lld bytes in %d s, %.1f requests/s\n",
+           total.count(), errors, bytes, g_opt.duration,
+           (double)total.count() / g_opt.duration);
+    printf("latency (us): min %lld mean %.0f p50 %lld p90 %lld p99 %lld "
+           "p99.9 %lld max %lld\n",
+           total.min(), total.mean(), total.percentile(50), total.percentile(90),
+           total.percentile(99), total.percentile(99.9), total.max());
+    return 0;
+}
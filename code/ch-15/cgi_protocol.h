@@ -0,0 +1,211 @@
+/**
+ * @file cgi_protocol.h
+ * @author
+ * @date 2026-10-18
+ * @brief 常驻 CGI 进程与服务器之间的通信协议（类似 FastCGI）
+ *
+ * 服务器为每个常驻 CGI 程序创建若干个工作进程，工作进程的标准输入是一个
+ * SOCK_SEQPACKET 类型的 UNIX 域 socket，环境变量 CGI_WORKER 为 1。双方在这个
+ * socket 上收发帧，每条消息就是一帧：帧头 cgi_frame 之后紧跟 m_length 字节的数据。
+ *
+ * - CGI_REQUEST：服务器发给工作进程，数据是客户请求的内容，客户连接的 socket 以
+ *   SCM_RIGHTS 附在消息上。工作进程把输出直接写到这个 socket。
+ * - CGI_END：工作进程处理完请求后回复，带上返回值和处理耗时。
+ *
+ * 每个请求有自己的编号，服务器不必等待上一个请求完成就可以发送下一个请求。
+*/
+#ifndef CGI_PROTOCOL_H
+#define CGI_PROTOCOL_H
+
+#include <sys/socket.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+
+// 标识工作进程的环境变量
+#define CGI_WORKER_ENV "CGI_WORKER"
+
+// 帧的类型
+enum CGI_FRAME_TYPE {
+    CGI_REQUEST = 1,
+    CGI_END = 2
+};
+
+// 一帧数据的最大长度
+static const int CGI_MAX_PAYLOAD = 1024;
+
+/**
+ * @brief 帧头
+*/
+struct cgi_frame {
+    uint32_t m_id;          // 请求编号
+    uint16_t m_type;        // 帧的类型
+    uint16_t m_length;      // 帧头之后的数据长度
+    int32_t m_status;       // CGI_END：处理函数的返回值
+    uint32_t m_elapsed_us;  // CGI_END：工作进程处理请求的耗时（微秒）
+};
+
+/**
+ * @brief 发送一帧
+ * @param sock 通信 socket
+ * @param frame 帧头，m_length 为数据长度
+ * @param payload 数据
+ * @param fd 随帧传递的文件描述符，-1 表示没有
+ * @param flags 传给 sendmsg 的标志，例如 MSG_DONTWAIT
+ * @return 是否发送成功
+*/
+inline bool cgi_send_frame(int sock, const cgi_frame & frame, const char * payload,
+                           int fd, int flags) {
+    iovec iov[2];
+    iov[0].iov_base = (void *)&frame;
+    iov[0].iov_len = sizeof(frame);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = frame.m_length;
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = frame.m_length > 0 ? 2 : 1;
+    if (fd >= 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsghdr * cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    int ret;
+    while ((ret = sendmsg(sock, &msg, flags | MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    return ret >= 0;
+}
+
+/**
+ * @brief 接收一帧
+ * @param sock 通信 socket
+ * @param frame 保存帧头
+ * @param payload 保存数据，长度至少为 CGI_MAX_PAYLOAD + 1，数据之后补 '\0'
+ * @param fd 保存随帧传递的文件描述符，没有时为 -1
+ * @param flags 传给 recvmsg 的标志
+ * @return 1 表示收到一帧，0 表示对端关闭，-1 表示出错（包括非阻塞时没有数据）
+*/
+inline int cgi_recv_frame(int sock, cgi_frame & frame, char * payload, int & fd,
+                          int flags) {
+    iovec iov[2];
+    iov[0].iov_base = &frame;
+    iov[0].iov_len = sizeof(frame);
+    iov[1].iov_base = payload;
+    iov[1].iov_len = CGI_MAX_PAYLOAD;
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    fd = -1;
+    int ret;
+    while ((ret = recvmsg(sock, &msg, flags | MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+    if (ret <= 0) {
+        return ret;
+    }
+    cmsghdr * cm = CMSG_FIRSTHDR(&msg);
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+    }
+    // 不完整的帧
+    if (ret < (int)sizeof(frame) || ret - (int)sizeof(frame) < frame.m_length) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        errno = EPROTO;
+        return -1;
+    }
+    payload[frame.m_length] = '\0';
+    return 1;
+}
+
+/**
+ * @brief 当前进程是否作为常驻工作进程启动
+*/
+inline bool cgi_is_worker() {
+    const char * env = getenv(CGI_WORKER_ENV);
+    return env && strcmp(env, "1") == 0;
+}
+
+/**
+ * @brief 工作进程的主循环：逐个接收请求，调用 handler 处理，直到服务器关闭 socket
+ *
+ * handler 执行期间标准输出被重定向到客户连接，所以原来用 printf 输出的 CGI 程序
+ * 不用修改输出部分。
+ * @param handler 请求处理函数，参数是客户请求的内容，返回值放在 CGI_END 帧中
+ * @return 进程的退出码
+*/
+inline int cgi_worker_main(int (*handler)(const char * request)) {
+    int sock = STDIN_FILENO;
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    // 客户提前关闭连接时，写标准输出不应该杀死工作进程
+    signal(SIGPIPE, SIG_IGN);
+
+    char payload[CGI_MAX_PAYLOAD + 1];
+    while (true) {
+        cgi_frame request;
+        int fd;
+        int ret = cgi_recv_frame(sock, request, payload, fd, 0);
+        if (ret == 0) {
+            break;
+        } else if (ret < 0) {
+            if (errno == EPROTO) {
+                continue;
+            }
+            break;
+        }
+        if (request.m_type != CGI_REQUEST || fd < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+
+        timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+        int status = handler(payload);
+        fflush(stdout);
+        // 让标准输出不再引用客户连接，客户才能读到 EOF
+        dup2(devnull, STDOUT_FILENO);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        cgi_frame reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.m_id = request.m_id;
+        reply.m_type = CGI_END;
+        reply.m_status = status;
+        reply.m_elapsed_us = (end.tv_sec - begin.tv_sec) * 1000000
+                             + (end.tv_nsec - begin.tv_nsec) / 1000;
+        if (!cgi_send_frame(sock, reply, nullptr, -1, 0)) {
+            break;
+        }
+    }
+    close(devnull);
+    return 0;
+}
+
+#endif
@@ -9,6 +9,7 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
@@ -19,8 +20,243 @@
 #include <cstdio>
 #include <cerrno>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include "processpool.h"
+#include "cgi_protocol.h"
+
+/**
+ * @brief 关闭所有不小于 lowfd 的文件描述符，在 fork 之后、exec 之前调用
+ *
+ * 优先用 close_range，一次系统调用就能完成；内核不支持时遍历 /proc/self/fd，只关闭
+ * 真正打开的文件描述符，而不是从 lowfd 逐个 close 到 RLIMIT_NOFILE。父进程有日志
+ * 线程，fork 之后只能使用异步信号安全的调用，所以直接用 getdents64 读目录。
+*/
+static void close_fds_from(int lowfd) {
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, lowfd, ~0U, 0) == 0) {
+        return;
+    }
+#endif
+    int dirfd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        long max_fd = sysconf(_SC_OPEN_MAX);
+        for (long fd=lowfd; fd<max_fd; ++fd) {
+            close(fd);
+        }
+        return;
+    }
+    // 内核的 struct linux_dirent64
+    struct dirent64_entry {
+        unsigned long long d_ino;
+        long long d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+    char buf[4096];
+    long len;
+    while ((len = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0) {
+        for (long pos=0; pos<len; ) {
+            dirent64_entry * entry = (dirent64_entry *)(buf + pos);
+            pos += entry->d_reclen;
+            int fd = 0;
+            const char * p = entry->d_name;
+            for (; *p >= '0' && *p <= '9'; ++p) {
+                fd = fd * 10 + (*p - '0');
+            }
+            // 跳过 "." 和 ".."
+            if (*p == '\0' && p != entry->d_name && fd >= lowfd && fd != dirfd) {
+                close(fd);
+            }
+        }
+    }
+    close(dirfd);
+}
+
+/**
+ * @brief 常驻 CGI 工作进程池
+ *
+ * 为注册过的 CGI 程序维护若干个常驻工作进程（见 cgi_protocol.h），请求到来时
+ * 把客户连接交给负载最小的工作进程，省去每个请求一次 fork+exec 的开销。没有注册
+ * 的程序、工作进程忙或者启动失败时，由调用者退回到 fork+exec。
+ *
+ * 工作进程在第一次使用时由进程池的子进程创建，所以每个子进程有自己的一组工作进程；
+ * 子进程退出时工作进程读到 EOF 随之退出。
+*/
+class cgi_worker_pool {
+public:
+    // 工作进程连续过早退出这么多次后，认为该程序不支持常驻模式
+    static const int MAX_FAILURES = 3;
+    // 工作进程运行不到这个时间（毫秒）就退出，视为启动失败
+    static const int MIN_UPTIME = 1000;
+public:
+    cgi_worker_pool(): m_worker_number(2), m_next_id(0) {}
+
+    void set_worker_number(int number) {
+        m_worker_number = number;
+    }
+
+    /**
+     * @brief 注册一个以常驻模式运行的 CGI 程序，必须在创建进程池之前调用
+     * @param path 程序路径，与客户请求的内容完全相同时才使用常驻工作进程
+    */
+    void add_program(const char * path) {
+        program prog;
+        prog.m_path = path;
+        prog.m_failures = 0;
+        prog.m_workers.resize(m_worker_number);
+        m_programs.push_back(prog);
+    }
+
+    /**
+     * @brief 把客户请求交给常驻工作进程处理
+     * @param path 客户请求的 CGI 程序
+     * @param sockfd 客户连接，成功后工作进程持有它的副本，调用者可以关闭自己的
+     * @return 是否成功交给了工作进程
+    */
+    bool submit(const char * path, int sockfd) {
+        program * prog = find(path);
+        if (!prog || prog->m_failures >= MAX_FAILURES) {
+            return false;
+        }
+        worker * best = nullptr;
+        for (size_t i=0; i<prog->m_workers.size(); ++i) {
+            worker & w = prog->m_workers[i];
+            if (w.m_sock < 0 && !spawn(*prog, w)) {
+                continue;
+            }
+            collect(*prog, w);
+            if (w.m_sock >= 0 && (!best || w.m_inflight < best->m_inflight)) {
+                best = &w;
+            }
+        }
+        if (!best) {
+            return false;
+        }
+
+        cgi_frame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.m_id = ++m_next_id;
+        frame.m_type = CGI_REQUEST;
+        frame.m_length = strlen(path);
+        // 工作进程的 socket 缓冲区满说明它处理不过来，退回到 fork+exec
+        if (!cgi_send_frame(best->m_sock, frame, path, sockfd, MSG_DONTWAIT)) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                stop(*prog, *best);
+            }
+            return false;
+        }
+        ++best->m_inflight;
+        return true;
+    }
+private:
+    struct worker {
+        worker(): m_pid(-1), m_sock(-1), m_inflight(0), m_start(0) {}
+        pid_t m_pid;         // 工作进程 pid
+        int m_sock;          // 与工作进程通信的 socket
+        int m_inflight;      // 已发送但还没有完成的请求数
+        long long m_start;   // 工作进程的启动时间（毫秒）
+    };
+    struct program {
+        std::string m_path;
+        int m_failures;      // 工作进程连续过早退出的次数
+        std::vector<worker> m_workers;
+    };
+
+    program * find(const char * path) {
+        for (size_t i=0; i<m_programs.size(); ++i) {
+            if (m_programs[i].m_path == path) {
+                return &m_programs[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 创建一个工作进程。工作进程的标准输入是通信 socket，其他文件描述符全部关闭
+    */
+    bool spawn(program & prog, worker & w) {
+        int fds[2];
+        if (socketpair(PF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+            return false;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        } else if (pid == 0) {
+            dup2(fds[1], STDIN_FILENO);
+            close_fds_from(STDERR_FILENO + 1);
+            setenv(CGI_WORKER_ENV, "1", 1);
+            execl(prog.m_path.c_str(), prog.m_path.c_str(), (char *)0);
+            exit(1);
+        }
+        close(fds[1]);
+        w.m_pid = pid;
+        w.m_sock = fds[0];
+        w.m_inflight = 0;
+        w.m_start = current_ms();
+        LOG_INFO("start cgi worker %s pid %d", prog.m_path.c_str(), (int)pid);
+        return true;
+    }
+
+    /**
+     * @brief 关闭与工作进程的连接，工作进程读到 EOF 后退出，下次使用时重新创建
+    */
+    void stop(program & prog, worker & w) {
+        if (current_ms() - w.m_start < MIN_UPTIME) {
+            if (++prog.m_failures == MAX_FAILURES) {
+                LOG_WARN("cgi worker %s keeps exiting, fall back to fork+exec",
+                         prog.m_path.c_str());
+            }
+        } else {
+            prog.m_failures = 0;
+        }
+        LOG_INFO("cgi worker %s pid %d stopped", prog.m_path.c_str(), (int)w.m_pid);
+        close(w.m_sock);
+        w.m_sock = -1;
+        w.m_pid = -1;
+        w.m_inflight = 0;
+    }
+
+    /**
+     * @brief 读取工作进程已完成请求的回复
+    */
+    void collect(program & prog, worker & w) {
+        cgi_frame frame;
+        char payload[CGI_MAX_PAYLOAD + 1];
+        int fd;
+        while (true) {
+            int ret = cgi_recv_frame(w.m_sock, frame, payload, fd, MSG_DONTWAIT);
+            if (ret > 0) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                if (frame.m_type == CGI_END && w.m_inflight > 0) {
+                    --w.m_inflight;
+                    LOG_DEBUG("cgi request %u done in %u us, status %d", frame.m_id,
+                              frame.m_elapsed_us, frame.m_status);
+                }
+            } else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                                   || errno == EPROTO)) {
+                if (errno == EPROTO) {
+                    continue;
+                }
+                break;
+            } else {
+                stop(prog, w);
+                break;
+            }
+        }
+    }
+private:
+    int m_worker_number;              // 每个程序的工作进程数量
+    unsigned int m_next_id;           // 下一个请求编号
+    std::vector<program> m_programs;
+};
 
 /**
  * @brief 处理用户CGI请求的类
@@ -54,7 +290,7 @@ public:
                 break;
             } else {
                 m_read_idx += ret;
-                printf("user content is: %s\n", m_buf);
+                LOG_DEBUG("user content is: %s", m_buf);
                 // 如果遇到字符 "\r\n"，则开始处理客户请求
                 for (; idx < m_read_idx; ++idx) {
                     if (idx>=1 && m_buf[idx-1]=='\r' && m_buf[idx]=='\n') {
@@ -68,12 +304,17 @@ public:
                 m_buf[idx-1] = '\0';
 
                 char * filename = m_buf;
-                printf("filename is: %s\n", filename);
+                LOG_DEBUG("filename is: %s", filename);
                 // 判断客户要运行的CGI程序是否存在
                 if (access(filename, F_OK) == -1) {
                     remove_fd(m_epollfd, m_sockfd);
                     break;
                 }
+                // 优先交给常驻工作进程，失败时再 fork+exec
+                if (m_workers.submit(filename, m_sockfd)) {
+                    remove_fd(m_epollfd, m_sockfd);
+                    break;
+                }
                 // 创建子进程来执行CGI程序
                 ret = fork();
                 if (ret == -1) {
@@ -98,17 +339,69 @@ private:
     sockaddr_in m_address;
     char m_buf[BUFFER_SIZE];
     int m_read_idx;
+public:
+    static cgi_worker_pool m_workers;
 };
 
 int cgi_conn::m_epollfd = -1;
+cgi_worker_pool cgi_conn::m_workers;
 
 int main(int argc, char * argv[]) {
-    if (argc <= 2) {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
+    const char * name = basename(argv[0]);
+    // -w 指定以常驻模式运行的 CGI 程序（可以指定多个），-n 指定每个程序的工作进程数量
+    std::vector<const char *> programs;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:n:")) != -1) {
+        switch (opt) {
+            case 'w':
+                programs.push_back(optarg);
+                break;
+            case 'n':
+                cgi_conn::m_workers.set_worker_number(atoi(optarg));
+                break;
+            default:
+                bad_option = true;
+                break;
+        }
+    }
+    for (size_t i=0; i<programs.size(); ++i) {
+        cgi_conn::m_workers.add_program(programs[i]);
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (bad_option || argc <= 2) {
+        printf("usage: %s [-w cgi_program]... [-n workers] ip_address port_number "
+               "[notify|passfd|reuseport] [rr|least|p2c]\n", name);
         return 1;
     }
     const char * ip = argv[1];
     int port = atoi(argv[2]);
+    // 新连接的分发方式，默认由父进程 accept 后把连接传递给子进程
+    processpool<cgi_conn>::DISPATCH_MODE mode = processpool<cgi_conn>::DISPATCH_PASS_FD;
+    if (argc > 3) {
+        if (strcmp(argv[3], "notify") == 0) {
+            mode = processpool<cgi_conn>::DISPATCH_NOTIFY;
+        } else if (strcmp(argv[3], "reuseport") == 0) {
+            mode = processpool<cgi_conn>::DISPATCH_REUSEPORT;
+        } else if (strcmp(argv[3], "passfd") != 0) {
+            printf("unknown dispatch mode: %s\n", argv[3]);
+            return 1;
+        }
+    }
+    // 选择子进程的策略，默认选择负载最小的子进程
+    processpool<cgi_conn>::BALANCE_POLICY policy = processpool<cgi_conn>::BALANCE_LEAST_CONN;
+    if (argc > 4) {
+        if (strcmp(argv[4], "rr") == 0) {
+            policy = processpool<cgi_conn>::BALANCE_ROUND_ROBIN;
+        } else if (strcmp(argv[4], "p2c") == 0) {
+            policy = processpool<cgi_conn>::BALANCE_TWO_CHOICES;
+        } else if (strcmp(argv[4], "least") != 0) {
+            printf("unknown balance policy: %s\n", argv[4]);
+            return 1;
+        }
+    }
 
     sockaddr_in address;
     bzero(&address, sizeof(address));
@@ -119,14 +412,26 @@ int main(int argc, char * argv[]) {
     int listenfd = socket(PF_INET, SOCK_STREAM, 0);
     assert(listenfd >= 0);
 
-    int ret = bind(listenfd, (sockaddr *)&address, sizeof(address));
-    assert(ret != -1);
+    int ret = 0;
+    if (mode == processpool<cgi_conn>::DISPATCH_REUSEPORT) {
+        // 子进程的监听 socket 会绑定到同一地址，所以这里也要设置 SO_REUSEPORT。
+        // 这个 socket 只用来占用地址，不 listen，连接全部由子进程的 socket 接收
+        int on = 1;
+        ret = setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        assert(ret != -1);
+    }
 
-    ret = listen(listenfd, 5);
+    ret = bind(listenfd, (sockaddr *)&address, sizeof(address));
     assert(ret != -1);
 
-    processpool<cgi_conn>* pool = processpool<cgi_conn>::create(listenfd);
+    if (mode != processpool<cgi_conn>::DISPATCH_REUSEPORT) {
+        ret = listen(listenfd, 5);
+        assert(ret != -1);
+    }
+
+    processpool<cgi_conn>* pool = processpool<cgi_conn>::create(listenfd, 2, mode);
     if (pool) {
+        pool->set_balance(policy);
         pool->run();
         delete pool;
     }
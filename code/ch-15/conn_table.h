@@ -0,0 +1,137 @@
+/**
+ * @file conn_table.h
+ * @author
+ * @date 2026-10-18
+ * @brief 以文件描述符为下标的连接表
+ *
+ * 连接对象存放在 slab 中，每个 slab 容纳 SLAB_SIZE 个相邻文件描述符的对象。
+ * slab 在其中第一个连接到来时才分配，最后一个连接释放后归还（最多缓存
+ * MAX_FREE_SLABS 个空闲 slab，避免连接反复建立时频繁分配内存）。因此内存占用
+ * 只与同时存在的连接数有关，与允许的最大连接数无关。
+*/
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stdint.h>
+#include <new>
+#include <vector>
+
+template<typename T>
+class conn_table {
+public:
+    // 每个 slab 容纳的对象数量，与 m_live 的位数相同
+    static const int SLAB_SIZE = 64;
+    // 缓存的空闲 slab 的最大数量
+    static const int MAX_FREE_SLABS = 4;
+public:
+    /**
+     * @param capacity 文件描述符的上限，不小于它的文件描述符不能放入表中
+    */
+    explicit conn_table(int capacity): m_capacity(capacity), m_size(0) {}
+    ~conn_table() {
+        for (size_t i=0; i<m_slabs.size(); ++i) {
+            slab * s = m_slabs[i];
+            if (!s) {
+                continue;
+            }
+            for (int j=0; j<SLAB_SIZE; ++j) {
+                if (s->m_live & (1ULL << j)) {
+                    s->at(j)->~T();
+                }
+            }
+            delete s;
+        }
+        for (size_t i=0; i<m_free.size(); ++i) {
+            delete m_free[i];
+        }
+    }
+
+    /**
+     * @brief 为文件描述符 fd 创建一个新的连接对象，原来的对象（如果有）先被销毁
+     * @return 连接对象，fd 超出上限时返回空
+    */
+    T * acquire(int fd) {
+        if (fd < 0 || fd >= m_capacity) {
+            return nullptr;
+        }
+        size_t idx = fd / SLAB_SIZE;
+        if (idx >= m_slabs.size()) {
+            m_slabs.resize(idx + 1, nullptr);
+        }
+        slab * s = m_slabs[idx];
+        if (!s) {
+            if (!m_free.empty()) {
+                s = m_free.back();
+                m_free.pop_back();
+            } else {
+                s = new slab;
+            }
+            s->m_live = 0;
+            m_slabs[idx] = s;
+        }
+        uint64_t bit = 1ULL << (fd % SLAB_SIZE);
+        T * obj = s->at(fd % SLAB_SIZE);
+        if (s->m_live & bit) {
+            obj->~T();
+        } else {
+            s->m_live |= bit;
+            ++m_size;
+        }
+        return new (obj) T();
+    }
+
+    /**
+     * @brief 查找文件描述符 fd 对应的连接对象
+     * @return 连接对象，不存在时返回空
+    */
+    T * find(int fd) const {
+        if (fd < 0 || (size_t)(fd / SLAB_SIZE) >= m_slabs.size()) {
+            return nullptr;
+        }
+        slab * s = m_slabs[fd / SLAB_SIZE];
+        if (!s || !(s->m_live & (1ULL << (fd % SLAB_SIZE)))) {
+            return nullptr;
+        }
+        return s->at(fd % SLAB_SIZE);
+    }
+
+    /**
+     * @brief 销毁文件描述符 fd 对应的连接对象，slab 空了就归还
+    */
+    void release(int fd) {
+        T * obj = find(fd);
+        if (!obj) {
+            return;
+        }
+        obj->~T();
+        --m_size;
+        size_t idx = fd / SLAB_SIZE;
+        slab * s = m_slabs[idx];
+        s->m_live &= ~(1ULL << (fd % SLAB_SIZE));
+        if (s->m_live == 0) {
+            m_slabs[idx] = nullptr;
+            if ((int)m_free.size() < MAX_FREE_SLABS) {
+                m_free.push_back(s);
+            } else {
+                delete s;
+            }
+        }
+    }
+
+    // 表中的连接数量
+    int size() const { return m_size; }
+private:
+    struct slab {
+        T * at(int i) {
+            return reinterpret_cast<T *>(m_storage) + i;
+        }
+        alignas(T) unsigned char m_storage[sizeof(T) * SLAB_SIZE];
+        uint64_t m_live;    // 第 i 位表示第 i 个对象是否存在
+    };
+    int m_capacity;                 // 文件描述符的上限
+    int m_size;                     // 表中的连接数量
+    std::vector<slab *> m_slabs;    // 第 i 项存放文件描述符 [i*SLAB_SIZE, (i+1)*SLAB_SIZE) 的对象
+    std::vector<slab *> m_free;     // 缓存的空闲 slab
+};
+
+#endif
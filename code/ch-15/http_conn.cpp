@@ -79,7 +79,7 @@ void mod_fd(int epollfd, int fd, int ev) {
 // http_conn 类成员 BEGIN
 // ========================
 
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 int http_conn::m_epollfd = -1;
 
 /**
@@ -96,6 +96,7 @@ void http_conn::init(int sockfd, const sockaddr_in &addr) {
     #endif
     add_fd(m_epollfd, m_sockfd, true);
     m_user_count++;
+    metrics::add(metrics::ACCEPTED);
 
     init();
 }
@@ -109,6 +110,7 @@ void http_conn::close_conn(bool real_close) {
         remove_fd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
+        metrics::add(metrics::CLOSED);
     }
 }
 
@@ -116,12 +118,28 @@ void http_conn::close_conn(bool real_close) {
  * @brief 处理HTTP请求的入口函数，由线程池中的工作线程调用
 */
 void http_conn::process() {
+    long long start = metrics::now_us();
+    if (m_request_start == 0) {
+        m_request_start = start;
+    }
+    m_process_start = 0;
     HTTP_CODE read_ret = process_read();
     if (read_ret == NO_REQUEST) {
+        m_parse_us += metrics::now_us() - start;
         mod_fd(m_epollfd, m_sockfd, EPOLLIN);
         return;
     }
+    long long parsed = metrics::now_us();
+    if (read_ret == BAD_REQUEST) {
+        metrics::add(metrics::PARSE_ERRORS);
+    }
     bool write_ret = process_write(read_ret);
+    // 解析的耗时截止到 do_request 开始执行，之后的都算作处理的耗时
+    long long process_start = m_process_start ? m_process_start : parsed;
+    m_write_start = metrics::now_us();
+    metrics::record(metrics::PARSE_TIME, m_parse_us + process_start - start);
+    metrics::record(metrics::PROCESS_TIME, m_write_start - process_start);
+    metrics::count_status(m_status);
     if (!write_ret) {
         close_conn();
     }
@@ -150,6 +168,7 @@ bool http_conn::read() {
             return false;
         }
         m_read_idx += bytes_read;
+        metrics::add(metrics::BYTES_IN, bytes_read);
     }
 
     return true;
@@ -174,12 +193,17 @@ bool http_conn::write() {
                 mod_fd(m_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
+            log_access();
             unmap();
             return false;
         }
         bytes_to_send -= temp;
         bytes_have_send += temp;
+        m_bytes_sent += temp;
+        metrics::add(metrics::BYTES_OUT, temp);
         if (bytes_to_send <= bytes_have_send) {
+            metrics::record(metrics::WRITE_TIME, metrics::now_us() - m_write_start);
+            log_access();
             unmap();
             if (m_linger) {
                 init();
@@ -206,6 +230,13 @@ void http_conn::init() {
     m_host = nullptr;
     m_content_length = 0;
 
+    m_status = 0;
+    m_parse_us = 0;
+    m_process_start = 0;
+    m_write_start = 0;
+    m_request_start = 0;
+    m_bytes_sent = 0;
+
     m_read_idx = 0;
     m_checked_idx = 0;
     m_start_line = 0;
@@ -228,7 +259,7 @@ http_conn::HTTP_CODE http_conn::process_read() {
            (line_status = parse_line()) == LINE_OK ) {
         text = get_line();
         m_start_line = m_checked_idx;
-        printf("got 1 http line: %s\n", text);
+        LOG_DEBUG("got 1 http line: %s", text);
 
         switch (m_check_state) {
             case CHECK_STATE_REQUESTLINE: {
@@ -303,6 +334,16 @@ bool http_conn::process_write(HTTP_CODE ret) {
             }
             break;
         }
+        case STATS_REQUEST: {
+            add_status_line(200, ok_200_title);
+            add_headers(m_stats_body.size());
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv[1].iov_base = (void *)m_stats_body.data();
+            m_iv[1].iov_len = m_stats_body.size();
+            m_iv_count = 2;
+            return true;
+        }
         case FILE_REQUEST: {
             add_status_line(200, ok_200_title);
             if (m_file_stat.st_size != 0) {
@@ -430,7 +471,7 @@ http_conn::HTTP_CODE http_conn::parse_headers(char * text) {
         text += strspn(text, " \t");
         m_host = text;
     } else {
-        printf("oop! unknow header: %s\n", text);
+        LOG_DEBUG("oop! unknow header: %s", text);
     }
 
     return NO_REQUEST;
@@ -456,6 +497,10 @@ http_conn::HTTP_CODE http_conn::parse_content(char * text) {
  * @return 服务器处理 HTTP 请求的结果
 */
 http_conn::HTTP_CODE http_conn::do_request() {
+    m_process_start = metrics::now_us();
+    if (strncmp(m_url, "/__stats", 8) == 0) {
+        return do_stats_request();
+    }
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
     strncpy(m_real_file+len, m_url, FILENAME_LEN-len-1);
@@ -477,6 +522,23 @@ http_conn::HTTP_CODE http_conn::do_request() {
     return FILE_REQUEST;
 }
 
+/**
+ * @brief 生成服务器运行指标。/__stats 返回文本格式，/__stats?format=json
+ * 返回 JSON 格式
+ * @return 服务器处理 HTTP 请求的结果
+*/
+http_conn::HTTP_CODE http_conn::do_stats_request() {
+    const char * query = m_url + 8;
+    if (query[0] == '\0') {
+        m_stats_body = metrics::to_text();
+    } else if (strcmp(query, "?format=json") == 0) {
+        m_stats_body = metrics::to_json();
+    } else {
+        return NO_RESOURCE;
+    }
+    return STATS_REQUEST;
+}
+
 /**
  * @brief 对内存映射区执行 unmap 操作
 */
@@ -485,6 +547,21 @@ void http_conn::unmap() {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = nullptr;
     }
+    m_stats_body.clear();
+}
+
+/**
+ * @brief 把当前请求写入访问日志
+*/
+void http_conn::log_access() {
+    static const char * method_names[] = {
+        "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"
+    };
+    if (!access_log::enabled()) {
+        return;
+    }
+    access_log::record(m_address, method_names[m_method], m_url ? m_url : "-",
+                       m_status, m_bytes_sent, metrics::now_us() - m_request_start);
 }
 
 /**
@@ -524,6 +601,7 @@ bool http_conn::add_content(const char * content) {
  * @return 是否添加成功
 */
 bool http_conn::add_status_line(int status, const char * title) {
+    m_status = status;
     // Status-Line: protocol-version + status-code + status-text
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
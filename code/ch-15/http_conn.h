@@ -24,7 +24,12 @@
 #include <cstdarg>
 #include <cerrno>
 #include <cstring>
+#include <atomic>
+#include <string>
 #include "../ch-14/locker.h"
+#include "metrics.h"
+#include "async_log.h"
+#include "access_log.h"
 
 /**
  * @brief 
@@ -50,15 +55,15 @@ public:
     // 服务器处理HTTP请求的结果
     enum HTTP_CODE {
         NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST,
-        FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION
+        FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, STATS_REQUEST
     };
     // 行的读取状态
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 public:
     // 标识 epoll 内核事件表的文件描述符
     static int m_epollfd;
-    // 统计用户数量
-    static int m_user_count;
+    // 统计用户数量（主线程和工作线程都会修改它）
+    static std::atomic<int> m_user_count;
 private:
     // 该http连接的socket
     int m_sockfd;
@@ -103,6 +108,21 @@ private:
     struct iovec m_iv[2];
     // 被写内存块的数量
     int m_iv_count;
+
+    // 访问 /__stats 时生成的指标内容
+    std::string m_stats_body;
+    // 应答的状态码
+    int m_status;
+    // 解析当前请求已经花费的时间（请求可能分多次读入）
+    long long m_parse_us;
+    // do_request 开始执行的时间
+    long long m_process_start;
+    // 应答生成完毕的时间
+    long long m_write_start;
+    // 开始处理当前请求的时间
+    long long m_request_start;
+    // 当前应答已发送的字节数
+    long long m_bytes_sent;
 public:
     http_conn() {}
     ~http_conn() {}
@@ -123,12 +143,14 @@ private:
     HTTP_CODE parse_headers(char * text);
     HTTP_CODE parse_content(char * text);
     HTTP_CODE do_request();
+    HTTP_CODE do_stats_request();
     LINE_STATUS parse_line();
     char * get_line() { return m_read_buf + m_start_line; }
 
     // 这组函数被 process_write 调用以填充 HTTP 应答
 
     void unmap();
+    void log_access();
     bool add_response(const char * format, ...);
     bool add_content(const char * content);
     bool add_status_line(int status, const char * title);
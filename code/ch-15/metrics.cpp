@@ -0,0 +1,205 @@
+/**
+ * @file metrics.cpp
+ * @author
+ * @date 2026-10-18
+ * @brief WEB 服务器内置的运行指标的实现
+*/
+#include <ctime>
+#include <cstdio>
+#include "metrics.h"
+
+static const char * counter_names[metrics::COUNTER_NUMBER] = {
+    "accepted", "closed", "rejected", "requests", "parse_errors",
+    "bytes_in", "bytes_out", "status_200", "status_400", "status_403",
+    "status_404", "status_500", "status_other"
+};
+
+static const char * histogram_names[metrics::HISTOGRAM_NUMBER] = {
+    "parse_us", "process_us", "write_us"
+};
+
+/**
+ * @brief 一个线程的指标，独占若干缓存行
+*/
+struct alignas(64) metrics::shard {
+    std::atomic<long long> counters[COUNTER_NUMBER];
+    std::atomic<long long> buckets[HISTOGRAM_NUMBER][BUCKET_NUMBER];
+    std::atomic<long long> sums[HISTOGRAM_NUMBER];
+    std::atomic<long long> maxs[HISTOGRAM_NUMBER];
+};
+
+/**
+ * @brief 汇总所有分片后的直方图摘要
+*/
+struct metrics::summary {
+    long long count;
+    long long sum;
+    long long max;
+    long long p50, p90, p99;
+};
+
+// 静态存储期的对象被零初始化，所有原子变量的初值都是 0
+metrics::shard metrics::m_shards[metrics::MAX_SHARDS];
+std::atomic<int> metrics::m_next_shard(0);
+
+/**
+ * @brief 获取当前线程的分片
+*/
+metrics::shard & metrics::local_shard() {
+    static thread_local int index = -1;
+    if (index < 0) {
+        index = m_next_shard.fetch_add(1, std::memory_order_relaxed) % MAX_SHARDS;
+    }
+    return m_shards[index];
+}
+
+/**
+ * @brief 增加计数器的值
+ * @param counter 计数器
+ * @param n 增加的值
+*/
+void metrics::add(COUNTER counter, long long n) {
+    local_shard().counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 向延迟直方图中记录一个值
+ * @param histogram 直方图
+ * @param us 延迟（微秒）
+*/
+void metrics::record(HISTOGRAM histogram, long long us) {
+    if (us < 0) us = 0;
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= BUCKET_NUMBER) bucket = BUCKET_NUMBER - 1;
+    shard & s = local_shard();
+    s.buckets[histogram][bucket].fetch_add(1, std::memory_order_relaxed);
+    s.sums[histogram].fetch_add(us, std::memory_order_relaxed);
+    long long old = s.maxs[histogram].load(std::memory_order_relaxed);
+    while (us > old && !s.maxs[histogram].compare_exchange_weak(old, us,
+                                            std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief 按状态码统计应答
+ * @param status HTTP 状态码
+*/
+void metrics::count_status(int status) {
+    COUNTER counter;
+    switch (status) {
+        case 200: counter = STATUS_200; break;
+        case 400: counter = STATUS_400; break;
+        case 403: counter = STATUS_403; break;
+        case 404: counter = STATUS_404; break;
+        case 500: counter = STATUS_500; break;
+        default: counter = STATUS_OTHER; break;
+    }
+    add(counter);
+    add(REQUESTS);
+}
+
+/**
+ * @brief 获取计数器在所有分片上的总和
+*/
+long long metrics::get(COUNTER counter) {
+    long long total = 0;
+    for (int i=0; i<MAX_SHARDS; ++i) {
+        total += m_shards[i].counters[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * @brief 汇总直方图。百分位数取所在桶的上界
+*/
+void metrics::summarize(HISTOGRAM histogram, summary & s) {
+    long long buckets[BUCKET_NUMBER] = {0};
+    s.count = s.sum = s.max = 0;
+    for (int i=0; i<MAX_SHARDS; ++i) {
+        for (int j=0; j<BUCKET_NUMBER; ++j) {
+            long long n = m_shards[i].buckets[histogram][j].load(std::memory_order_relaxed);
+            buckets[j] += n;
+            s.count += n;
+        }
+        s.sum += m_shards[i].sums[histogram].load(std::memory_order_relaxed);
+        long long max = m_shards[i].maxs[histogram].load(std::memory_order_relaxed);
+        if (max > s.max) s.max = max;
+    }
+    long long * targets[3] = { &s.p50, &s.p90, &s.p99 };
+    double ranks[3] = { 0.5, 0.9, 0.99 };
+    for (int k=0; k<3; ++k) {
+        long long rank = (long long)(ranks[k] * s.count + 0.5);
+        if (rank < 1) rank = 1;
+        long long seen = 0;
+        *targets[k] = 0;
+        for (int j=0; j<BUCKET_NUMBER && s.count>0; ++j) {
+            seen += buckets[j];
+            if (seen >= rank) {
+                long long upper = j == 0 ? 0 : (1LL << j) - 1;
+                *targets[k] = upper < s.max ? upper : s.max;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief 以文本格式输出所有指标，每行一个 "名字 值"
+*/
+std::string metrics::to_text() {
+    std::string out;
+    char line[256];
+    for (int i=0; i<COUNTER_NUMBER; ++i) {
+        snprintf(line, sizeof(line), "%s %lld\n", counter_names[i],
+                 get((COUNTER)i));
+        out += line;
+    }
+    snprintf(line, sizeof(line), "active %lld\n", get(ACCEPTED) - get(CLOSED));
+    out += line;
+    for (int i=0; i<HISTOGRAM_NUMBER; ++i) {
+        summary s;
+        summarize((HISTOGRAM)i, s);
+        snprintf(line, sizeof(line), "%s count=%lld mean=%.1f p50=%lld p90=%lld "
+                 "p99=%lld max=%lld\n", histogram_names[i], s.count,
+                 s.count ? (double)s.sum / s.count : 0.0, s.p50, s.p90, s.p99,
+                 s.max);
+        out += line;
+    }
+    return out;
+}
+
+/**
+ * @brief 以 JSON 格式输出所有指标
+*/
+std::string metrics::to_json() {
+    std::string out = "{";
+    char item[256];
+    for (int i=0; i<COUNTER_NUMBER; ++i) {
+        snprintf(item, sizeof(item), "\"%s\":%lld,", counter_names[i],
+                 get((COUNTER)i));
+        out += item;
+    }
+    snprintf(item, sizeof(item), "\"active\":%lld", get(ACCEPTED) - get(CLOSED));
+    out += item;
+    for (int i=0; i<HISTOGRAM_NUMBER; ++i) {
+        summary s;
+        summarize((HISTOGRAM)i, s);
+        snprintf(item, sizeof(item), ",\"%s\":{\"count\":%lld,\"mean\":%.1f,"
+                 "\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"max\":%lld}",
+                 histogram_names[i], s.count,
+                 s.count ? (double)s.sum / s.count : 0.0, s.p50, s.p90, s.p99,
+                 s.max);
+        out += item;
+    }
+    out += "}\n";
+    return out;
+}
+
+/**
+ * @brief 获取单调时钟的当前时间（微秒）
+*/
+long long metrics::now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,63 @@
+/**
+ * @file metrics.h
+ * @author
+ * @date 2026-10-18
+ * @brief WEB 服务器内置的运行指标（计数器、仪表和延迟直方图）
+ *
+ * 每个线程第一次更新指标时被分配一个分片，之后只修改自己分片中的原子变量
+ * （relaxed 序），不同线程之间没有锁，也不会在同一缓存行上争用。读取指标时
+ * 把所有分片的值加起来即可，读到的是一个近似的快照。
+*/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+
+class metrics {
+public:
+    // 计数器
+    enum COUNTER {
+        ACCEPTED = 0,       // 接受的连接数
+        CLOSED,             // 关闭的连接数
+        REJECTED,           // 因服务器繁忙而拒绝的连接数
+        REQUESTS,           // 处理完毕的请求数
+        PARSE_ERRORS,       // 格式错误的请求数
+        BYTES_IN,           // 读取的字节数
+        BYTES_OUT,          // 发送的字节数
+        STATUS_200, STATUS_400, STATUS_403, STATUS_404, STATUS_500,
+        STATUS_OTHER,
+        COUNTER_NUMBER
+    };
+    // 延迟直方图（微秒）
+    enum HISTOGRAM {
+        PARSE_TIME = 0,     // 解析请求的耗时
+        PROCESS_TIME,       // 查找目标文件并生成应答的耗时
+        WRITE_TIME,         // 从应答生成完毕到全部发送出去的耗时
+        HISTOGRAM_NUMBER
+    };
+    // 最多的分片数量，线程数超过它时多个线程共用一个分片（仍然是正确的）
+    static const int MAX_SHARDS = 64;
+    // 直方图的桶数，第 i 个桶记录 [2^(i-1), 2^i) 微秒的值
+    static const int BUCKET_NUMBER = 32;
+public:
+    static void add(COUNTER counter, long long n = 1);
+    static void record(HISTOGRAM histogram, long long us);
+    static void count_status(int status);
+    static long long get(COUNTER counter);
+    // 以文本或 JSON 格式输出所有指标
+    static std::string to_text();
+    static std::string to_json();
+    // 获取单调时钟的当前时间（微秒）
+    static long long now_us();
+private:
+    struct shard;
+    struct summary;
+    static shard & local_shard();
+    static void summarize(HISTOGRAM histogram, summary & s);
+private:
+    static shard m_shards[MAX_SHARDS];     // 所有分片
+    static std::atomic<int> m_next_shard;  // 下一个被分配的分片
+};
+
+#endif
@@ -12,6 +12,7 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
@@ -22,16 +23,62 @@
 #include <cstdio>
 #include <cerrno>
 #include <cstring>
+#include <new>
+#include <atomic>
+#include <vector>
+#include "async_log.h"
+#include "conn_table.h"
+#include "../ch-13/fd_passing.h"
+#include "../ch-13/shm_queue.h"
 
 /**
  * @brief 描述一个子进程的类
 */
 class process {
 public:
-    process(): m_pid(-1) {}
+    process(): m_pid(-1), m_draining(false), m_start(0), m_respawn_at(0),
+               m_drain_deadline(0), m_backoff(0) {
+        m_pipefd[0] = m_pipefd[1] = -1;
+    }
 public:
-    pid_t m_pid;      // 子进程pid
-    int m_pipefd[2];  // 父子进程通信用的管道
+    pid_t m_pid;               // 子进程pid
+    int m_pipefd[2];           // 父子进程通信用的管道
+    bool m_draining;           // 是否正在退出：不再接收新连接，处理完已有连接后退出
+    long long m_start;         // 子进程的启动时间（毫秒）
+    long long m_respawn_at;    // 计划重新创建子进程的时间（毫秒），0 表示没有计划
+    long long m_drain_deadline;// 退出的最后期限（毫秒），超过后父进程发送 SIGTERM
+    int m_backoff;             // 子进程连续崩溃时，下次重新创建之前等待的时间（毫秒）
+};
+
+/**
+ * @brief 子进程的负载统计，放在父子进程共享的内存中。
+ *
+ * 子进程更新 m_active，父进程交出连接时增加 m_queued，子进程取走连接时减少
+ * m_queued。每个子进程的统计独占一个缓存行，避免子进程之间的伪共享。
+*/
+struct alignas(64) process_stat {
+    process_stat(): m_active(0), m_queued(0), m_accepted(0) {}
+    void reset() {
+        m_active.store(0);
+        m_queued.store(0);
+        m_accepted.store(0);
+    }
+    std::atomic<int> m_active;          // 子进程正在处理的连接数
+    std::atomic<int> m_queued;          // 已交给子进程但子进程还没有取走的连接数
+    std::atomic<long long> m_accepted;  // 子进程累计接收的连接数
+};
+
+/**
+ * @brief DISPATCH_NOTIFY 方式下父进程通知子进程的通道，放在父子进程共享的内存中。
+ *
+ * 父进程把通知放进队列，只在子进程空闲时写一次 eventfd，子进程每轮事件循环
+ * 取出所有通知，不再是每个新连接一次 send 和一次 recv。
+*/
+struct child_channel {
+    // 队列的容量，队列满时父进程丢弃通知，子进程处理已有的通知时会取走所有等待的连接
+    static const int CAPACITY = 1024;
+    spsc_queue<int, CAPACITY> m_commands;
+    queue_doorbell m_bell;
 };
 
 /**
@@ -39,48 +86,132 @@ public:
 */
 template<typename T>
 class processpool {
+public:
+    // 新连接的分发方式
+    enum DISPATCH_MODE {
+        // 父进程通知子进程，由子进程自己 accept
+        DISPATCH_NOTIFY = 0,
+        // 父进程批量 accept，再通过 SCM_RIGHTS 把连接交给子进程
+        DISPATCH_PASS_FD,
+        // 每个子进程用 SO_REUSEPORT 创建自己的监听 socket，由内核分发连接。
+        // 这种方式下 listenfd 只需设置 SO_REUSEPORT 并绑定地址，不要 listen，
+        // 否则内核也会把一部分连接分给这个没有进程 accept 的 socket
+        DISPATCH_REUSEPORT
+    };
 private:
-    processpool(int listenfd, int process_number=0);
+    processpool(int listenfd, int process_number=0,
+                DISPATCH_MODE mode=DISPATCH_PASS_FD);
+public:
+    // 选择子进程的策略，只用于 DISPATCH_NOTIFY 和 DISPATCH_PASS_FD
+    enum BALANCE_POLICY {
+        // 轮流分配
+        BALANCE_ROUND_ROBIN = 0,
+        // 选择活跃连接数与排队连接数之和最小的子进程
+        BALANCE_LEAST_CONN,
+        // 随机选两个子进程，取其中负载较小的一个
+        BALANCE_TWO_CHOICES
+    };
 public:
     /**
      * @brief 创建一个 processpool<T> 实例
      * @param listenfd 监听 socket 文件描述符
      * @param process_number 进程数量
+     * @param mode 新连接的分发方式
      * @return processpool<T> 指针
     */
-    static processpool<T>* create(int listenfd, int process_number=2) {
+    static processpool<T>* create(int listenfd, int process_number=2,
+                                  DISPATCH_MODE mode=DISPATCH_PASS_FD) {
         if (!m_instance) {
-            m_instance = new processpool<T>(listenfd, process_number);
+            m_instance = new processpool<T>(listenfd, process_number, mode);
         }
         return m_instance;
     }
 
     ~processpool() {
         delete [] m_sub_process;
+        munmap(m_stats, sizeof(process_stat) * m_slot_number);
+        if (m_channels) {
+            munmap(m_channels, sizeof(child_channel) * m_slot_number);
+        }
     }
 
     void run();
+    void set_balance(BALANCE_POLICY policy) {
+        m_balance = policy;
+    }
+    int load(int idx) const {
+        return m_stats[idx].m_active.load(std::memory_order_relaxed)
+               + m_stats[idx].m_queued.load(std::memory_order_relaxed);
+    }
+    void dump_stats() const;
 private:
     void setup_sig_pipe();
     void run_parent();
     void run_child();
+    pid_t spawn_child(int idx);
+    void reap_children();
+    void reload();
+    void drain_child(int idx, long long now);
+    void run_timers();
+    int next_timeout() const;
+    void stop_accepting(int & pipefd, conn_table<T> & users);
+    void release_closed(conn_table<T> & users);
+    bool serving(int idx) const {
+        return m_sub_process[idx].m_pid != -1 && !m_sub_process[idx].m_draining;
+    }
+    int next_child(int & counter);
+    int select_child(int & counter, const int * pending);
+    void dispatch_conns(int & counter);
+    bool take_conns(int pipefd, conn_table<T> & users);
+    void take_notified(conn_table<T> & users);
+    void accept_conns(conn_table<T> & users);
+    int create_reuseport_listener();
 private:
-    // 进程池允许的最大子进程数量
+    // 进程池允许的最大子进程数量至少是这个值，CPU 核数更多时等于核数
     static const int MAX_PROCESS_NUMBER = 16;
-    // 每个子进程最多能处理的客户数量
+    // 子进程崩溃后重新创建之前的最短和最长等待时间（毫秒）
+    static const int RESPAWN_MIN_BACKOFF = 100;
+    static const int RESPAWN_MAX_BACKOFF = 10000;
+    // 子进程运行超过这个时间（毫秒）后退出，不再视为连续崩溃，等待时间恢复为最短
+    static const int STABLE_UPTIME = 5000;
+    // 重新加载时旧子进程处理完已有连接的最长时间（毫秒）
+    static const int DRAIN_TIMEOUT = 30000;
+    // 每个子进程中连接的文件描述符的上限。连接对象按需分配（见 conn_table.h），
+    // 这个值不影响内存占用
     static const int USER_PER_PROCESS = 65536;
     // epoll 最多能处理的事件数
     static const int MAX_EVENT_NUMBER = 10000;
+    // 父进程一批最多 accept 的连接数
+    static const int MAX_ACCEPT_BATCH = 64;
     // 进程池中的进程总数
     int m_process_number;
+    // 子进程槽位数量。重新加载时新旧子进程同时存在，所以是子进程数量的两倍
+    int m_slot_number;
     // 子进程在进程池中的序号（0-index）
     int m_idx;
     // 进程的 epoll 内核时间表
     int m_epollfd;
     // 监听 socket
     int m_listenfd;
+    // 新连接的分发方式
+    DISPATCH_MODE m_mode;
+    // 选择子进程的策略
+    BALANCE_POLICY m_balance;
+    // 所有子进程的负载统计，位于共享内存中
+    process_stat * m_stats;
+    // DISPATCH_NOTIFY 方式下通知子进程的通道，位于共享内存中，其他方式下为空
+    child_channel * m_channels;
+    // BALANCE_TWO_CHOICES 使用的随机数状态
+    unsigned int m_seed;
+    // dispatch_conns 中按子进程分组的连接
+    std::vector<fd_batch> m_batches;
+    std::vector<int> m_batch_counts;
+    // select_child 中正在服务的子进程
+    std::vector<int> m_alive;
     // 进程通过 m_stop 来决定是否停止运行
     int m_stop;
+    // 父进程收到 SIGTERM 或 SIGINT 后不再重新创建子进程，等所有子进程退出后停止
+    bool m_terminating;
     // 保存所有子进程的描述信息
     process * m_sub_process;
     // 进程池静态实例
@@ -93,6 +224,21 @@ processpool<T>* processpool<T>::m_instance = nullptr;
 // 用于处理信号的管道，以实现统一事件源。后面称为“信号管道”。
 static int sig_pipefd[2];
 
+// 子进程自己的负载统计，父进程中为空
+static process_stat * child_stat = nullptr;
+// 子进程中被 remove_fd 关闭、还没有释放连接对象的文件描述符。连接对象通常在
+// 自己的 process 方法中调用 remove_fd，所以要等 process 返回后再释放
+static std::vector<int> closed_conns;
+
+/**
+ * @brief 获取单调时钟的当前时间（毫秒）
+*/
+static long long current_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 /**
  * @brief 将指定文件描述符设为非阻塞的
  * @param fd 文件描述符
@@ -126,6 +272,11 @@ static void add_fd(int epollfd, int fd) {
 static void remove_fd(int epollfd, int fd) {
     epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, nullptr);
     close(fd);
+    // 逻辑处理对象都通过 remove_fd 关闭连接，子进程借此统计活跃连接数
+    if (child_stat) {
+        child_stat->m_active.fetch_sub(1, std::memory_order_relaxed);
+        closed_conns.push_back(fd);
+    }
 }
 
 /**
@@ -163,30 +314,105 @@ static void add_sig(int sig, void(*handler)(int), bool restart=true) {
  * @param process_number 进程数量
 */
 template<typename T>
-processpool<T>::processpool(int listenfd, int process_number)
-: m_listenfd(listenfd), m_process_number(process_number), 
-  m_idx(-1), m_stop(false) {
-    assert((process_number>0) && (process_number<=MAX_PROCESS_NUMBER));
+processpool<T>::processpool(int listenfd, int process_number, DISPATCH_MODE mode)
+: m_process_number(process_number), m_idx(-1), m_listenfd(listenfd),
+  m_mode(mode), m_balance(BALANCE_LEAST_CONN), m_stop(false),
+  m_terminating(false) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_process_number = cpus > MAX_PROCESS_NUMBER ? (int)cpus : MAX_PROCESS_NUMBER;
+    assert((process_number>0) && (process_number<=max_process_number));
+    m_slot_number = 2 * process_number;
+    m_alive.resize(m_slot_number);
+    if (mode == DISPATCH_PASS_FD) {
+        m_batches.resize(m_slot_number);
+        m_batch_counts.resize(m_slot_number);
+    }
+
+    // 负载统计必须在 fork 之前映射，父子进程才能共享
+    void * mem = mmap(nullptr, sizeof(process_stat) * m_slot_number,
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(mem != MAP_FAILED);
+    m_stats = new (mem) process_stat[m_slot_number];
+    m_channels = nullptr;
+    if (mode == DISPATCH_NOTIFY) {
+        mem = mmap(nullptr, sizeof(child_channel) * m_slot_number,
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        assert(mem != MAP_FAILED);
+        m_channels = new (mem) child_channel[m_slot_number];
+    }
+    m_seed = getpid();
 
-    m_sub_process = new process[process_number];
+    m_sub_process = new process[m_slot_number];
     assert(m_sub_process);
 
     // 创建 process_number 个子进程，并创建它们和父进程之间的管道
     for (int i=0; i<process_number; ++i) {
-        int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_sub_process[i].m_pipefd);
-        assert(ret == 0);
+        pid_t pid = spawn_child(i);
+        assert(pid >= 0);
+        if (pid == 0) {
+            break;
+        }
+    }
+}
 
-        m_sub_process[i].m_pid = fork();
-        assert(m_sub_process[i].m_pid >= 0);
-        if (m_sub_process[i].m_pid > 0) {
-            close(m_sub_process[i].m_pipefd[1]);
-            continue;
-        } else {
+/**
+ * @brief 在槽位 idx 上创建一个子进程，以及它和父进程之间的管道
+ * @param idx 槽位序号
+ * @return 在父进程中返回子进程的 pid，在子进程中返回 0，失败时返回 -1
+*/
+template<typename T>
+pid_t processpool<T>::spawn_child(int idx) {
+    process & child = m_sub_process[idx];
+    // 传递连接时用 SOCK_SEQPACKET 保持消息边界，使每批连接的地址和文件描述符
+    // 在同一条消息中
+    int type = m_mode == DISPATCH_PASS_FD ? SOCK_SEQPACKET : SOCK_STREAM;
+    if (socketpair(PF_UNIX, type, 0, child.m_pipefd) < 0) {
+        return -1;
+    }
+    m_stats[idx].reset();
+    if (m_channels) {
+        m_channels[idx].m_commands.init();
+        if (!m_channels[idx].m_bell.init()) {
+            close(child.m_pipefd[0]);
+            close(child.m_pipefd[1]);
+            child.m_pipefd[0] = child.m_pipefd[1] = -1;
+            return -1;
+        }
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(child.m_pipefd[0]);
+        close(child.m_pipefd[1]);
+        child.m_pipefd[0] = child.m_pipefd[1] = -1;
+        if (m_channels) {
+            m_channels[idx].m_bell.destroy();
+        }
+        return -1;
+    } else if (pid > 0) {
+        close(child.m_pipefd[1]);
+        child.m_pipefd[1] = -1;
+        child.m_pid = pid;
+        child.m_draining = false;
+        child.m_respawn_at = 0;
+        child.m_start = current_ms();
+        return pid;
+    }
+
+    // 子进程只保留自己的管道
+    close(child.m_pipefd[0]);
+    for (int i=0; i<m_slot_number; ++i) {
+        if (i != idx && m_sub_process[i].m_pipefd[0] >= 0) {
             close(m_sub_process[i].m_pipefd[0]);
-            m_idx = i;
-            break;
+        }
+        // 通道在共享内存中，只能关闭自己的文件描述符，不能调用 destroy
+        if (i != idx && m_channels && m_channels[i].m_bell.fd() >= 0) {
+            close(m_channels[i].m_bell.fd());
         }
     }
+    m_idx = idx;
+    child_stat = &m_stats[idx];
+    return 0;
 }
 
 /**
@@ -206,6 +432,9 @@ void processpool<T>::setup_sig_pipe() {
     add_sig(SIGCHLD, sig_handler);
     add_sig(SIGTERM, sig_handler);
     add_sig(SIGINT, sig_handler);
+    add_sig(SIGUSR1, sig_handler);
+    add_sig(SIGHUP, sig_handler);
+    add_sig(SIGUSR2, sig_handler);
     add_sig(SIGPIPE, SIG_IGN);
 }
 
@@ -214,11 +443,13 @@ void processpool<T>::setup_sig_pipe() {
 */
 template<typename T>
 void processpool<T>::run() {
+    if (m_idx == -1) {
+        run_parent();
+    }
+    // 子进程可能是在构造函数中创建的，也可能是父进程在 run_parent 中重新创建的
     if (m_idx != -1) {
         run_child();
-        return;
     }
-    run_parent();
 }
 
 template<typename T>
@@ -227,42 +458,69 @@ void processpool<T>::run_child() {
 
     // 每个子进程通过其在进程池中的序号 m_idx 找到与父进程通信的管道
     int pipefd = m_sub_process[m_idx].m_pipefd[1];
-    // 子进程需要监听管道文件描述符 pipefd, 因为父进程将通过管道来通知子进程 accept 新连接
+    // 子进程需要监听管道文件描述符 pipefd, 因为父进程将通过管道来通知子进程 accept 新连接，
+    // 或者把新连接直接传递过来
     add_fd(m_epollfd, pipefd);
+    // 通知方式下父进程通过共享内存中的队列发送通知，空闲时用 eventfd 唤醒子进程
+    queue_doorbell * bell = m_channels ? &m_channels[m_idx].m_bell : nullptr;
+    if (bell) {
+        add_fd(m_epollfd, bell->fd());
+    }
+    // SO_REUSEPORT 方式下子进程使用自己的监听 socket
+    if (m_mode == DISPATCH_REUSEPORT) {
+        m_listenfd = create_reuseport_listener();
+        assert(m_listenfd >= 0);
+        add_fd(m_epollfd, m_listenfd);
+    }
 
     epoll_event events[MAX_EVENT_NUMBER];
-    T* users = new T[USER_PER_PROCESS];
-    assert(users);
+    conn_table<T> users(USER_PER_PROCESS);
     int number = 0;
     int ret = -1;
 
     while (!m_stop) {
-        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        int timeout = -1;
+        if (bell && pipefd >= 0) {
+            // 登记之后再检查一次队列，父进程在登记之前放入的通知不会唤醒我们
+            bell->prepare_wait();
+            if (!m_channels[m_idx].m_commands.empty()) {
+                timeout = 0;
+            }
+        }
+        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, timeout);
+        if (bell) {
+            bell->cancel_wait();
+        }
         if (number < 0 && errno != EINTR) {
-            printf("epoll failure\n");
+            LOG_ERROR("epoll failure");
             break;
         }
+        if (bell && pipefd >= 0) {
+            take_notified(users);
+        }
 
         for (int i=0; i<number; ++i) {
             int sockfd = events[i].data.fd;
-            if ((sockfd == pipefd) && (events[i].events & EPOLLIN)) {
-                int client = 0;
-                // 从父子进程之间的管道读取数据，并将结果保存在变量 client 中。
-                // 如果读取成功，则表示有新客户连接到来。
-                ret = recv(pipefd, (char *)&client, sizeof(client), 0);
-                if ((ret < 0 && errno != EAGAIN) || ret == 0) {
-                    continue;
+            if ((sockfd == pipefd) && (events[i].events & EPOLLIN)
+                && m_mode == DISPATCH_PASS_FD) {
+                // 父进程关闭了管道，表示这个子进程要被替换
+                if (!take_conns(pipefd, users)) {
+                    stop_accepting(pipefd, users);
                 }
-                struct sockaddr_in client_addr;
-                socklen_t client_addr_len = sizeof(client_addr);
-                int connfd = accept(m_listenfd, (sockaddr *)&client_addr,
-                                &client_addr_len);
-                if (connfd < 0) {
-                    printf("errno is: %d\n", errno);
-                    continue;
+            }
+            else if ((sockfd == m_listenfd) && m_mode == DISPATCH_REUSEPORT) {
+                accept_conns(users);
+            }
+            else if (bell && sockfd == bell->fd()) {
+                bell->clear();
+            }
+            else if ((sockfd == pipefd) && (events[i].events & EPOLLIN)) {
+                // 通知方式下管道上不再有数据，读到 EOF 说明父进程要替换这个子进程
+                char buf[64];
+                ret = recv(pipefd, buf, sizeof(buf), 0);
+                if (ret == 0) {
+                    stop_accepting(pipefd, users);
                 }
-                add_fd(m_epollfd, connfd);
-                users[connfd].init(m_epollfd, connfd, client_addr);
             }
             // 处理信号
             else if ((sockfd == sig_pipefd[0]) && (events[i].events & EPOLLIN)) {
@@ -292,26 +550,70 @@ void processpool<T>::run_child() {
             }
             // 客户请求到来。调用逻辑处理对象的 process 方法处理。
             else if (events[i].events & EPOLLIN) {
-                users[sockfd].process();
-            }
-            else {
-                continue;
+                T * conn = users.find(sockfd);
+                if (conn) {
+                    conn->process();
+                }
             }
+            release_closed(users);
+        }
+
+        // 正在退出的子进程处理完所有连接后结束
+        if (pipefd < 0 && child_stat->m_active.load(std::memory_order_relaxed) <= 0) {
+            m_stop = true;
         }
     }
 
-    delete [] users;
-    users = nullptr;
-    close(pipefd);
+    if (m_mode == DISPATCH_REUSEPORT && m_listenfd >= 0) {
+        close(m_listenfd);
+    }
+    if (pipefd >= 0) {
+        close(pipefd);
+    }
     close(m_epollfd);
 }
 
+/**
+ * @brief 释放已经被 remove_fd 关闭的连接的逻辑处理对象
+ * @param users 连接表
+*/
+template<typename T>
+void processpool<T>::release_closed(conn_table<T> & users) {
+    for (size_t i=0; i<closed_conns.size(); ++i) {
+        users.release(closed_conns[i]);
+    }
+    closed_conns.clear();
+}
+
+/**
+ * @brief 子进程不再接收新连接，已有的连接继续处理，处理完后子进程退出
+ * @param pipefd 与父进程通信的管道，关闭后置为 -1
+ * @param users 连接表
+*/
+template<typename T>
+void processpool<T>::stop_accepting(int & pipefd, conn_table<T> & users) {
+    LOG_INFO("child [%d] draining %d connections", m_idx,
+             child_stat->m_active.load(std::memory_order_relaxed));
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, pipefd, nullptr);
+    close(pipefd);
+    pipefd = -1;
+    // 关闭 SO_REUSEPORT 监听 socket 之前先取走已经排队的连接，否则它们会被内核重置
+    if (m_mode == DISPATCH_REUSEPORT) {
+        accept_conns(users);
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, nullptr);
+        close(m_listenfd);
+        m_listenfd = -1;
+    }
+}
+
 template<typename T>
 void processpool<T>::run_parent() {
     setup_sig_pipe();
 
-    // 父进程监听 m_listenfd
-    add_fd(m_epollfd, m_listenfd);
+    // 父进程监听 m_listenfd。SO_REUSEPORT 方式下由子进程各自监听，父进程只管理子进程
+    if (m_mode != DISPATCH_REUSEPORT) {
+        add_fd(m_epollfd, m_listenfd);
+    }
 
     epoll_event events[MAX_EVENT_NUMBER];
     int sub_process_counter = 0;
@@ -319,33 +621,37 @@ void processpool<T>::run_parent() {
     int number = 0;
     int ret = -1;
 
-    while (!m_stop) {
-        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+    // 父进程中重新创建子进程时，新的子进程会从 spawn_child 返回到这里，
+    // 它设置了 m_idx，据此跳出循环，回到 run 中运行 run_child
+    while (!m_stop && m_idx == -1) {
+        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, next_timeout());
         if (number < 0 && errno != EINTR) {
-            printf("epoll failure\n");
+            LOG_ERROR("epoll failure");
             break;
         }
 
-        for (int i=0; i<number; ++i) {
+        for (int i=0; i<number && m_idx == -1; ++i) {
             int sockfd = events[i].data.fd;
-            if (sockfd == m_listenfd) {
-                // 如果有新连接到来，就采用 Round Robin 方式将其分配给一个子进程处理
-                int i = sub_process_counter;
-                do {
-                    if (m_sub_process[i].m_pid != -1) {
-                        break;
-                    }
-                    i = (i+1)%m_process_number;
-                } while (i != sub_process_counter);
-                if (m_sub_process[i].m_pid == -1) {
-                    m_stop = true;
-                    break;
+            if (sockfd == m_listenfd && m_mode == DISPATCH_PASS_FD) {
+                dispatch_conns(sub_process_counter);
+            }
+            else if (sockfd == m_listenfd) {
+                // 如果有新连接到来，就按 m_balance 选择一个子进程处理。
+                // 没有可用的子进程（都在等待重新创建）时，连接留在监听队列中
+                int i = select_child(sub_process_counter, nullptr);
+                if (i < 0) {
+                    continue;
                 }
-                sub_process_counter = (i+1)%m_process_number;
 
-                send(m_sub_process[i].m_pipefd[0], (char *)&new_conn,
-                    sizeof(new_conn), 0);
-                printf("send request to child [%d]\n", i);
+                m_stats[i].m_queued.fetch_add(1, std::memory_order_relaxed);
+                child_channel & channel = m_channels[i];
+                if (!channel.m_commands.push(new_conn)) {
+                    m_stats[i].m_queued.fetch_sub(1, std::memory_order_relaxed);
+                    LOG_WARN("child [%d] command queue full", i);
+                    continue;
+                }
+                channel.m_bell.ring();
+                LOG_DEBUG("send request to child [%d]", i);
             }
             // 处理信号
             else if ((sockfd == sig_pipefd[0]) && (events[i].events & EPOLLIN)) {
@@ -355,35 +661,35 @@ void processpool<T>::run_parent() {
                 if (ret <= 0) {
                     continue;
                 }
-                for (int i=0; i<ret; ++i) {
+                for (int i=0; i<ret && m_idx == -1; ++i) {
                     switch (signals[i]) {
                         case SIGCHLD: {
-                            pid_t pid;
-                            int stat;
-                            while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
-                                for (int i=0; i<m_process_number; ++i) {
-                                    if (pid == m_sub_process[i].m_pid) {
-                                        printf("child [%d] join\n", i);
-                                        close(m_sub_process[i].m_pipefd[0]);
-                                        m_sub_process[i].m_pid = -1;
-                                    }
-                                }
-                            }
-                            m_stop = true;
-                            for (int i=0; i<m_process_number; ++i) {
-                                if (m_sub_process[i].m_pid != -1) {
-                                    m_stop = false;
-                                } 
+                            reap_children();
+                            break;
+                        }
+                        case SIGUSR1: {
+                            dump_stats();
+                            break;
+                        }
+                        // 平滑重新加载：先创建新的子进程，再让旧的子进程处理完已有连接后退出
+                        case SIGHUP:
+                        case SIGUSR2: {
+                            if (!m_terminating) {
+                                reload();
                             }
                             break;
                         }
                         case SIGTERM:
                         case SIGINT: {
-                            printf("kill all child now\n");
-                            for (int i=0; i<m_process_number; ++i) {
+                            LOG_INFO("kill all child now");
+                            m_terminating = true;
+                            m_stop = true;
+                            for (int i=0; i<m_slot_number; ++i) {
+                                m_sub_process[i].m_respawn_at = 0;
                                 int pid = m_sub_process[i].m_pid;
                                 if (pid != -1) {
                                     kill(pid, SIGTERM);
+                                    m_stop = false;
                                 }
                             }
                             break;
@@ -395,9 +701,473 @@ void processpool<T>::run_parent() {
                 continue;
             }
         }
+
+        if (m_idx == -1) {
+            run_timers();
+        }
     }
 
     close(m_epollfd);
+    if (m_idx != -1) {
+        close(sig_pipefd[0]);
+        close(sig_pipefd[1]);
+    }
+}
+
+/**
+ * @brief 回收退出的子进程。意外退出的子进程按退避时间重新创建：连续崩溃时等待时间
+ * 从 RESPAWN_MIN_BACKOFF 开始加倍，最长 RESPAWN_MAX_BACKOFF。
+*/
+template<typename T>
+void processpool<T>::reap_children() {
+    pid_t pid;
+    int stat;
+    while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
+        for (int i=0; i<m_slot_number; ++i) {
+            process & child = m_sub_process[i];
+            if (pid != child.m_pid) {
+                continue;
+            }
+            if (child.m_pipefd[0] >= 0) {
+                close(child.m_pipefd[0]);
+                child.m_pipefd[0] = -1;
+            }
+            if (m_channels) {
+                m_channels[i].m_bell.destroy();
+            }
+            child.m_pid = -1;
+            if (child.m_draining || m_terminating) {
+                LOG_INFO("child [%d] join", i);
+                child.m_draining = false;
+                break;
+            }
+            long long now = current_ms();
+            if (now - child.m_start >= STABLE_UPTIME || child.m_backoff == 0) {
+                child.m_backoff = RESPAWN_MIN_BACKOFF;
+            } else if (child.m_backoff < RESPAWN_MAX_BACKOFF) {
+                child.m_backoff = child.m_backoff * 2 < RESPAWN_MAX_BACKOFF ?
+                                  child.m_backoff * 2 : RESPAWN_MAX_BACKOFF;
+            }
+            child.m_respawn_at = now + child.m_backoff;
+            LOG_WARN("child [%d] pid %d exited with status %d, respawn in %d ms",
+                     i, (int)pid, stat, child.m_backoff);
+            break;
+        }
+    }
+
+    if (m_terminating) {
+        m_stop = true;
+        for (int i=0; i<m_slot_number; ++i) {
+            if (m_sub_process[i].m_pid != -1) {
+                m_stop = false;
+            }
+        }
+    }
+}
+
+/**
+ * @brief 平滑重新加载：为每个正在服务的子进程在空闲槽位上创建一个新的子进程，
+ * 全部创建完成后再关闭通往旧子进程的管道，旧子进程处理完已有连接后退出。
+ * 监听 socket 一直由父进程持有，重新加载期间不会拒绝连接。
+*/
+template<typename T>
+void processpool<T>::reload() {
+    std::vector<int> old(m_slot_number);
+    int old_number = 0;
+    for (int i=0; i<m_slot_number; ++i) {
+        if (serving(i) || m_sub_process[i].m_respawn_at) {
+            old[old_number++] = i;
+        }
+    }
+
+    // 新的子进程占用空闲的槽位：没有进程、没有在退出、也没有计划重新创建
+    int slot = 0;
+    for (int n=0; n<old_number; ++n) {
+        while (slot < m_slot_number
+               && (m_sub_process[slot].m_pid != -1 || m_sub_process[slot].m_respawn_at)) {
+            ++slot;
+        }
+        if (slot == m_slot_number) {
+            LOG_WARN("no free slot to reload child [%d], keep it", old[n]);
+            old[n] = -1;
+            continue;
+        }
+        pid_t pid = spawn_child(slot);
+        if (pid == 0) {
+            return;
+        } else if (pid < 0) {
+            LOG_ERROR("reload child [%d] failure, errno is: %d", old[n], errno);
+            old[n] = -1;
+            continue;
+        }
+        LOG_INFO("child [%d] pid %d replaces child [%d]", slot, (int)pid, old[n]);
+    }
+
+    long long now = current_ms();
+    for (int n=0; n<old_number; ++n) {
+        if (old[n] >= 0) {
+            drain_child(old[n], now);
+        }
+    }
+}
+
+/**
+ * @brief 让子进程不再接收新连接，处理完已有连接后退出
+ * @param idx 子进程的槽位序号
+ * @param now 当前时间（毫秒）
+*/
+template<typename T>
+void processpool<T>::drain_child(int idx, long long now) {
+    process & child = m_sub_process[idx];
+    // 还在等待重新创建的槽位直接释放
+    child.m_respawn_at = 0;
+    if (child.m_pid == -1) {
+        return;
+    }
+    // 子进程读到管道关闭后停止接收连接
+    close(child.m_pipefd[0]);
+    child.m_pipefd[0] = -1;
+    child.m_draining = true;
+    child.m_drain_deadline = now + DRAIN_TIMEOUT;
+}
+
+/**
+ * @brief 重新创建到期的子进程，终止超时仍未退出的旧子进程
+*/
+template<typename T>
+void processpool<T>::run_timers() {
+    long long now = current_ms();
+    for (int i=0; i<m_slot_number; ++i) {
+        process & child = m_sub_process[i];
+        if (child.m_respawn_at && child.m_respawn_at <= now) {
+            pid_t pid = spawn_child(i);
+            if (pid == 0) {
+                return;
+            } else if (pid < 0) {
+                LOG_ERROR("respawn child [%d] failure, errno is: %d", i, errno);
+                child.m_respawn_at = now + RESPAWN_MAX_BACKOFF;
+            } else {
+                LOG_INFO("child [%d] respawned, pid %d", i, (int)pid);
+            }
+        }
+        if (child.m_draining && child.m_pid != -1 && child.m_drain_deadline <= now) {
+            LOG_WARN("child [%d] pid %d drain timeout", i, (int)child.m_pid);
+            kill(child.m_pid, SIGTERM);
+            child.m_drain_deadline = now + DRAIN_TIMEOUT;
+        }
+    }
+}
+
+/**
+ * @brief 计算 epoll_wait 的超时时间
+ * @return 距离最近一个重新创建或退出期限的毫秒数，没有时返回 -1
+*/
+template<typename T>
+int processpool<T>::next_timeout() const {
+    long long now = current_ms();
+    long long next = -1;
+    for (int i=0; i<m_slot_number; ++i) {
+        const process & child = m_sub_process[i];
+        long long when = -1;
+        if (child.m_respawn_at) {
+            when = child.m_respawn_at;
+        } else if (child.m_draining && child.m_pid != -1) {
+            when = child.m_drain_deadline;
+        }
+        if (when >= 0 && (next < 0 || when < next)) {
+            next = when;
+        }
+    }
+    if (next < 0) {
+        return -1;
+    }
+    return next > now ? (int)(next - now) : 0;
+}
+
+/**
+ * @brief 采用 Round Robin 方式选择一个正在服务的子进程
+ * @param counter 轮转计数器，返回时指向下一个子进程
+ * @return 子进程的槽位序号，没有正在服务的子进程时返回 -1
+*/
+template<typename T>
+int processpool<T>::next_child(int & counter) {
+    int i = counter;
+    do {
+        if (serving(i)) {
+            break;
+        }
+        i = (i+1)%m_slot_number;
+    } while (i != counter);
+    if (!serving(i)) {
+        return -1;
+    }
+    counter = (i+1)%m_slot_number;
+    return i;
+}
+
+/**
+ * @brief 按 m_balance 选择一个正在服务的子进程
+ * @param counter 轮转计数器，负载相同时从它指向的子进程开始选，使空闲时连接也能均匀分布
+ * @param pending 本批次中已经分给各子进程、但还没有发送出去的连接数，可以为空
+ * @return 子进程的槽位序号，没有正在服务的子进程时返回 -1
+*/
+template<typename T>
+int processpool<T>::select_child(int & counter, const int * pending) {
+    if (m_balance == BALANCE_ROUND_ROBIN) {
+        return next_child(counter);
+    }
+
+    int * alive = &m_alive[0];
+    int alive_number = 0;
+    for (int n=0; n<m_slot_number; ++n) {
+        int i = (counter+n)%m_slot_number;
+        if (serving(i)) {
+            alive[alive_number++] = i;
+        }
+    }
+    if (alive_number == 0) {
+        return -1;
+    }
+
+    int best = -1;
+    if (m_balance == BALANCE_TWO_CHOICES && alive_number > 2) {
+        int ia = rand_r(&m_seed)%alive_number;
+        int ib = (ia + 1 + rand_r(&m_seed)%(alive_number-1))%alive_number;
+        int a = alive[ia];
+        int b = alive[ib];
+        int load_a = load(a) + (pending ? pending[a] : 0);
+        int load_b = load(b) + (pending ? pending[b] : 0);
+        best = load_b < load_a ? b : a;
+    } else {
+        int best_load = 0;
+        for (int n=0; n<alive_number; ++n) {
+            int i = alive[n];
+            int l = load(i) + (pending ? pending[i] : 0);
+            if (best < 0 || l < best_load) {
+                best = i;
+                best_load = l;
+            }
+        }
+    }
+    counter = (best+1)%m_slot_number;
+    return best;
+}
+
+/**
+ * @brief 输出每个子进程的负载（父进程收到 SIGUSR1 时调用）
+*/
+template<typename T>
+void processpool<T>::dump_stats() const {
+    for (int i=0; i<m_slot_number; ++i) {
+        const process & child = m_sub_process[i];
+        if (child.m_pid == -1 && !child.m_respawn_at) {
+            continue;
+        }
+        LOG_INFO("child [%d] pid %d%s active %d queued %d accepted %lld", i,
+                 (int)child.m_pid, child.m_draining ? " draining" : "",
+                 m_stats[i].m_active.load(std::memory_order_relaxed),
+                 m_stats[i].m_queued.load(std::memory_order_relaxed),
+                 m_stats[i].m_accepted.load(std::memory_order_relaxed));
+    }
+}
+
+/**
+ * @brief 父进程 accept 所有已完成握手的连接，并把它们交给子进程。
+ *
+ * 每次最多 accept MAX_ACCEPT_BATCH 个连接，先按子进程分组，再用一条 sendmsg 把
+ * 同一个子进程的连接一起发送过去，之后父进程关闭自己持有的副本。监听 socket 是
+ * ET 模式，所以要一直 accept 到 EAGAIN 为止。
+ * @param counter 轮转计数器
+*/
+template<typename T>
+void processpool<T>::dispatch_conns(int & counter) {
+    int * counts = &m_batch_counts[0];
+    bool drained = false;
+
+    while (!drained) {
+        memset(counts, 0, sizeof(int) * m_slot_number);
+        for (int n=0; n<MAX_ACCEPT_BATCH; ++n) {
+            sockaddr_in client_addr;
+            socklen_t client_addr_len = sizeof(client_addr);
+            int connfd = accept4(m_listenfd, (sockaddr *)&client_addr,
+                                 &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (connfd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    LOG_ERROR("accept failure, errno is: %d", errno);
+                }
+                drained = true;
+                break;
+            }
+            int i = select_child(counter, counts);
+            if (i < 0) {
+                // 所有子进程都在等待重新创建，只能拒绝连接
+                LOG_WARN("no child available, drop connection");
+                close(connfd);
+                continue;
+            }
+            m_batches[i].add(connfd, (sockaddr *)&client_addr, client_addr_len);
+            ++counts[i];
+        }
+
+        for (int i=0; i<m_slot_number; ++i) {
+            if (counts[i] == 0) {
+                continue;
+            }
+            m_stats[i].m_queued.fetch_add(counts[i], std::memory_order_relaxed);
+            fd_batch & batch = m_batches[i];
+            if (batch.send(m_sub_process[i].m_pipefd[0]) != 1) {
+                LOG_ERROR("pass %d connections to child [%d] failed, errno is: %d",
+                          counts[i], i, errno);
+                m_stats[i].m_queued.fetch_sub(counts[i], std::memory_order_relaxed);
+            } else {
+                LOG_DEBUG("pass %d connections to child [%d]", counts[i], i);
+            }
+            batch.close_all();
+            batch.clear();
+        }
+    }
+}
+
+/**
+ * @brief 子进程接收父进程传递过来的连接，直到管道中没有数据为止
+ * @param pipefd 与父进程通信的管道
+ * @param users 连接表
+ * @return 父进程关闭了管道时返回 false
+*/
+template<typename T>
+bool processpool<T>::take_conns(int pipefd, conn_table<T> & users) {
+    // fd_batch 有几十 KB，不放在栈上
+    static fd_batch batch;
+    int ret;
+    while ((ret = batch.recv(pipefd)) > 0) {
+        int number = batch.size();
+        if (batch.dropped() > 0) {
+            // 文件描述符用完时内核截断了辅助数据，被截掉的连接已经由内核关闭
+            LOG_WARN("%d passed connections dropped", batch.dropped());
+        }
+        child_stat->m_queued.fetch_sub(number + batch.dropped(), std::memory_order_relaxed);
+        child_stat->m_accepted.fetch_add(number, std::memory_order_relaxed);
+        for (int i=0; i<number; ++i) {
+            int fd = batch.fd(i);
+            T * conn = users.acquire(fd);
+            if (!conn) {
+                close(fd);
+                continue;
+            }
+            sockaddr_in client_addr;
+            memset(&client_addr, 0, sizeof(client_addr));
+            socklen_t addr_len = batch.peer_len(i);
+            memcpy(&client_addr, batch.peer(i),
+                   addr_len < sizeof(client_addr) ? addr_len : sizeof(client_addr));
+            child_stat->m_active.fetch_add(1, std::memory_order_relaxed);
+            add_fd(m_epollfd, fd);
+            conn->init(m_epollfd, fd, client_addr);
+        }
+    }
+    return ret == 0;
+}
+
+/**
+ * @brief 通知方式下子进程取出父进程的所有通知，然后 accept 监听队列中的所有连接
+ *
+ * 父进程以 ET 模式监听，几个连接几乎同时到达时只收到一次事件、发出一条通知，
+ * 所以收到通知后要 accept 到 EAGAIN 为止，否则多出来的连接要等下一个连接到达
+ * 才会被处理。之后到达的连接会再次触发父进程的事件。
+ * @param users 连接表
+*/
+template<typename T>
+void processpool<T>::take_notified(conn_table<T> & users) {
+    int command;
+    bool notified = false;
+    while (m_channels[m_idx].m_commands.pop(command)) {
+        child_stat->m_queued.fetch_sub(1, std::memory_order_relaxed);
+        notified = true;
+    }
+    while (notified) {
+        sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int connfd = accept(m_listenfd, (sockaddr *)&client_addr, &client_addr_len);
+        if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // 其他子进程可能已经取走了连接
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR("errno is: %d", errno);
+            }
+            break;
+        }
+        child_stat->m_accepted.fetch_add(1, std::memory_order_relaxed);
+        T * conn = users.acquire(connfd);
+        if (!conn) {
+            close(connfd);
+            continue;
+        }
+        child_stat->m_active.fetch_add(1, std::memory_order_relaxed);
+        add_fd(m_epollfd, connfd);
+        conn->init(m_epollfd, connfd, client_addr);
+    }
+}
+
+/**
+ * @brief SO_REUSEPORT 方式下子进程 accept 自己的监听 socket 上的所有连接
+ * @param users 连接表
+*/
+template<typename T>
+void processpool<T>::accept_conns(conn_table<T> & users) {
+    while (true) {
+        sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int connfd = accept4(m_listenfd, (sockaddr *)&client_addr,
+                             &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR("accept failure, errno is: %d", errno);
+            }
+            break;
+        }
+        child_stat->m_accepted.fetch_add(1, std::memory_order_relaxed);
+        T * conn = users.acquire(connfd);
+        if (!conn) {
+            close(connfd);
+            continue;
+        }
+        child_stat->m_active.fetch_add(1, std::memory_order_relaxed);
+        add_fd(m_epollfd, connfd);
+        conn->init(m_epollfd, connfd, client_addr);
+    }
+}
+
+/**
+ * @brief 创建子进程自己的监听 socket，绑定到与 m_listenfd 相同的地址
+ * @return 监听 socket，失败时返回 -1
+*/
+template<typename T>
+int processpool<T>::create_reuseport_listener() {
+    sockaddr_in address;
+    socklen_t len = sizeof(address);
+    if (getsockname(m_listenfd, (sockaddr *)&address, &len) < 0) {
+        return -1;
+    }
+    int fd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0
+        || bind(fd, (sockaddr *)&address, len) < 0
+        || listen(fd, SOMAXCONN) < 0) {
+        LOG_ERROR("create listener failure, errno is: %d", errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
 #endif
\ No newline at end of file
@@ -1,5 +1,15 @@
 #include <cstdio>
+#include "cgi_protocol.h"
 
-int main() {
+static int say_hi(const char *) {
     printf("hi!\n");
-}
\ No newline at end of file
+    return 0;
+}
+
+int main() {
+    // 由服务器作为常驻工作进程启动时，循环处理请求
+    if (cgi_is_worker()) {
+        return cgi_worker_main(say_hi);
+    }
+    return say_hi(nullptr);
+}
@@ -12,6 +12,7 @@
 #include <list>
 #include <exception>
 #include "../ch-14/locker.h"
+#include "async_log.h"
 
 /**
  * @brief 线程池类
@@ -46,7 +47,7 @@ private:
 template <typename T>
 threadpool<T>::threadpool(int thread_number, int max_requests)
 : m_thread_number(thread_number), m_max_requests(max_requests),
-  m_stop(false), m_threads(nullptr) {
+  m_queuelocker("threadpool::m_queuelocker"), m_stop(false), m_threads(nullptr) {
     if (thread_number<=0 || max_requests<=0) {
         throw std::exception();
     }
@@ -57,7 +58,7 @@ threadpool<T>::threadpool(int thread_number, int max_requests)
     }
 
     for (int i=0; i<m_thread_number; ++i) {
-        printf("create the %dth thread\n", i);
+        LOG_INFO("create the %dth thread", i);
         if (pthread_create(m_threads+i, nullptr, worker, this)) {
             delete [] m_threads;
             throw std::exception();
@@ -83,13 +84,13 @@ threadpool<T>::~threadpool() {
 */
 template <typename T>
 bool threadpool<T>::append(T * request) {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_requests) {
-        m_queuelocker.unlock();
-        return false;
+    {
+        scoped_lock<locker> guard(m_queuelocker);
+        if (m_workqueue.size() >= m_max_requests) {
+            return false;
+        }
+        m_workqueue.push_back(request);
     }
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
     m_queuestat.post();
     return true;
 }
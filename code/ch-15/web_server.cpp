@@ -19,12 +19,29 @@
 #include "../ch-14/locker.h"
 #include "http_conn.h"
 #include "threadpool.h"
+#include "metrics.h"
+#include "access_log.h"
 
 #define MAX_FD 65536
 #define MAX_EVENT_NUMBER 10000
 
 extern int add_fd(int epollfd, int fd, bool one_shot);
 extern void remove_fd(int epollfd, int fd);
+extern int set_nonblocking(int fd);
+
+// 用于处理信号的管道，以实现统一事件源
+static int sig_pipefd[2];
+
+/**
+ * @brief 信号处理器：通过信号管道传递信号
+ * @param sig 信号值
+*/
+static void sig_handler(int sig) {
+    int save_errno = errno;
+    int msg = sig;
+    send(sig_pipefd[1], (char *)&msg, 1, 0);
+    errno = save_errno;
+}
 
 /**
  * @brief 添加信号
@@ -54,11 +71,16 @@ void show_error(int connfd, const char * info) {
 
 int main(int argc, char * argv[]) {
     if (argc <= 2) {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
+        printf("usage: %s ip_address port_number [access_log_file]\n",
+               basename(argv[0]));
         return 1;
     }
     const char * ip = argv[1];
     int port = atoi(argv[2]);
+    if (argc > 3 && !access_log::open(argv[3])) {
+        printf("cannot open access log %s: %s\n", argv[3], strerror(errno));
+        return 1;
+    }
 
     // 忽略 SGIPIPE 信号
     add_sig(SIGPIPE, SIG_IGN);
@@ -97,11 +119,23 @@ int main(int argc, char * argv[]) {
     assert(epollfd != -1);
     add_fd(epollfd, listenfd, false);
     http_conn::m_epollfd = epollfd;
-    
-    while (true) {
+
+    // SIGHUP 用于日志轮转，SIGTERM/SIGINT 用于退出，SIGUSR1 输出锁竞争报告（需要用
+    // -DLOCKER_PROFILE 编译），都通过信号管道交给主循环处理
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sig_pipefd);
+    assert(ret != -1);
+    set_nonblocking(sig_pipefd[1]);
+    add_fd(epollfd, sig_pipefd[0], false);
+    add_sig(SIGHUP, sig_handler);
+    add_sig(SIGTERM, sig_handler);
+    add_sig(SIGINT, sig_handler);
+    add_sig(SIGUSR1, sig_handler);
+
+    bool stop_server = false;
+    while (!stop_server) {
         int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
         if (number < 0 && errno != EINTR) {
-            printf("epoll failure\n");
+            LOG_ERROR("epoll failure");
             break;
         }
 
@@ -113,14 +147,37 @@ int main(int argc, char * argv[]) {
                 int connfd = accept(listenfd, (sockaddr *)&client_addr,
                                 &client_addr_len);
                 if (connfd < 0) {
-                    printf("errno is: %d\n", errno);
+                    LOG_ERROR("errno is: %d", errno);
                     continue;
                 }
                 if (http_conn::m_user_count >= MAX_FD) {
+                    metrics::add(metrics::REJECTED);
                     show_error(connfd, "Internal server busy\n");
                     continue;
                 }
                 users[connfd].init(connfd, client_addr);
+            } else if (sockfd == sig_pipefd[0] && (events[i].events & EPOLLIN)) {
+                char signals[1024];
+                ret = recv(sig_pipefd[0], signals, sizeof(signals), 0);
+                for (int j=0; j<ret; ++j) {
+                    switch (signals[j]) {
+                        case SIGHUP: {
+                            if (!access_log::reopen()) {
+                                LOG_ERROR("failed to reopen access log");
+                            }
+                            break;
+                        }
+                        case SIGUSR1: {
+                            lock_profile_dump(stderr);
+                            break;
+                        }
+                        case SIGTERM:
+                        case SIGINT: {
+                            stop_server = true;
+                            break;
+                        }
+                    }
+                }
             } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 users[sockfd].close_conn();
             } else if (events[i].events & EPOLLIN) {
@@ -139,6 +196,9 @@ int main(int argc, char * argv[]) {
         }
     }
 
+    access_log::close();
+    close(sig_pipefd[0]);
+    close(sig_pipefd[1]);
     close(epollfd);
     close(listenfd);
     delete [] users;
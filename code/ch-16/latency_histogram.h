@@ -0,0 +1,116 @@
+/**
+ * @file latency_histogram.h
+ * @author
+ * @date 2026-10-18
+ * @brief HDR 风格的对数-线性延迟直方图
+ *
+ * 0~127 的值各占一个桶；之后每个 2 的幂区间 [64*2^k, 128*2^k) 被等分成 64 个
+ * 桶，桶宽为 2^k。因此任意值的相对误差都小于 1/64（约 1.6%），而记录一个值
+ * 只需几次位运算和一次自增，适合在压测的热路径上使用。
+*/
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstring>
+
+class latency_histogram {
+public:
+    latency_histogram() {
+        reset();
+    }
+
+    void reset() {
+        memset(m_counts, 0, sizeof(m_counts));
+        m_total = 0;
+        m_sum = 0;
+        m_min = -1;
+        m_max = 0;
+    }
+
+    /**
+     * @brief 记录一个值（负值按 0 记录）
+    */
+    void record(long long value) {
+        if (value < 0) value = 0;
+        ++m_counts[index_of(value)];
+        ++m_total;
+        m_sum += value;
+        if (m_min < 0 || value < m_min) m_min = value;
+        if (value > m_max) m_max = value;
+    }
+
+    /**
+     * @brief 将另一个直方图的数据合并进来
+    */
+    void merge(const latency_histogram & other) {
+        for (int i=0; i<BUCKET_NUMBER; ++i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        if (other.m_min >= 0 && (m_min < 0 || other.m_min < m_min)) {
+            m_min = other.m_min;
+        }
+        if (other.m_max > m_max) m_max = other.m_max;
+    }
+
+    /**
+     * @brief 获取百分位数
+     * @param percentile 百分位，取值范围 [0, 100]
+     * @return 对应的值（所在桶的上界，但不超过记录到的最大值）
+    */
+    long long percentile(double percentile) const {
+        if (m_total == 0) return 0;
+        long long rank = (long long)(percentile / 100.0 * m_total + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > m_total) rank = m_total;
+        long long seen = 0;
+        for (int i=0; i<BUCKET_NUMBER; ++i) {
+            seen += m_counts[i];
+            if (seen >= rank) {
+                long long value = upper_bound_of(i);
+                return value < m_max ? value : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    long long count() const { return m_total; }
+    long long min() const { return m_min < 0 ? 0 : m_min; }
+    long long max() const { return m_max; }
+    double mean() const { return m_total ? (double)m_sum / m_total : 0.0; }
+private:
+    static const int SUB_BITS = 6;
+    static const int SUB_COUNT = 1 << SUB_BITS;          // 每个区间的桶数
+    static const int MAX_SHIFT = 40;                     // 可记录的最大值约为 2^47
+    static const int BUCKET_NUMBER = 2 * SUB_COUNT + MAX_SHIFT * SUB_COUNT;
+
+    static int msb(unsigned long long v) {
+        return 63 - __builtin_clzll(v);
+    }
+
+    static int index_of(long long value) {
+        if (value < 2 * SUB_COUNT) return (int)value;
+        int shift = msb(value) - SUB_BITS;
+        if (shift > MAX_SHIFT) {
+            return BUCKET_NUMBER - 1;
+        }
+        return 2 * SUB_COUNT + (shift - 1) * SUB_COUNT +
+               (int)((value >> shift) - SUB_COUNT);
+    }
+
+    static long long upper_bound_of(int index) {
+        if (index < 2 * SUB_COUNT) return index;
+        int shift = (index - 2 * SUB_COUNT) / SUB_COUNT + 1;
+        long long sub = (index - 2 * SUB_COUNT) % SUB_COUNT + SUB_COUNT;
+        return ((sub + 1) << shift) - 1;
+    }
+private:
+    long long m_counts[BUCKET_NUMBER];
+    long long m_total;   // 记录的值的个数
+    long long m_sum;     // 记录的值的总和
+    long long m_min;
+    long long m_max;
+};
+
+#endif
@@ -3,22 +3,166 @@
  * @author
  * @date 2024-03-19
  * @brief 服务器压力测试程序
+ *
+ * 支持两种负载模式：
+ *   - 闭环（closed-loop）：每个连接上始终保持 pipeline 个未完成的请求，一个请求
+ *     完成后立即发出下一个。吞吐量由服务器的处理速度决定。
+ *   - 开环（open-loop）：按固定速率 -R 产生请求，与服务器是否及时应答无关。
+ *     请求的延迟从它“应当被发出”的时刻算起，服务器变慢时排队等待的时间也会被
+ *     计入，从而避免协调遗漏（coordinated omission）问题。
+ * 以及以下几种场景（-s）：
+ *   - keepalive：长连接，可写时立即发送（默认）
+ *   - churn：每个连接发出 -n 个请求后由客户端关闭并重新连接，-C 限制建连速率
+ *   - slowloris：每隔 -i 毫秒只发送请求的 -b 个字节，模拟慢慢发送头部的客户端
+ *   - slowread：缩小接收缓冲区，每隔 -i 毫秒只读取 -b 个字节，模拟不读应答的客户端
+ * 每个线程拥有自己的 epoll 实例和一组非阻塞连接，延迟记录在 HDR 直方图中，
+ * 结束时合并各线程的结果并以文本或 JSON 格式输出。除请求延迟外还报告建连
+ * 延迟、首字节时间（TTFB）、被服务器关闭或重置的连接数及这些连接的存活时间。
 */
 #include <sys/socket.h>
 #include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <ctime>
 #include <cstdio>
 #include <cstring>
 #include <cassert>
 #include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <functional>
+#include "latency_histogram.h"
 
 static const int MAX_EVENT_NUMBER = 10000;
-static const int EPOLL_WAIT_TIMEOUT = 2000;  // milli-second
 static const int BUFFER_SIZE = 2048;
-static const char * request = "GET /hi.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+static const int MAX_PIPELINE = 64;
+static const int SLOW_READ_RCVBUF = 4096;   // slowread 场景下套接字的接收缓冲区大小
+static const long long IDLE_WAKEUP = 100000000LL;   // 没有其他事件时最多等待 100ms
+static const char * DEFAULT_URL = "/hi.html";
+
+/**
+ * @brief 压测场景
+*/
+enum SCENARIO { KEEPALIVE = 0, CHURN, SLOWLORIS, SLOWREAD };
+static const char * scenario_names[] = { "keepalive", "churn", "slowloris", "slowread" };
+
+/**
+ * @brief 请求组合中的一种请求
+*/
+struct request_type {
+    std::string text;   // 完整的请求报文
+    int weight;         // 权重
+};
+
+/**
+ * @brief 命令行选项
+*/
+struct options {
+    const char * ip;
+    int port;
+    int threads;         // 线程数
+    int connections;     // 连接总数
+    int duration;        // 压测时长（秒）
+    double rate;         // 开环模式下每秒的请求数，0 表示闭环模式
+    int pipeline;        // 每个连接上未完成请求的最大数量
+    bool json;           // 以 JSON 格式输出结果
+    int scenario;        // 压测场景
+    int conn_requests;   // 每个连接上发出的请求数，0 表示不限
+    double connect_rate; // 每秒最多新建的连接数，0 表示不限
+    int slow_interval;   // slowloris/slowread 场景下两次读写的间隔（毫秒）
+    int slow_bytes;      // slowloris/slowread 场景下每次读写的字节数
+    std::vector<request_type> requests;
+    int total_weight;
+};
+
+static options g_opt;
+
+/**
+ * @brief 一个到服务器的连接
+*/
+struct connection {
+    enum STATE { CLOSED = 0, CONNECTING, ACTIVE };
+    int idx;                            // 在 worker::conns 中的下标
+    int fd;
+    int state;
+    bool idle;                          // 是否在 worker::idle 中
+    long long connect_start;            // 发起连接的时间
+    long long next_io;                  // slowloris/slowread 场景下下一次读写的时间
+    int issued;                         // 该连接上已发出的请求数
+    int done;                           // 该连接上已完成的请求数
+    std::string out;                    // 待发送的数据
+    size_t out_offset;                  // out 中已发送的字节数
+    long long inflight[MAX_PIPELINE];   // 未完成请求的起始时间（纳秒），按发送顺序排列
+    int inflight_head;
+    int inflight_count;
+    char in[BUFFER_SIZE];               // 读缓冲区
+    int in_len;
+    bool in_body;                       // 正在读取应答的消息体
+    long long body_remain;              // 消息体中尚未读取的字节数
+    int status;                         // 当前应答的状态码
+    bool ttfb_recorded;                 // 当前应答的首字节时间是否已记录
+};
+
+/**
+ * @brief 每个压测线程的状态和统计数据
+*/
+struct worker {
+    int id;
+    pthread_t tid;
+    int epollfd;
+    int conn_number;
+    std::vector<connection> conns;
+    unsigned int seed;                  // rand_r 的种子
+    long long interval;                 // 开环模式下两次请求的间隔（纳秒）
+    long long next_send;                // 开环模式下下一个请求应当发出的时间
+    std::deque<long long> backlog;      // 开环模式下尚未找到空闲连接的请求
+    // 开环模式下可能还能发出请求的连接，取出时再检查；按先进先出轮流使用
+    std::deque<int> idle;
+    // 等待重新建立的连接
+    std::deque<int> closed;
+    // slowloris/slowread 场景下的读写定时器：(时间, 连接下标)，最早的在堆顶。
+    // 连接的 next_io 改变后旧的定时器不再有效，取出时丢弃
+    std::priority_queue<std::pair<long long, int>, std::vector<std::pair<long long, int> >,
+                        std::greater<std::pair<long long, int> > > timers;
+    long long connect_interval;         // 两次建连之间的最小间隔（纳秒）
+    long long next_connect;             // 下一次允许建连的时间
+
+    latency_histogram latency;          // 请求延迟（微秒）
+    latency_histogram ttfb;             // 首字节时间（微秒）
+    latency_histogram connect_latency;  // 建连延迟（微秒）
+    latency_histogram lifetime;         // 被服务器关闭或重置的连接的存活时间（毫秒）
+    long long completed;                // 完成的请求数
+    long long status_count[6];          // 各类状态码 (1xx~5xx) 的应答数，下标 0 为无法解析
+    long long bytes_read;
+    long long bytes_written;
+    long long connects;                 // 成功建立的连接数
+    long long client_closes;            // 客户端主动关闭的连接数
+    long long server_closes;            // 被服务器关闭（读到 EOF）的连接数
+    long long resets;                   // 被服务器重置（ECONNRESET/EPIPE）的连接数
+    long long connect_errors;
+    long long io_errors;                // 其他读写错误的次数
+    long long lost_requests;            // 因连接关闭而没有得到应答的请求数
+};
+
+/**
+ * @brief 读取连接的结果
+*/
+enum READ_RESULT { READ_OK = 0, READ_EOF, READ_RESET, READ_ERROR };
+
+/**
+ * @brief 获取单调时钟的当前时间（纳秒）
+*/
+static long long now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
 /**
  * @brief 将指定文件描述符设为非阻塞的
@@ -32,139 +176,720 @@ int set_nonblocking(int fd) {
     return old_option;
 }
 
+static void flush_conn(worker * w, connection * c, long long now);
+static void on_conn_ready(worker * w, connection * c, long long now);
+
+/**
+ * @brief 设置连接下一次读写的时间，并加入定时器堆
+*/
+static void schedule_io(worker * w, connection * c, long long when) {
+    c->next_io = when;
+    w->timers.push(std::make_pair(when, c->idx));
+}
+
 /**
- * @brief 为指定的文件描述符注册事件
- * @param epollfd 标识 epoll 内核事件表的文件描述符
- * @param fd 被注册事件的文件描述符
+ * @brief 发起一个非阻塞连接
+ * @param w 所属的线程
+ * @param c 连接
+ * @param idx 连接在 w->conns 中的下标
 */
-void add_fd(int epollfd, int fd) {
+static void start_conn(worker * w, connection * c, int idx, long long now) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, g_opt.ip, &address.sin_addr);
+    address.sin_port = htons(g_opt.port);
+
+    c->state = connection::CLOSED;
+    c->connect_start = now;
+    c->next_io = 0;
+    c->issued = c->done = 0;
+    c->out.clear();
+    c->out_offset = 0;
+    c->inflight_head = c->inflight_count = 0;
+    c->in_len = 0;
+    c->in_body = false;
+    c->ttfb_recorded = false;
+
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        ++w->connect_errors;
+        c->fd = -1;
+        w->closed.push_back(idx);
+        return;
+    }
+    if (g_opt.scenario == SLOWREAD) {
+        // 必须在 connect 之前设置，才能影响通告的窗口大小
+        int rcvbuf = SLOW_READ_RCVBUF;
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    set_nonblocking(sockfd);
+    c->fd = sockfd;
+    int ret = connect(sockfd, (sockaddr *)&address, sizeof(address));
+    if (ret < 0 && errno != EINPROGRESS) {
+        ++w->connect_errors;
+        close(sockfd);
+        c->fd = -1;
+        w->closed.push_back(idx);
+        return;
+    }
     epoll_event event;
-    event.data.fd = fd;
-    event.events = EPOLLOUT | EPOLLET | EPOLLERR;
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    set_nonblocking(fd);
+    event.data.u64 = idx;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(w->epollfd, EPOLL_CTL_ADD, sockfd, &event);
+    c->state = connection::CONNECTING;
+    if (ret == 0) {
+        on_conn_ready(w, c, now);
+    }
 }
 
 /**
- * @brief 向服务器写入len字节的数据
- * @param sockfd socket文件描述符
- * @param buffer 存放要写入的数据的缓冲区
- * @param len 写入数据的长度
- * @return 是否写入成功
+ * @brief 关闭一个连接，其上未完成的请求都算作丢失。连接随后由 service_conns 重新建立
 */
-bool write_nbytes(int sockfd, const char * buffer, int len) {
-    int bytes_write = 0;
-    printf("writing out %d bytes of data to socket %d...\n", len, sockfd);
-    while (true) {
-        bytes_write = send(sockfd, buffer, len, 0);
-        if (bytes_write == -1) {
-            // handle error
-            return false;
-        } else if (bytes_write == 0) {
-            return false;
+static void close_conn(worker * w, connection * c) {
+    if (c->state == connection::CLOSED) {
+        return;
+    }
+    if (c->fd >= 0) {
+        epoll_ctl(w->epollfd, EPOLL_CTL_DEL, c->fd, 0);
+        close(c->fd);
+    }
+    w->lost_requests += c->inflight_count;
+    c->inflight_count = 0;
+    c->fd = -1;
+    c->state = connection::CLOSED;
+    w->closed.push_back(c->idx);
+}
+
+/**
+ * @brief 服务器关闭或重置了连接，记录连接的存活时间后关闭它
+*/
+static void close_by_server(worker * w, connection * c, bool reset, long long now) {
+    if (reset) {
+        ++w->resets;
+    } else {
+        ++w->server_closes;
+    }
+    w->lifetime.record((now - c->connect_start) / 1000000);
+    close_conn(w, c);
+}
+
+/**
+ * @brief 连接上是否还能发出新的请求
+*/
+static bool can_issue(const connection * c) {
+    return c->state == connection::ACTIVE && c->inflight_count < g_opt.pipeline &&
+           (g_opt.conn_requests == 0 || c->issued < g_opt.conn_requests);
+}
+
+/**
+ * @brief 按权重随机选择一种请求
+*/
+static const request_type & pick_request(worker * w) {
+    int r = rand_r(&w->seed) % g_opt.total_weight;
+    for (size_t i=0; i<g_opt.requests.size(); ++i) {
+        r -= g_opt.requests[i].weight;
+        if (r < 0) return g_opt.requests[i];
+    }
+    return g_opt.requests.back();
+}
+
+/**
+ * @brief 在连接上发出一个请求
+ * @param start 请求的起始时间，延迟从这一刻开始计算
+*/
+static void issue_request(worker * w, connection * c, long long start) {
+    const request_type & req = pick_request(w);
+    c->out.append(req.text);
+    int tail = (c->inflight_head + c->inflight_count) % MAX_PIPELINE;
+    c->inflight[tail] = start;
+    ++c->inflight_count;
+    ++c->issued;
+}
+
+/**
+ * @brief 开环模式下连接还能发出请求时放入空闲队列
+*/
+static void mark_idle(worker * w, connection * c) {
+    if (g_opt.rate > 0 && !c->idle && can_issue(c)) {
+        c->idle = true;
+        w->idle.push_back(c->idx);
+    }
+}
+
+/**
+ * @brief 为连接补充请求：闭环模式下补满 pipeline，开环模式下从积压队列中取
+*/
+static void fill_conn(worker * w, connection * c, long long now) {
+    bool issued = false;
+    while (can_issue(c)) {
+        if (g_opt.rate > 0) {
+            if (w->backlog.empty()) break;
+            issue_request(w, c, w->backlog.front());
+            w->backlog.pop_front();
+        } else {
+            issue_request(w, c, now);
+        }
+        issued = true;
+    }
+    if (issued) {
+        flush_conn(w, c, now);
+    }
+    mark_idle(w, c);
+}
+
+/**
+ * @brief 发送连接上待发送的数据。slowloris 场景下每隔一段时间只发送几个字节，
+ * 其他场景下尽可能多地发送
+*/
+static void flush_conn(worker * w, connection * c, long long now) {
+    bool slow = g_opt.scenario == SLOWLORIS;
+    if (slow && now < c->next_io) {
+        return;
+    }
+    while (c->out_offset < c->out.size()) {
+        size_t len = c->out.size() - c->out_offset;
+        if (slow && len > (size_t)g_opt.slow_bytes) {
+            len = g_opt.slow_bytes;
         }
-        len -= bytes_write;
-        buffer += bytes_write;
-        if (len <= 0) {
-            return true;
+        // 服务器重置连接后继续写会触发 SIGPIPE
+        int ret = send(c->fd, c->out.data() + c->out_offset, len, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;   // 等待 EPOLLOUT
+            }
+            if (errno == ECONNRESET || errno == EPIPE) {
+                close_by_server(w, c, true, now);
+            } else {
+                ++w->io_errors;
+                close_conn(w, c);
+            }
+            return;
+        }
+        c->out_offset += ret;
+        w->bytes_written += ret;
+        if (slow) {
+            schedule_io(w, c, now + g_opt.slow_interval * 1000000LL);
+            break;
         }
     }
+    if (c->out_offset == c->out.size()) {
+        c->out.clear();
+        c->out_offset = 0;
+    }
 }
 
 /**
- * @brief 从服务器读取数据
- * @param sockfd socket文件描述符
- * @param buffer 存放要读取的数据的缓冲区
- * @param len 要读取的数据的长度
- * @return 是否读取成功
+ * @brief 非阻塞连接建立完成
 */
-bool read_once(int sockfd, char * buffer, int len) {
-    int bytes_read = 0;
-    memset(buffer, '\0', len);
-    bytes_read = recv(sockfd, buffer, len, 0);
-    if (bytes_read == -1) {
-        // handle error
-        return false;
-    } else if (bytes_read == 0) {
-        return false;
+static void on_conn_ready(worker * w, connection * c, long long now) {
+    c->state = connection::ACTIVE;
+    ++w->connects;
+    w->connect_latency.record((now - c->connect_start) / 1000);
+    if (g_opt.scenario == SLOWREAD) {
+        schedule_io(w, c, now);
     }
-    printf("read in %d bytes from socket %d with content: %s\n", bytes_read,
-        sockfd, buffer);
-    return true;
+    fill_conn(w, c, now);
 }
 
 /**
- * @brief 向服务器发送num个TCP连接
- * @param epollfd 标识内核中epoll事件注册表的文件描述符
- * @param num 发起的TCP连接个数
- * @param ip ip地址
- * @param port 端口号
+ * @brief 一个应答接收完毕
 */
-void start_conn(int epollfd, int num, const char *ip, int port) {
-    int ret = 0;
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    inet_pton(AF_INET, ip, &address.sin_addr);
-    address.sin_port = ntohs(port);
-
-    for (int i=0; i<num; ++i) {
-        // sleep(1);
-        int sockfd = socket(PF_INET, SOCK_STREAM, 0);
-        printf("create 1 sock\n");
-        if (sockfd < 0) {
+static void on_response(worker * w, connection * c, long long now) {
+    if (c->inflight_count > 0) {
+        long long start = c->inflight[c->inflight_head];
+        c->inflight_head = (c->inflight_head + 1) % MAX_PIPELINE;
+        --c->inflight_count;
+        w->latency.record((now - start) / 1000);
+        if (!c->ttfb_recorded) {
+            w->ttfb.record((now - start) / 1000);
+        }
+    }
+    c->ttfb_recorded = false;
+    int cls = c->status / 100;
+    ++w->status_count[(cls >= 1 && cls <= 5) ? cls : 0];
+    ++w->completed;
+    ++c->done;
+}
+
+/**
+ * @brief 解析读缓冲区中的应答
+ * @return 应答格式是否正确
+*/
+static bool parse_responses(worker * w, connection * c, long long now) {
+    int pos = 0;
+    while (pos < c->in_len) {
+        if (c->in_body) {
+            long long avail = c->in_len - pos;
+            long long take = avail < c->body_remain ? avail : c->body_remain;
+            pos += take;
+            c->body_remain -= take;
+            if (c->body_remain == 0) {
+                c->in_body = false;
+                on_response(w, c, now);
+            }
             continue;
         }
-        if (connect(sockfd, (sockaddr *)&address, sizeof(address)) == 0) {
-            printf("build connection %d\n", i);
-            add_fd(epollfd, sockfd);
+        // 查找应答头部的结束位置
+        char * begin = c->in + pos;
+        char * end = (char *)memmem(begin, c->in_len - pos, "\r\n\r\n", 4);
+        if (!end) break;
+        *end = '\0';
+        c->status = 0;
+        if (strncmp(begin, "HTTP/", 5) == 0) {
+            char * sp = strchr(begin, ' ');
+            if (sp) c->status = atoi(sp + 1);
+        }
+        c->body_remain = 0;
+        char * cl = strcasestr(begin, "\r\nContent-Length:");
+        if (cl) {
+            c->body_remain = atoll(cl + 17);
+        }
+        pos = end + 4 - c->in;
+        c->in_body = true;
+        if (c->body_remain == 0) {
+            c->in_body = false;
+            on_response(w, c, now);
         }
     }
+    // 把未解析的数据移到缓冲区开头
+    if (pos > 0) {
+        memmove(c->in, c->in + pos, c->in_len - pos);
+        c->in_len -= pos;
+    }
+    // 下一个应答已经开始到达
+    if ((c->in_len > 0 || c->in_body) && !c->ttfb_recorded && c->inflight_count > 0) {
+        w->ttfb.record((now - c->inflight[c->inflight_head]) / 1000);
+        c->ttfb_recorded = true;
+    }
+    // 应答头部大到缓冲区装不下，视为错误
+    return c->in_len < BUFFER_SIZE;
 }
 
 /**
- * @brief 关闭一个连接并从epoll内核事件注册表中删除此连接的相关事件
- * @param epollfd 标识内核中epoll事件注册表的文件描述符
- * @param sockfd 标识socket连接的文件描述符
+ * @brief 读取连接上的应答
+ * @param limit 最多读取的字节数，<= 0 表示读到 EAGAIN 为止
 */
-void close_conn(int epollfd, int sockfd) {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, sockfd, 0);
-    close(sockfd);
+static int read_conn(worker * w, connection * c, long long now, int limit) {
+    while (true) {
+        int len = BUFFER_SIZE - c->in_len;
+        if (limit > 0 && len > limit) len = limit;
+        int ret = recv(c->fd, c->in + c->in_len, len, 0);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return READ_OK;
+            }
+            return errno == ECONNRESET ? READ_RESET : READ_ERROR;
+        } else if (ret == 0) {
+            return READ_EOF;
+        }
+        w->bytes_read += ret;
+        c->in_len += ret;
+        if (!parse_responses(w, c, now)) {
+            return READ_ERROR;
+        }
+        if (limit > 0) {
+            return READ_OK;
+        }
+    }
 }
 
-int main(int argc, char * argv[]) {
-    if (argc <= 3) {
-        printf("usage: %s ip_address port_number conncetion_number\n",
-                basename(argv[0]));
-        return 1;
+/**
+ * @brief 读取连接并根据结果关闭连接或补充请求
+*/
+static void handle_read(worker * w, connection * c, long long now, int limit) {
+    int ret = read_conn(w, c, now, limit);
+    // 连接上的请求都已完成，由客户端关闭
+    if (g_opt.conn_requests > 0 && c->done >= g_opt.conn_requests) {
+        ++w->client_closes;
+        close_conn(w, c);
+        return;
+    }
+    switch (ret) {
+        case READ_EOF: close_by_server(w, c, false, now); return;
+        case READ_RESET: close_by_server(w, c, true, now); return;
+        case READ_ERROR: ++w->io_errors; close_conn(w, c); return;
+        default: break;
+    }
+    fill_conn(w, c, now);
+}
+
+/**
+ * @brief 开环模式下把一个请求交给一个空闲连接，没有空闲连接时放入积压队列
+*/
+static void dispatch(worker * w, long long start, long long now) {
+    while (!w->idle.empty()) {
+        connection * c = &w->conns[w->idle.front()];
+        w->idle.pop_front();
+        c->idle = false;
+        // 放入队列之后连接可能已经关闭或发满了 pipeline
+        if (!can_issue(c)) continue;
+        issue_request(w, c, start);
+        flush_conn(w, c, now);
+        // 还能发出请求时放回队尾，请求轮流分配给各个空闲连接
+        mark_idle(w, c);
+        return;
+    }
+    w->backlog.push_back(start);
+}
+
+/**
+ * @brief 重新建立被关闭的连接，并执行 slowloris/slowread 场景下到期的读写。
+ * 只处理关闭队列和到期的定时器，不遍历所有连接
+ * @return 下一次需要被唤醒的时间
+*/
+static long long service_conns(worker * w, long long now) {
+    long long wakeup = now + IDLE_WAKEUP;
+    // 建连失败的连接会回到队尾，只处理本轮开始时已经在队列中的连接
+    size_t closed = w->closed.size();
+    for (size_t n=0; n<closed; ++n) {
+        if (w->connect_interval > 0 && w->next_connect > now) {
+            if (w->next_connect < wakeup) wakeup = w->next_connect;
+            break;
+        }
+        if (w->connect_interval > 0) {
+            // 空闲一段时间后不允许一次性补发积攒的建连配额
+            if (w->next_connect < now) w->next_connect = now;
+            w->next_connect += w->connect_interval;
+        }
+        int idx = w->closed.front();
+        w->closed.pop_front();
+        start_conn(w, &w->conns[idx], idx, now);
     }
-    
-    int epollfd = epoll_create(100);
-    start_conn(epollfd, atoi(argv[3]), argv[1], atoi(argv[2]));
+    while (!w->timers.empty() && w->timers.top().first <= now) {
+        long long when = w->timers.top().first;
+        connection * c = &w->conns[w->timers.top().second];
+        w->timers.pop();
+        if (c->state != connection::ACTIVE || c->next_io != when) continue;
+        if (g_opt.scenario == SLOWLORIS) {
+            if (c->out_offset < c->out.size()) {
+                flush_conn(w, c, now);
+            }
+        } else if (g_opt.scenario == SLOWREAD) {
+            schedule_io(w, c, now + g_opt.slow_interval * 1000000LL);
+            handle_read(w, c, now, g_opt.slow_bytes);
+        }
+    }
+    if (!w->timers.empty() && w->timers.top().first < wakeup) {
+        wakeup = w->timers.top().first;
+    }
+    return wakeup;
+}
+
+/**
+ * @brief 压测线程的主函数
+*/
+static void * run_worker(void * arg) {
+    worker * w = (worker *)arg;
+    w->epollfd = epoll_create(5);
+    assert(w->epollfd != -1);
+    w->conns.resize(w->conn_number);
+    for (int i=0; i<w->conn_number; ++i) {
+        w->conns[i].idx = i;
+        w->conns[i].fd = -1;
+        w->conns[i].state = connection::CLOSED;
+        w->conns[i].idle = false;
+        w->closed.push_back(i);
+    }
+
     epoll_event events[MAX_EVENT_NUMBER];
-    char buffer[BUFFER_SIZE];
-    while (true) {
-        int fds = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, EPOLL_WAIT_TIMEOUT);
-        for (int i=0; i<fds; ++i) {
-            int sockfd = events[i].data.fd;
-            if (events[i].events & EPOLLIN) {
-                if (!read_once(sockfd, buffer, BUFFER_SIZE)) {
-                    close_conn(epollfd, sockfd);
+    long long begin = now_ns();
+    long long end = begin + (long long)g_opt.duration * 1000000000LL;
+    w->next_send = begin;
+    w->next_connect = begin;
+    long long now = begin;
+    while (now < end) {
+        long long wakeup = service_conns(w, now);
+        if (g_opt.rate > 0 && w->next_send < wakeup) {
+            wakeup = w->next_send;
+        }
+        int timeout = wakeup <= now ? 0 : (int)((wakeup - now + 999999) / 1000000);
+        int number = epoll_wait(w->epollfd, events, MAX_EVENT_NUMBER, timeout);
+        if (number < 0 && errno != EINTR) {
+            printf("epoll failure\n");
+            break;
+        }
+        now = now_ns();
+        for (int i=0; i<number; ++i) {
+            connection * c = &w->conns[events[i].data.u64];
+            if (c->state == connection::CLOSED) continue;
+            if (c->state == connection::CONNECTING) {
+                int error = 0;
+                socklen_t len = sizeof(error);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                if (error != 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                    ++w->connect_errors;
+                    close_conn(w, c);
+                    continue;
                 }
-                struct epoll_event event;
-                event.events = EPOLLOUT | EPOLLET | EPOLLERR;
-                event.data.fd = sockfd;
-                epoll_ctl(epollfd, EPOLL_CTL_MOD, sockfd, &event);
-            } else if (events[i].events & EPOLLOUT) {
-                if (!write_nbytes(sockfd, request, strlen(request))) {
-                    close_conn(epollfd, sockfd);
+                if (events[i].events & EPOLLOUT) {
+                    on_conn_ready(w, c, now);
                 }
-                struct epoll_event event;
-                event.events = EPOLLIN | EPOLLET | EPOLLERR;
-                event.data.fd = sockfd;
-                epoll_ctl(epollfd, EPOLL_CTL_MOD, sockfd, &event);
-            } else if (events[i].events & EPOLLERR) {
-                close_conn(epollfd, sockfd);
+            }
+            // slowread 场景下只在定时器到期时读取
+            if (c->state == connection::ACTIVE && g_opt.scenario != SLOWREAD &&
+                (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR))) {
+                handle_read(w, c, now, 0);
+            }
+            if (c->state == connection::ACTIVE && (events[i].events & EPOLLOUT)) {
+                flush_conn(w, c, now);
+            }
+        }
+        // 开环模式：发出所有已经到时间的请求
+        if (g_opt.rate > 0) {
+            while (w->next_send <= now) {
+                dispatch(w, w->next_send, now);
+                w->next_send += w->interval;
             }
         }
     }
-}
\ No newline at end of file
+
+    // 压测结束时仍在积压队列中的请求也算作丢失
+    w->lost_requests += w->backlog.size();
+    for (int i=0; i<w->conn_number; ++i) {
+        close_conn(w, &w->conns[i]);
+    }
+    close(w->epollfd);
+    return w;
+}
+
+/**
+ * @brief 以 JSON 格式输出一个直方图的摘要
+*/
+static void print_histogram_json(const char * name, const latency_histogram & h) {
+    printf("\"%s\":{\"count\":%lld,\"min\":%lld,\"mean\":%.1f,\"p50\":%lld,"
+           "\"p90\":%lld,\"p99\":%lld,\"p99.9\":%lld,\"max\":%lld}",
+           name, h.count(), h.min(), h.mean(), h.percentile(50),
+           h.percentile(90), h.percentile(99), h.percentile(99.9), h.max());
+}
+
+/**
+ * @brief 以文本格式输出一个直方图的摘要
+*/
+static void print_histogram(const char * name, const latency_histogram & h) {
+    printf("%-18s min %lld, mean %.1f, p50 %lld, p90 %lld, p99 %lld, "
+           "p99.9 %lld, max %lld\n", name, h.min(), h.mean(),
+           h.percentile(50), h.percentile(90), h.percentile(99),
+           h.percentile(99.9), h.max());
+}
+
+/**
+ * @brief 以文本或 JSON 格式输出汇总结果
+*/
+static void report(const std::vector<worker *> & workers, double elapsed) {
+    worker total = worker();
+    for (size_t i=0; i<workers.size(); ++i) {
+        worker * w = workers[i];
+        total.latency.merge(w->latency);
+        total.ttfb.merge(w->ttfb);
+        total.connect_latency.merge(w->connect_latency);
+        total.lifetime.merge(w->lifetime);
+        total.completed += w->completed;
+        total.bytes_read += w->bytes_read;
+        total.bytes_written += w->bytes_written;
+        total.connects += w->connects;
+        total.client_closes += w->client_closes;
+        total.server_closes += w->server_closes;
+        total.resets += w->resets;
+        total.connect_errors += w->connect_errors;
+        total.io_errors += w->io_errors;
+        total.lost_requests += w->lost_requests;
+        for (int j=0; j<6; ++j) total.status_count[j] += w->status_count[j];
+    }
+    const long long * status = total.status_count;
+    double throughput = total.completed / elapsed;
+    if (g_opt.json) {
+        printf("{\"scenario\":\"%s\",\"mode\":\"%s\",\"threads\":%d,"
+               "\"connections\":%d,\"pipeline\":%d,\"target_rate\":%.1f,"
+               "\"duration_s\":%.3f,\"requests\":%lld,\"throughput_rps\":%.1f,"
+               "\"bytes_read\":%lld,\"bytes_written\":%lld,"
+               "\"conns\":{\"opened\":%lld,\"client_closed\":%lld,"
+               "\"server_closed\":%lld,\"reset\":%lld},"
+               "\"errors\":{\"connect\":%lld,\"io\":%lld,\"lost_requests\":%lld},"
+               "\"status\":{\"1xx\":%lld,\"2xx\":%lld,\"3xx\":%lld,\"4xx\":%lld,"
+               "\"5xx\":%lld,\"invalid\":%lld},",
+               scenario_names[g_opt.scenario], g_opt.rate > 0 ? "open" : "closed",
+               g_opt.threads, g_opt.connections, g_opt.pipeline, g_opt.rate,
+               elapsed, total.completed, throughput, total.bytes_read,
+               total.bytes_written, total.connects, total.client_closes,
+               total.server_closes, total.resets, total.connect_errors,
+               total.io_errors, total.lost_requests,
+               status[1], status[2], status[3], status[4], status[5], status[0]);
+        print_histogram_json("latency_us", total.latency);
+        printf(",");
+        print_histogram_json("ttfb_us", total.ttfb);
+        printf(",");
+        print_histogram_json("connect_us", total.connect_latency);
+        printf(",");
+        print_histogram_json("server_close_lifetime_ms", total.lifetime);
+        printf("}\n");
+        return;
+    }
+    printf("scenario: %s, mode: %s-loop, %d threads, %d connections, pipeline %d",
+           scenario_names[g_opt.scenario], g_opt.rate > 0 ? "open" : "closed",
+           g_opt.threads, g_opt.connections, g_opt.pipeline);
+    if (g_opt.rate > 0) {
+        printf(", target %.1f req/s", g_opt.rate);
+    }
+    printf("\n%lld requests in %.2fs, %.1f req/s, read %lld bytes, "
+           "wrote %lld bytes\n", total.completed, elapsed, throughput,
+           total.bytes_read, total.bytes_written);
+    printf("status: 2xx %lld, 3xx %lld, 4xx %lld, 5xx %lld, other %lld\n",
+           status[2], status[3], status[4], status[5], status[0] + status[1]);
+    printf("connections: opened %lld, closed by client %lld, closed by server %lld, "
+           "reset %lld\n", total.connects, total.client_closes,
+           total.server_closes, total.resets);
+    printf("errors: connect %lld, io %lld, lost requests %lld\n",
+           total.connect_errors, total.io_errors, total.lost_requests);
+    print_histogram("latency (us):", total.latency);
+    print_histogram("ttfb (us):", total.ttfb);
+    print_histogram("connect (us):", total.connect_latency);
+    if (total.lifetime.count() > 0) {
+        print_histogram("server close (ms):", total.lifetime);
+    }
+}
+
+/**
+ * @brief 解析形如 "url[:weight]" 的请求组合项
+*/
+static void add_request(const char * spec) {
+    request_type req;
+    std::string url(spec);
+    req.weight = 1;
+    size_t colon = url.rfind(':');
+    if (colon != std::string::npos) {
+        req.weight = atoi(url.c_str() + colon + 1);
+        url.erase(colon);
+        if (req.weight <= 0) req.weight = 1;
+    }
+    req.text = "GET " + url + " HTTP/1.1\r\nHost: " + g_opt.ip +
+               "\r\nConnection: keep-alive\r\n\r\n";
+    g_opt.requests.push_back(req);
+    g_opt.total_weight += req.weight;
+}
+
+/**
+ * @brief 根据名字查找压测场景
+ * @return 场景编号，找不到时返回 -1
+*/
+static int parse_scenario(const char * name) {
+    for (int i=0; i<(int)(sizeof(scenario_names)/sizeof(scenario_names[0])); ++i) {
+        if (strcmp(name, scenario_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static void usage(const char * prog) {
+    printf("usage: %s [options] ip_address port_number [connection_number]\n"
+           "  -c N     total number of connections (default 1)\n"
+           "  -t N     number of threads, one epoll per thread (default 1)\n"
+           "  -d SEC   test duration in seconds (default 10)\n"
+           "  -R RATE  open-loop mode with a fixed rate of RATE req/s\n"
+           "           (default: closed-loop)\n"
+           "  -p N     pipelining depth per connection (default 1, max %d)\n"
+           "  -r URL[:WEIGHT]  add a request to the mix, may be repeated\n"
+           "           (default %s)\n"
+           "  -s NAME  scenario: keepalive, churn, slowloris or slowread\n"
+           "           (default keepalive)\n"
+           "  -n N     requests per connection before the client closes it\n"
+           "           (default 1 for churn, unlimited otherwise)\n"
+           "  -C RATE  limit new connections to RATE per second\n"
+           "  -i MS    slowloris/slowread: interval between reads/writes\n"
+           "           (default 1000)\n"
+           "  -b N     slowloris/slowread: bytes per read/write\n"
+           "           (default 1 for slowloris, 1024 for slowread)\n"
+           "  -j       print the result as JSON\n", prog, MAX_PIPELINE, DEFAULT_URL);
+}
+
+int main(int argc, char * argv[]) {
+    g_opt.threads = 1;
+    g_opt.connections = 1;
+    g_opt.duration = 10;
+    g_opt.rate = 0;
+    g_opt.pipeline = 1;
+    g_opt.json = false;
+    g_opt.scenario = KEEPALIVE;
+    g_opt.conn_requests = -1;
+    g_opt.connect_rate = 0;
+    g_opt.slow_interval = 1000;
+    g_opt.slow_bytes = 0;
+    g_opt.total_weight = 0;
+    std::vector<const char *> urls;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:d:R:p:r:s:n:C:i:b:jh")) != -1) {
+        switch (opt) {
+            case 'c': g_opt.connections = atoi(optarg); break;
+            case 't': g_opt.threads = atoi(optarg); break;
+            case 'd': g_opt.duration = atoi(optarg); break;
+            case 'R': g_opt.rate = atof(optarg); break;
+            case 'p': g_opt.pipeline = atoi(optarg); break;
+            case 'r': urls.push_back(optarg); break;
+            case 's': g_opt.scenario = parse_scenario(optarg); break;
+            case 'n': g_opt.conn_requests = atoi(optarg); break;
+            case 'C': g_opt.connect_rate = atof(optarg); break;
+            case 'i': g_opt.slow_interval = atoi(optarg); break;
+            case 'b': g_opt.slow_bytes = atoi(optarg); break;
+            case 'j': g_opt.json = true; break;
+            default: usage(basename(argv[0])); return 1;
+        }
+    }
+    if (argc - optind < 2) {
+        usage(basename(argv[0]));
+        return 1;
+    }
+    g_opt.ip = argv[optind];
+    g_opt.port = atoi(argv[optind+1]);
+    if (argc - optind > 2) {
+        g_opt.connections = atoi(argv[optind+2]);
+    }
+    if (g_opt.conn_requests < 0) {
+        g_opt.conn_requests = g_opt.scenario == CHURN ? 1 : 0;
+    }
+    if (g_opt.slow_bytes == 0) {
+        g_opt.slow_bytes = g_opt.scenario == SLOWREAD ? 1024 : 1;
+    }
+    if (g_opt.threads <= 0 || g_opt.connections < g_opt.threads ||
+        g_opt.duration <= 0 || g_opt.pipeline <= 0 ||
+        g_opt.pipeline > MAX_PIPELINE || g_opt.rate < 0 ||
+        g_opt.scenario < 0 || g_opt.connect_rate < 0 ||
+        g_opt.slow_interval <= 0 || g_opt.slow_bytes <= 0) {
+        usage(basename(argv[0]));
+        return 1;
+    }
+    if (urls.empty()) {
+        urls.push_back(DEFAULT_URL);
+    }
+    for (size_t i=0; i<urls.size(); ++i) {
+        add_request(urls[i]);
+    }
+
+    std::vector<worker *> workers;
+    long long begin = now_ns();
+    for (int i=0; i<g_opt.threads; ++i) {
+        worker * w = new worker();
+        w->id = i;
+        w->conn_number = g_opt.connections / g_opt.threads +
+                         (i < g_opt.connections % g_opt.threads ? 1 : 0);
+        w->seed = 12345 + i;
+        w->interval = g_opt.rate > 0 ?
+                      (long long)(1e9 * g_opt.threads / g_opt.rate) : 0;
+        if (g_opt.rate > 0 && w->interval <= 0) w->interval = 1;
+        w->connect_interval = g_opt.connect_rate > 0 ?
+                      (long long)(1e9 * g_opt.threads / g_opt.connect_rate) : 0;
+        if (pthread_create(&w->tid, nullptr, run_worker, w) != 0) {
+            printf("failed to create thread %d\n", i);
+            return 1;
+        }
+        workers.push_back(w);
+    }
+    for (size_t i=0; i<workers.size(); ++i) {
+        pthread_join(workers[i]->tid, nullptr);
+    }
+    double elapsed = (now_ns() - begin) / 1e9;
+    report(workers, elapsed);
+    for (size_t i=0; i<workers.size(); ++i) {
+        delete workers[i];
+    }
+    return 0;
+}